@@ -1,8 +1,30 @@
+#define _GNU_SOURCE
+
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 // Sorts entries of array keys into array outKeys per the count sort algorithm.
 //
@@ -115,17 +137,27 @@ typedef struct dateTime {
     unsigned int second;    // [0, 59]
 } DateTime;
 
+// Returns true if the given year is a leap year in the proleptic Gregorian calendar.
+bool IsLeapYear(unsigned int year)
+{
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+// Returns the number of days in the given month, [1, 12], of the given year.
+unsigned int DaysInMonth(unsigned int year, unsigned int month)
+{
+    static const unsigned int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    return (month == 2 && IsLeapYear(year)) ? 29 : days[month - 1];
+}
+
 // Returns true if all fields of the given DateTime are within
-// valid ranges.
-//
-// This function does not validate if date is semantically accurate
-// i.e., it does nottest  if the represented date exists on the calendar.
+// valid ranges, and the day exists in its month.
 bool IsDateTimeValid(DateTime* dateTime)
 {
     return dateTime
         && InRange(dateTime->year, 0, 9999)
         && InRange(dateTime->month, 1, 12)
-        && InRange(dateTime->day, 1, 31)
+        && InRange(dateTime->day, 1, DaysInMonth(dateTime->year, dateTime->month))
         && InRange(dateTime->hour, 0, 23)
         && InRange(dateTime->minute, 0, 59)
         && InRange(dateTime->second, 0, 59);
@@ -222,137 +254,112 @@ bool DateTimeLessThan(const DateTime* lhs, const DateTime* rhs)
     return (lhs->second < rhs->second);
 }
 
-// Adds or subtracts the given offset from the given val, wrapping the result if
-// outside the range [min, max].
-// Returns signed carryover, i.e., number of wraps performed.
-int OffsetAndWrap(unsigned int* val, int offset, unsigned int min, unsigned int max)
-{
-    if (val == NULL) {
-        return 0;
-    }
-
-    // If starting value isn't in [min, max] range, wrapping is undefined
-    if (!InRange(*val, min, max)) {
-        return 0;
-    }
-
-    int carry = 0;
-
-    // Remap range to [0, (max - min)]
-    int tempVal = (int)(*val - min);
-    int tempMax = (int)(max - min);
+// Days in a 400 year era of the proleptic Gregorian calendar. Shifting years by one era keeps
+// every supported year non-negative in the civil conversions below, so their divisions
+// truncate the same as they floor.
+#define DAYS_PER_ERA 146097
+#define DAYS_TO_EPOCH_FROM_ERA_START (719468 + DAYS_PER_ERA)  // From 0000-03-01, less an era, to 1970-01-01
+#define SECONDS_PER_DAY 86400
 
-    int newVal = tempVal + offset;
-    if (!InRange(newVal, 0, tempMax)) {
-
-        if (newVal < 0) {
-            carry = -1;
-            carry -= abs(newVal) / (tempMax + 1);
-        }
-        else {
-            carry += newVal / (tempMax + 1);
-        }
-
-        newVal = newVal % (tempMax + 1);
-        if (newVal < 0) {
-            newVal = (tempMax + 1) - abs(newVal);
-        }
-    }
-    
-    // Unmap range
-    newVal += min;
-    
-    *val = newVal;
-
-    return carry;
-}
-
-bool DoOffsetAndWrapTest(
-    unsigned int* val,
-    int* carry,
-    unsigned int startVal,
-    int offset,
-    unsigned int min,
-    unsigned int max,
-    unsigned int expectedVal,
-    int expectedCarry)
+// Returns the number of days from 1970-01-01 to the given date of the proleptic Gregorian
+// calendar, for years in [0, 9999]. Days past the end of their month count on into the next.
+//
+// Years are taken to start on March 1, so that the leap day is the last day of the year and
+// the days before each month follow a fixed formula, with no tables or branches.
+int64_t DaysFromCivil(unsigned int year, unsigned int month, unsigned int day)
 {
-    if (val == NULL || carry == NULL) {
-        return false;
-    }
-
-    *val = startVal;
-    *carry = OffsetAndWrap(val, offset, min, max);
-    printf("%d + %d = %d (carry %d)\n", startVal, offset, *val, *carry);
+    const unsigned int shiftedYear = year + 400 - (month <= 2);
+    const unsigned int era = shiftedYear / 400;
+    const unsigned int yearOfEra = shiftedYear - era * 400;                        // [0, 399]
+    const unsigned int dayOfYear = (153 * ((month + 9) % 12) + 2) / 5 + day - 1;    // [0, 365]
+    const unsigned int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
 
-    return (*val == expectedVal) && (*carry == expectedCarry);
+    return (int64_t)era * DAYS_PER_ERA + dayOfEra - DAYS_TO_EPOCH_FROM_ERA_START;
 }
 
-bool TestOffsetAndWrap()
+// Populates the year, month and day of the given DateTime from the given number of days since
+// 1970-01-01. The inverse of DaysFromCivil. Returns false if the year falls outside [0, 9999].
+bool CivilFromDays(int64_t days, DateTime* dateTime)
 {
-    unsigned int val = 0;
-    int carry = 0;
-
-    if (!DoOffsetAndWrapTest(&val, &carry, 8, 1, 0, 9, 9, 0)) {
+    const int64_t shiftedDays = days + DAYS_TO_EPOCH_FROM_ERA_START;
+    if (shiftedDays < 0) {
         return false;
     }
 
-    if (!DoOffsetAndWrapTest(&val, &carry, 8, 4, 0, 9, 2, 1)) {
-        return false;
-    }
+    const int64_t era = shiftedDays / DAYS_PER_ERA;
+    const unsigned int dayOfEra = (unsigned int)(shiftedDays - era * DAYS_PER_ERA);
+    const unsigned int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const unsigned int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const unsigned int shiftedMonth = (5 * dayOfYear + 2) / 153;                   // [0, 11] from March
+    const unsigned int month = (shiftedMonth + 2) % 12 + 1;
+    const int64_t year = era * 400 + yearOfEra - 400 + (month <= 2);
 
-    if (!DoOffsetAndWrapTest(&val, &carry, 8, -8, 0, 9, 0, 0)) {
+    if (year < 0 || year > 9999) {
         return false;
     }
 
-    if (!DoOffsetAndWrapTest(&val, &carry, 8, -10, 0, 9, 8, -1)) {
-        return false;
-    }
+    dateTime->year = (unsigned int)year;
+    dateTime->month = month;
+    dateTime->day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+    return true;
+}
 
-    if (!DoOffsetAndWrapTest(&val, &carry, 10, 6, 1, 12, 4, 1)) {
-        return false;
-    }
-    
-    if (!DoOffsetAndWrapTest(&val, &carry, 2, -4, 1, 12, 10, -1)) {
-        return false;
+// Returns the number of seconds from 1970-01-01T00:00:00Z to the given valid DateTime.
+int64_t EpochSecondsFromDateTime(const DateTime* dateTime)
+{
+    return DaysFromCivil(dateTime->year, dateTime->month, dateTime->day) * SECONDS_PER_DAY
+        + dateTime->hour * 3600 + dateTime->minute * 60 + dateTime->second;
+}
+
+// Populates the given DateTime from the given number of seconds since 1970-01-01T00:00:00Z.
+// Returns false if the year falls outside [0, 9999].
+bool DateTimeFromEpochSeconds(int64_t seconds, DateTime* dateTime)
+{
+    // Floor division, as seconds before the epoch are negative
+    int64_t days = seconds / SECONDS_PER_DAY;
+    int64_t secondOfDay = seconds - days * SECONDS_PER_DAY;
+    if (secondOfDay < 0) {
+        secondOfDay += SECONDS_PER_DAY;
+        days--;
     }
 
-    if (!DoOffsetAndWrapTest(&val, &carry, 10, 24, 1, 12, 10, 2)) {
+    if (!CivilFromDays(days, dateTime)) {
         return false;
     }
 
+    dateTime->hour = (unsigned int)(secondOfDay / 3600);
+    dateTime->minute = (unsigned int)(secondOfDay / 60 % 60);
+    dateTime->second = (unsigned int)(secondOfDay % 60);
     return true;
 }
 
 // Applies the given hour and minute offsets to the given DateTime.
-// Overflow is handled automatically.
+// The DateTime is converted to seconds since the epoch, offset with a single add and
+// converted back, so carries across month and year ends land on real calendar dates.
 // Returns true if the resulting DateTime is still valid.
 bool OffsetDateTime(DateTime* dateTime, int hours, int minutes)
 {
-    if (dateTime == NULL) {
+    if (dateTime == NULL || !IsDateTimeValid(dateTime)) {
         return false;
     }
 
-    int days = 0;
-    int months = 0;
-    int years = 0;
+    return DateTimeFromEpochSeconds(EpochSecondsFromDateTime(dateTime) + hours * 3600 + minutes * 60, dateTime);
+}
 
-    hours += OffsetAndWrap(&dateTime->minute, minutes, 0, 59);
-    days += OffsetAndWrap(&dateTime->hour, hours, 0, 23);
-    months += OffsetAndWrap(&dateTime->day, days, 1, 31);
-    years += OffsetAndWrap(&dateTime->month, months, 1, 12);
-    OffsetAndWrap(&dateTime->year, years, 0, 9999);
-    
-    return IsDateTimeValid(dateTime);
+// Returns the character at the given position in the given source buffer of srcLength
+// characters, or a null terminator if the position is past the end of the buffer.
+char CharAt(const char* src, size_t srcLength, size_t pos)
+{
+    return pos < srcLength ? src[pos] : '\0';
 }
 
 // Copies length number of characters at the given start position from the given source
 // buffer into the given destination buffer, provided all encountered characters are digits.
 // Returns true if the given length of digits was copied.
-bool CopyDigits(char* dst, const char* src, size_t start, size_t length, size_t* outPos)
+bool CopyDigits(char* dst, const char* src, size_t srcLength, size_t start, size_t length, size_t* outPos)
 {
     for (size_t i = 0; i < length; i++) {
-        char c = src[i + start];
+        char c = CharAt(src, srcLength, i + start);
 
         if (c == '\0' || c < '0' || c > '9') {
             return false;
@@ -373,19 +380,20 @@ bool TestCopyDigits()
     printf("Testing CopyDigits()...\n");
 
     const char* digits = "1234-5678";
+    const size_t digitsLength = strlen(digits);
     char lhs[5] = { '\0' };
     char rhs[5] = { '\0' };
     char err[5] = { '\0' };
 
     size_t pos = 0;
 
-    if (!CopyDigits(lhs, digits, pos, 4, &pos)){
+    if (!CopyDigits(lhs, digits, digitsLength, pos, 4, &pos)){
         return false;
     }
 
     pos++; // consume '-'
 
-    if (!CopyDigits(rhs, digits, pos, 4, &pos)) {
+    if (!CopyDigits(rhs, digits, digitsLength, pos, 4, &pos)) {
         return false;
     }
 
@@ -398,12 +406,12 @@ bool TestCopyDigits()
     }
 
     // Should fail if encounters non-digit
-    if (CopyDigits(err, digits, 0, 5, &pos)) {
+    if (CopyDigits(err, digits, digitsLength, 0, 5, &pos)) {
         return false;
     }
 
     // Should fail if string isn't long enough
-    if (CopyDigits(err, digits, 5, 5, &pos)) {
+    if (CopyDigits(err, digits, digitsLength, 5, 5, &pos)) {
         return false;
     }
 
@@ -434,20 +442,46 @@ bool IntFromChars(unsigned int* dst, char* src, size_t n)
 }
 
 // Returns true if the given value appears at the given position in the given soruce buffer.
-bool ExpectChar(const char* src, size_t offset, char val)
+bool ExpectChar(const char* src, size_t srcLength, size_t offset, char val)
 {
-    return src[offset] == val;
+    return CharAt(src, srcLength, offset) == val;
 }
 
-// Initializes the given DateTime using the given, null-terminated ISO 8601 date string.
-// Returns true if the DateTime is left in a valid state.
+// Reasons an ISO 8601 date string can be rejected
+typedef enum isoParseError {
+    ISO_PARSE_ERROR_NONE,
+    ISO_PARSE_ERROR_BAD_DIGIT,      // A non-digit, or the end of the string, where a digit belongs
+    ISO_PARSE_ERROR_BAD_SEPARATOR,  // A missing '-', 'T' or ':', or characters after the date
+    ISO_PARSE_ERROR_BAD_TZD,        // A time zone designator that isn't Z, +hh:mm or -hh:mm
+    ISO_PARSE_ERROR_OUT_OF_RANGE,   // A field outside its valid range
+    ISO_PARSE_ERROR_COUNT,
+} IsoParseError;
+
+// Records the given error for the caller, if it asked for one, and returns false.
+bool IsoParseFailed(IsoParseError* outError, IsoParseError error)
+{
+    if (outError) {
+        *outError = error;
+    }
+    return false;
+}
+
+// Initializes the given DateTime using the ISO 8601 date string held in the first length
+// characters of the given buffer, which need not be null-terminated. This allows dates to be
+// parsed in place, e.g., from a memory mapped file.
+// Returns true if the DateTime is left in a valid state; otherwise, if outError is given, it
+// receives the reason the string was rejected.
 //
 // ISO 8601 date-time format is YYYY-MM-DDThh:mm:ss[Z | +hh:mm | -hh:mm]
 //
-// Trailing whitespace at the end of the string is allowed, but the string must still
-// end with a null terminator.
-bool PopulateDateTimeFromIsoString(const char* isoString, DateTime* dateTime)
+// Trailing whitespace at the end of the string is allowed. A null terminator within the
+// buffer ends the string early.
+bool ParseIsoDateTime(const char* isoChars, size_t length, DateTime* dateTime, IsoParseError* outError)
 {
+    if (outError) {
+        *outError = ISO_PARSE_ERROR_NONE;
+    }
+
     if (!dateTime) {
         return false;
     }
@@ -462,68 +496,68 @@ bool PopulateDateTimeFromIsoString(const char* isoString, DateTime* dateTime)
     char second[2];    // [0. 59]
 
     // Read year
-    if (!CopyDigits(year, isoString, seekPos, 4, &seekPos)) {
-        return false;
+    if (!CopyDigits(year, isoChars, length, seekPos, 4, &seekPos)) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_DIGIT);
     }
     IntFromChars(&(dateTime->year), year, 4);
 
     // Consume '-'
-    if (!ExpectChar(isoString, seekPos++, '-')) {
-        return false;
+    if (!ExpectChar(isoChars, length, seekPos++, '-')) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_SEPARATOR);
     }
 
     // Read month
-    if (!CopyDigits(month, isoString, seekPos, 2, &seekPos)) {
-        return false;
+    if (!CopyDigits(month, isoChars, length, seekPos, 2, &seekPos)) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_DIGIT);
     }
     IntFromChars(&(dateTime->month), month, 2);
 
     // Consume '-'
-    if (!ExpectChar(isoString, seekPos++, '-')) {
-        return false;
+    if (!ExpectChar(isoChars, length, seekPos++, '-')) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_SEPARATOR);
     }
 
     // Read day
-    if (!CopyDigits(day, isoString, seekPos, 2, &seekPos)) {
-        return false;
+    if (!CopyDigits(day, isoChars, length, seekPos, 2, &seekPos)) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_DIGIT);
     }
     IntFromChars(&(dateTime->day), day, 2);
 
     // Consume 'T'
-    if (!ExpectChar(isoString, seekPos++, 'T')) {
-        return false;
+    if (!ExpectChar(isoChars, length, seekPos++, 'T')) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_SEPARATOR);
     }
 
     // Read hour
-    if (!CopyDigits(hour, isoString, seekPos, 2, &seekPos)) {
-        return false;
+    if (!CopyDigits(hour, isoChars, length, seekPos, 2, &seekPos)) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_DIGIT);
     }
     IntFromChars(&(dateTime->hour), hour, 2);
 
     // Consume ':'
-    if (!ExpectChar(isoString, seekPos++, ':')) {
-        return false;
+    if (!ExpectChar(isoChars, length, seekPos++, ':')) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_SEPARATOR);
     }
 
     // Read minute
-    if (!CopyDigits(minute, isoString, seekPos, 2, &seekPos)) {
-        return false;
+    if (!CopyDigits(minute, isoChars, length, seekPos, 2, &seekPos)) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_DIGIT);
     }
     IntFromChars(&(dateTime->minute), minute, 2);
 
     // Consume ':'
-    if (!ExpectChar(isoString, seekPos++, ':')) {
-        return false;
+    if (!ExpectChar(isoChars, length, seekPos++, ':')) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_SEPARATOR);
     }
 
     // Read second
-    if (!CopyDigits(second, isoString, seekPos, 2, &seekPos)) {
-        return false;
+    if (!CopyDigits(second, isoChars, length, seekPos, 2, &seekPos)) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_DIGIT);
     }
     IntFromChars(&(dateTime->second), second, 2);
 
     // Read time zone
-    char tzd = isoString[seekPos++];
+    char tzd = CharAt(isoChars, length, seekPos++);
 
     if (tzd == '+' || tzd == '-') {
         unsigned int tzHourOffset = 0;
@@ -532,26 +566,26 @@ bool PopulateDateTimeFromIsoString(const char* isoString, DateTime* dateTime)
         char tzdMinute[2];    // [0, 59]
 
         // Read hour
-        if (!CopyDigits(tzdHour, isoString, seekPos, 2, &seekPos)) {
-            return false;
+        if (!CopyDigits(tzdHour, isoChars, length, seekPos, 2, &seekPos)) {
+            return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_TZD);
         }
 
         if (!IntFromChars(&tzHourOffset, tzdHour, 2) || !InRange(tzHourOffset, 0, 23)) {
-            return false;
+            return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_TZD);
         }
 
         // Consume ':'
-        if (!ExpectChar(isoString, seekPos++, ':')) {
-            return false;
+        if (!ExpectChar(isoChars, length, seekPos++, ':')) {
+            return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_TZD);
         }
 
         // Read minute
-        if (!CopyDigits(tzdMinute, isoString, seekPos, 2, &seekPos)) {
-            return false;
+        if (!CopyDigits(tzdMinute, isoChars, length, seekPos, 2, &seekPos)) {
+            return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_TZD);
         }
 
         if (!IntFromChars(&tzMinuteOffset, tzdMinute, 2) || !InRange(tzMinuteOffset, 0, 59)) {
-            return false;
+            return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_TZD);
         }
 
         if (tzd == '-') {
@@ -560,24 +594,43 @@ bool PopulateDateTimeFromIsoString(const char* isoString, DateTime* dateTime)
         }
         
         if (!OffsetDateTime(dateTime, tzHourOffset, tzMinuteOffset)) {
-            return false;
+            return IsoParseFailed(outError, ISO_PARSE_ERROR_OUT_OF_RANGE);
         }
     }
     else if (tzd != 'Z') { // 'Z' denotes GMT
-        return false;
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_TZD);
     }
 
     // Consume trailing whitespace
-    while (isspace(isoString[seekPos])) {
+    while (isspace(CharAt(isoChars, length, seekPos))) {
         seekPos++;
     }
 
     // Expect end of string
-    if (!ExpectChar(isoString, seekPos++, '\0')) {
-        return false;
+    if (!ExpectChar(isoChars, length, seekPos++, '\0')) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_BAD_SEPARATOR);
+    }
+
+    if (!IsDateTimeValid(dateTime)) {
+        return IsoParseFailed(outError, ISO_PARSE_ERROR_OUT_OF_RANGE);
     }
 
-    return IsDateTimeValid(dateTime);
+    return true;
+}
+
+// Same as ParseIsoDateTime, without reporting why a string was rejected.
+bool PopulateDateTimeFromIsoChars(const char* isoChars, size_t length, DateTime* dateTime)
+{
+    return ParseIsoDateTime(isoChars, length, dateTime, NULL);
+}
+
+// Initializes the given DateTime using the given, null-terminated ISO 8601 date string.
+// Returns true if the DateTime is left in a valid state.
+//
+// See PopulateDateTimeFromIsoChars for the accepted format.
+bool PopulateDateTimeFromIsoString(const char* isoString, DateTime* dateTime)
+{
+    return PopulateDateTimeFromIsoChars(isoString, strlen(isoString), dateTime);
 }
 
 bool TestPopulateDateTimeFromIsoString()
@@ -642,6 +695,219 @@ bool TestPopulateDateTimeFromIsoString()
         return false;
     }
 
+    // Days past the end of their month, with or without a TZD
+    if (PopulateDateTimeFromIsoString("2085-02-30T00:00:00Z", &date)
+        || PopulateDateTimeFromIsoString("2085-02-30T00:00:00+01:00", &date)
+        || PopulateDateTimeFromIsoString("2085-04-31T00:00:00Z", &date)
+        || PopulateDateTimeFromIsoString("2023-02-29T00:00:00Z", &date)
+        || !PopulateDateTimeFromIsoString("2024-02-29T00:00:00Z", &date)) {
+        return false;
+    }
+
+    return true;
+}
+
+bool TestOffsetDateTime()
+{
+    // Start, hours, minutes, expected; an empty expectation must fail
+    const struct {
+        const char* start;
+        int hours;
+        int minutes;
+        const char* expected;
+    } cases[] = {
+        { "2085-09-28T08:03:29Z", 12, 30, "2085-09-28T20:33:29Z" },
+        { "2085-09-30T23:00:00Z", 1, 0, "2085-10-01T00:00:00Z" },
+        { "2085-10-01T00:10:00Z", 0, -11, "2085-09-30T23:59:00Z" },
+        { "2024-02-28T23:30:00Z", 0, 30, "2024-02-29T00:00:00Z" },
+        { "2023-02-28T23:30:00Z", 0, 30, "2023-03-01T00:00:00Z" },
+        { "2000-03-01T00:00:00Z", -1, 0, "2000-02-29T23:00:00Z" },
+        { "1900-03-01T00:00:00Z", -1, 0, "1900-02-28T23:00:00Z" },
+        { "1999-12-31T23:59:59Z", 0, 1, "2000-01-01T00:00:59Z" },
+        { "1970-01-01T00:00:00Z", -23, -59, "1969-12-31T00:01:00Z" },
+        { "0000-01-01T12:00:00Z", -12, 0, "0000-01-01T00:00:00Z" },
+        { "0000-01-01T00:00:00Z", 0, -1, "" },
+        { "9999-12-31T23:59:59Z", 0, 0, "9999-12-31T23:59:59Z" },
+        { "9999-12-31T23:00:00Z", 1, 0, "" },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        DateTime date;
+        DateTime expected;
+        if (!PopulateDateTimeFromIsoString(cases[i].start, &date)) {
+            return false;
+        }
+
+        bool success = OffsetDateTime(&date, cases[i].hours, cases[i].minutes);
+        printf("%s %+dh %+dm -> ", cases[i].start, cases[i].hours, cases[i].minutes);
+        if (success) {
+            PrintDateTime(&date);
+        }
+        else {
+            printf("out of range\n");
+        }
+
+        if (cases[i].expected[0] == '\0' ? success
+            : !success || !PopulateDateTimeFromIsoString(cases[i].expected, &expected) || !DateTimesEqual(&date, &expected)) {
+            return false;
+        }
+    }
+
+    // Every day of four centuries survives the round trip, one day after another
+    int64_t days = DaysFromCivil(1600, 1, 1);
+    for (int64_t d = days; d < days + 4 * DAYS_PER_ERA; d++) {
+        DateTime date;
+        if (!CivilFromDays(d, &date) || DaysFromCivil(date.year, date.month, date.day) != d) {
+            return false;
+        }
+    }
+
+    return DaysFromCivil(1970, 1, 1) == 0 && DaysFromCivil(0, 1, 1) == -719528 && DaysFromCivil(9999, 12, 31) == 2932896;
+}
+
+// Nearly all ISO 8601 strings in practice use the fixed-width, 20 character GMT form
+// YYYY-MM-DDThh:mm:ssZ. On x86 processors with SSSE3 that form is validated and converted with
+// a handful of vector instructions: every digit and separator position is checked with one
+// compare per load, and all digit pairs are combined with a single multiply-add.
+//
+// Anything else (time zone offsets, malformed strings, missing SSSE3 support) is handed to
+// PopulateDateTimeFromIsoChars, so results are identical to it in every case.
+#define ISO_GMT_LEN 20
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Returns true if the given DateTime was populated from the canonical GMT form at the start of
+// the given buffer, which must hold at least ISO_GMT_LEN characters. Returns false if the string
+// needs to be checked by the scalar parser.
+__attribute__((target("ssse3")))
+bool PopulateDateTimeFromIsoGmtSsse3(const char* isoChars, DateTime* dateTime)
+{
+    // Bytes 0-15 hold "YYYY-MM-DDThh:mm" and bytes 4-19 hold "-MM-DDThh:mm:ssZ"
+    const __m128i head = _mm_loadu_si128((const __m128i*)isoChars);
+    const __m128i tail = _mm_loadu_si128((const __m128i*)(isoChars + 4));
+
+    // Digit positions subtract down to [0, 9]; anything else is larger as an unsigned byte
+    const __m128i zeros = _mm_set1_epi8('0');
+    const __m128i headDigits = _mm_sub_epi8(head, zeros);
+    const __m128i tailDigits = _mm_sub_epi8(tail, zeros);
+    const __m128i nine = _mm_set1_epi8(9);
+
+    const unsigned int headDigitMask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(headDigits, nine), headDigits));
+    const unsigned int tailDigitMask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(tailDigits, nine), tailDigits));
+    const unsigned int tailSeparatorMask = _mm_movemask_epi8(_mm_cmpeq_epi8(tail,
+        _mm_setr_epi8('-', 0, 0, '-', 0, 0, 'T', 0, 0, ':', 0, 0, ':', 0, 0, 'Z')));
+
+    const unsigned int yearPositions = 0x000F;        // Head bytes 0-3
+    const unsigned int tailDigitPositions = 0x6DB6;   // Tail bytes 1-2, 4-5, 7-8, 10-11, 13-14
+    const unsigned int tailSeparatorPositions = 0x9249;
+
+    if ((headDigitMask & yearPositions) != yearPositions
+        || (tailDigitMask & tailDigitPositions) != tailDigitPositions
+        || (tailSeparatorMask & tailSeparatorPositions) != tailSeparatorPositions) {
+        return false;
+    }
+
+    // Gather the digits into adjacent pairs: YY YY MM DD hh mm ss, then multiply-add each pair
+    const __m128i yearDigits = _mm_shuffle_epi8(headDigits,
+        _mm_setr_epi8(0, 1, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const __m128i fieldDigits = _mm_shuffle_epi8(tailDigits,
+        _mm_setr_epi8(-1, -1, -1, -1, 1, 2, 4, 5, 7, 8, 10, 11, 13, 14, -1, -1));
+    const __m128i pairs = _mm_maddubs_epi16(_mm_or_si128(yearDigits, fieldDigits),
+        _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 0, 0));
+
+    // Combine the two halves of the year: YY * 100 + YY
+    const __m128i year = _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 0, 0, 0, 0, 0, 0));
+
+    dateTime->year = (unsigned int)_mm_cvtsi128_si32(year);
+    dateTime->month = (unsigned int)_mm_extract_epi16(pairs, 2);
+    dateTime->day = (unsigned int)_mm_extract_epi16(pairs, 3);
+    dateTime->hour = (unsigned int)_mm_extract_epi16(pairs, 4);
+    dateTime->minute = (unsigned int)_mm_extract_epi16(pairs, 5);
+    dateTime->second = (unsigned int)_mm_extract_epi16(pairs, 6);
+
+    return true;
+}
+#endif
+
+// Initializes the given DateTime the same as PopulateDateTimeFromIsoChars, taking a vectorized
+// fast path for strings in the canonical GMT form.
+bool PopulateDateTimeFromIsoCharsFast(const char* isoChars, size_t length, DateTime* dateTime)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (dateTime && length >= ISO_GMT_LEN && __builtin_cpu_supports("ssse3")
+        && PopulateDateTimeFromIsoGmtSsse3(isoChars, dateTime)) {
+        // Trailing whitespace then the end of the string is all that may follow
+        size_t seekPos = ISO_GMT_LEN;
+        while (isspace(CharAt(isoChars, length, seekPos))) {
+            seekPos++;
+        }
+
+        if (CharAt(isoChars, length, seekPos) == '\0') {
+            return IsDateTimeValid(dateTime);
+        }
+    }
+#endif
+
+    return PopulateDateTimeFromIsoChars(isoChars, length, dateTime);
+}
+
+bool TestPopulateDateTimeFromIsoCharsFast()
+{
+    const char* isoStrings[] = {
+        "2085-09-28T20:33:29Z",
+        "2085-09-28T20:33:29Z \t\n",
+        "0000-01-01T00:00:00Z",
+        "9999-12-31T23:59:59Z",
+        "2085-09-28T08:03:29+12:30",
+        "2085-09-28T20:33:29Zx",
+        "2085-09-28T20:33:29",
+        "2085-13-28T20:33:29Z",
+        "2085-09-32T20:33:29Z",
+        "2085-02-30T20:33:29Z",
+        "2085-09-28T24:33:29Z",
+        "2085-09-28T20:60:29Z",
+        "2085-09-28T20:33:60Z",
+        "2085/09-28T20:33:29Z",
+        "2085-09-28 20:33:29Z",
+        "2085-09-28T20-33:29Z",
+        "2085-09-28T20:33:2AZ",
+        "2O85-09-28T20:33:29Z",
+        "2085-09-28T20:33:29z",
+    };
+
+    for (size_t i = 0; i < sizeof(isoStrings) / sizeof(isoStrings[0]); i++) {
+        DateTime expected = { 0 };
+        DateTime date = { 0 };
+        size_t length = strlen(isoStrings[i]);
+
+        bool expectedSuccess = PopulateDateTimeFromIsoChars(isoStrings[i], length, &expected);
+        bool success = PopulateDateTimeFromIsoCharsFast(isoStrings[i], length, &date);
+        printf("%s -> %s\n", isoStrings[i], success ? "valid" : "invalid");
+
+        if (success != expectedSuccess || (success && !DateTimesEqual(&date, &expected))) {
+            return false;
+        }
+    }
+
+    // Corrupt each byte of a valid string in turn, including with a null terminator
+    const char corruptions[] = { '\0', '/', ':', '0' - 1, '9' + 1, 'T', 'Z', ' ' };
+    for (size_t pos = 0; pos < ISO_GMT_LEN; pos++) {
+        for (size_t c = 0; c < sizeof(corruptions); c++) {
+            char isoString[] = "2085-09-28T20:33:29Z";
+            isoString[pos] = corruptions[c];
+
+            DateTime expected = { 0 };
+            DateTime date = { 0 };
+            bool expectedSuccess = PopulateDateTimeFromIsoChars(isoString, ISO_GMT_LEN, &expected);
+            bool success = PopulateDateTimeFromIsoCharsFast(isoString, ISO_GMT_LEN, &date);
+
+            if (success != expectedSuccess || (success && !DateTimesEqual(&date, &expected))) {
+                return false;
+            }
+        }
+    }
+
     return true;
 }
 
@@ -719,76 +985,148 @@ bool TestYearSelectors()
     return true;
 }
 
-// Sorts the given list of DateTimes using a radix sort.
-bool SortDateTimes(const DateTime* dateTimes, size_t count, size_t* outKeys)
+// The digits SortDateTimes sorts by, least significant first, as
+// X(name, value of the digit for const DateTime* d, maxValue).
+#define DATE_TIME_DIGITS(X)                             \
+    X(Second, d->second, 59)                            \
+    X(Minute, d->minute, 59)                            \
+    X(Hour, d->hour, 23)                                \
+    X(Day, d->day, 31)                                  \
+    X(Month, d->month, 12)                              \
+    X(YearLSD, d->year % 10, 9)                         \
+    X(YearDecade, (d->year / 10) % 10, 9)               \
+    X(YearCentury, (d->year / 100) % 10, 9)             \
+    X(YearMillenium, (d->year / 1000) % 10, 9)
+
+typedef enum dateTimeDigit {
+#define DATE_TIME_DIGIT_ENUM(name, value, maxValue) DATE_TIME_DIGIT_##name,
+    DATE_TIME_DIGITS(DATE_TIME_DIGIT_ENUM)
+#undef DATE_TIME_DIGIT_ENUM
+    DATE_TIME_DIGIT_COUNT,
+} DateTimeDigit;
+
+#define DATE_TIME_DIGIT_VALUES 64   // More than the largest maxValue in DATE_TIME_DIGITS
+
+// Builds the histogram of every digit in one read of the given DateTimes. Returns false if a
+// digit is out of range.
+bool HistogramDateTimeDigits(const DateTime* dateTimes, size_t count, size_t (*histograms)[DATE_TIME_DIGIT_VALUES])
 {
-    if (!outKeys) {
-        return false;
-    }
-
-    // Initialize key array that we'll be sorting
-    size_t* keys = calloc(count, sizeof(size_t));  // calloc should initialize memory to 0
     for (size_t i = 0; i < count; i++) {
-        keys[i] = i;
+        const DateTime* d = &dateTimes[i];
+
+#define DATE_TIME_DIGIT_COUNT_VALUE(name, value, maxValue)          \
+        {                                                           \
+            unsigned int digit = (value);                           \
+            if (digit > (maxValue)) {                               \
+                return false;                                       \
+            }                                                       \
+            histograms[DATE_TIME_DIGIT_##name][digit]++;            \
+        }
+        DATE_TIME_DIGITS(DATE_TIME_DIGIT_COUNT_VALUE)
+#undef DATE_TIME_DIGIT_COUNT_VALUE
     }
 
-    if (!CountSort((void*)dateTimes, SecondSelector, 59, count, keys, outKeys)) {
-        free(keys);
-        return false;
-    }
-    memcpy(keys, outKeys, count * sizeof(size_t));
-    
-    if (!CountSort((void*)dateTimes, MinuteSelector, 59, count, keys, outKeys)) {
-        free(keys);
-        return false;
-    }
-    memcpy(keys, outKeys, count * sizeof(size_t));
+    return true;
+}
 
-    if (!CountSort((void*)dateTimes, HourSelector, 23, count, keys, outKeys)) {
-        free(keys);
-        return false;
-    }
-    memcpy(keys, outKeys, count * sizeof(size_t));
+// A scatter kernel for each digit reads the field directly, so unlike CountSort's selector
+// callbacks it can be inlined into the loop. offsets holds the start index of each value.
+#define DATE_TIME_DIGIT_SCATTER(name, value, maxValue)                                                      \
+void Scatter##name(const DateTime* dateTimes, size_t count, const size_t* keys, size_t* outKeys, size_t* offsets) \
+{                                                                                                           \
+    for (size_t i = 0; i < count; i++) {                                                                    \
+        size_t key = keys[i];                                                                               \
+        const DateTime* d = &dateTimes[key];                                                                \
+        outKeys[offsets[(value)]++] = key;                                                                  \
+    }                                                                                                       \
+}
+DATE_TIME_DIGITS(DATE_TIME_DIGIT_SCATTER)
+#undef DATE_TIME_DIGIT_SCATTER
 
-    if (!CountSort((void*)dateTimes, DaySelector, 31, count, keys, outKeys)) {
-        free(keys);
-        return false;
-    }
-    memcpy(keys, outKeys, count * sizeof(size_t));
+typedef void(*DateTimeDigitScatter)(const DateTime*, size_t, const size_t*, size_t*, size_t*);
 
-    if (!CountSort((void*)dateTimes, MonthSelector, 12, count, keys, outKeys)) {
-        free(keys);
+static const DateTimeDigitScatter DateTimeDigitScatters[DATE_TIME_DIGIT_COUNT] = {
+#define DATE_TIME_DIGIT_SCATTER_ENTRY(name, value, maxValue) Scatter##name,
+    DATE_TIME_DIGITS(DATE_TIME_DIGIT_SCATTER_ENTRY)
+#undef DATE_TIME_DIGIT_SCATTER_ENTRY
+};
+
+// Sorts the given list of DateTimes using a radix sort.
+//
+// This is the sort CountSort would give over each digit in DATE_TIME_DIGITS in turn, but the
+// histograms for every digit are built in a single read of the DateTimes and each pass uses a
+// scatter kernel specialized for its digit. As in RadixSortPackedKeys, a digit shared by every
+// DateTime cannot reorder anything, so its pass is skipped.
+//
+// The sort ping-pongs between outKeys and the given scratch buffer of count keys. If scratch is
+// NULL one is allocated for the duration of the sort.
+bool SortDateTimesWithScratch(const DateTime* dateTimes, size_t count, size_t* outKeys, size_t* scratch)
+{
+    if (!dateTimes || !outKeys) {
         return false;
     }
-    memcpy(keys, outKeys, count * sizeof(size_t));
 
-    if (!CountSort((void*)dateTimes, YearLSDSelector, 9, count, keys, outKeys)) {
-        free(keys);
+    size_t (*histograms)[DATE_TIME_DIGIT_VALUES] = calloc(DATE_TIME_DIGIT_COUNT, sizeof(*histograms));
+    size_t* ownedScratch = scratch ? NULL : malloc((count ? count : 1) * sizeof(size_t));
+    if (scratch == NULL) {
+        scratch = ownedScratch;
+    }
+    if (histograms == NULL || scratch == NULL || !HistogramDateTimeDigits(dateTimes, count, histograms)) {
+        free(histograms);
+        free(ownedScratch);
         return false;
     }
-    memcpy(keys, outKeys, count * sizeof(size_t));
 
-    if (!CountSort((void*)dateTimes, YearDecadeSelector, 9, count, keys, outKeys)) {
-        free(keys);
-        return false;
+    for (size_t i = 0; i < count; i++) {
+        outKeys[i] = i;
     }
-    memcpy(keys, outKeys, count * sizeof(size_t));
 
-    if (!CountSort((void*)dateTimes, YearCenturySelector, 9, count, keys, outKeys)) {
-        free(keys);
-        return false;
+    // Ping-pong between the two key buffers, starting from outKeys
+    size_t* keys = outKeys;
+    size_t* sortedKeys = scratch;
+
+    for (size_t digit = 0; digit < DATE_TIME_DIGIT_COUNT; digit++) {
+        size_t* histogram = histograms[digit];
+
+        bool constant = false;
+        for (size_t i = 0; i < DATE_TIME_DIGIT_VALUES && !constant; i++) {
+            constant = histogram[i] == count;
+        }
+        if (constant) {
+            continue;  // Every DateTime shares this digit
+        }
+
+        // Exclusive prefix sums give the start index of each digit value
+        size_t sum = 0;
+        for (size_t i = 0; i < DATE_TIME_DIGIT_VALUES; i++) {
+            size_t frequency = histogram[i];
+            histogram[i] = sum;
+            sum += frequency;
+        }
+
+        // Scatter forwards, which keeps the sort stable
+        DateTimeDigitScatters[digit](dateTimes, count, keys, sortedKeys, histogram);
+
+        size_t* temp = keys;
+        keys = sortedKeys;
+        sortedKeys = temp;
     }
-    memcpy(keys, outKeys, count * sizeof(size_t));
 
-    if (!CountSort((void*)dateTimes, YearMilleniumSelector, 9, count, keys, outKeys)) {
-        free(keys);
-        return false;
+    if (keys != outKeys) {
+        memcpy(outKeys, keys, count * sizeof(size_t));
     }
 
-    free(keys);
+    free(ownedScratch);
+    free(histograms);
     return true;
 }
 
+// Same as SortDateTimesWithScratch, allocating its own scratch buffer.
+bool SortDateTimes(const DateTime* dateTimes, size_t count, size_t* outKeys)
+{
+    return SortDateTimesWithScratch(dateTimes, count, outKeys, NULL);
+}
+
 bool TestSortDateTimes()
 {
     const size_t numDates = 12;
@@ -828,200 +1166,7994 @@ bool TestSortDateTimes()
     return true;
 }
 
-// Finds the set of keys in the given list of DateTimes that correspond to unique entries and places
-// them in outKeys.
-//
-// This uses a radix sort to organize DateTimes in ascending order, then scans the ordered list for
-// unique keys. This has two implications:
-//
-//   1) The algorithm is not stable, i.e., elements in outKeys will not appear in the same order as the input list
-//   2) The algorithm scales linearly with the number of DateTimes
-//
-bool DistinctDateTimes(const DateTime* dateTimes, size_t count, size_t* outKeys, size_t* outNewCount)
+// The specialized kernels must give the same stable ordering as CountSort over each selector.
+bool TestSortDateTimesMatchesCountSort()
 {
-    if (!outKeys || !outNewCount) {
-        return false;
-    }
+    const size_t numDates = 1000;
+    DateTime dates[numDates];
+    size_t keys[numDates];
+    size_t expectedKeys[numDates];
+    size_t sortedKeys[numDates];
 
-    // First sort the list of dates
-    size_t* sortedKeys = calloc(count, sizeof(size_t));  // calloc should initialize memory to 0
-    bool success = SortDateTimes(dateTimes, count, sortedKeys);
+    uint32_t state = 12345;
+    for (size_t i = 0; i < numDates; i++) {
+        state = state * 1664525 + 1013904223;
+
+        // Few distinct values per field, so that there are plenty of ties to keep stable
+        dates[i].year = 1990 + (state >> 8) % 20;
+        dates[i].month = 1 + (state >> 13) % 3;
+        dates[i].day = 1 + (state >> 16) % 2;
+        dates[i].hour = 7;
+        dates[i].minute = (state >> 20) % 60;
+        dates[i].second = (state >> 26) % 2;
+        keys[i] = i;
+    }
 
-    size_t newCount = 0;
-    if (success) {
-        for (size_t i = 0; i < count; i++) {
-            // Equal dates are now contiguous; if a date equals the previous date then skip it
-            if (i > 0) {
-                const DateTime* prevDate = &dateTimes[sortedKeys[i - 1]];
-                const DateTime* curDate = &dateTimes[sortedKeys[i]];
-                if (DateTimesEqual(prevDate, curDate)) {
-                    continue;
-                }
-            }
+    unsigned int(*selectors[])(const void*, size_t) = {
+        SecondSelector, MinuteSelector, HourSelector, DaySelector, MonthSelector,
+        YearLSDSelector, YearDecadeSelector, YearCenturySelector, YearMilleniumSelector,
+    };
+    const unsigned int maxValues[] = { 59, 59, 23, 31, 12, 9, 9, 9, 9 };
 
-            outKeys[newCount] = sortedKeys[i];
-            newCount++;
+    for (size_t i = 0; i < sizeof(selectors) / sizeof(selectors[0]); i++) {
+        if (!CountSort((void*)dates, selectors[i], maxValues[i], numDates, keys, expectedKeys)) {
+            return false;
         }
+        memcpy(keys, expectedKeys, sizeof(keys));
     }
 
-    *outNewCount = newCount;
-    free(sortedKeys);
+    if (!SortDateTimes(dates, numDates, sortedKeys)) {
+        return false;
+    }
 
-    return success;
+    if (memcmp(sortedKeys, expectedKeys, sizeof(sortedKeys)) != 0) {
+        return false;
+    }
+
+    // Out of range fields are rejected, as CountSort rejects out of range values
+    dates[numDates / 2].month = 13;
+    return !SortDateTimes(dates, numDates, sortedKeys);
 }
 
-bool TestDistinctDateTimes()
+// A DateTime can be packed into a single integer whose ordering matches DateTimeLessThan,
+// letting the radix sort run over bytes of one key instead of over each field in turn.
+//
+// Fields are packed from most to least significant: year (14 bits), month (4 bits),
+// day (5 bits), hour (5 bits), minute (6 bits), second (6 bits); 40 bits in total.
+#define PACKED_SECOND_SHIFT 0
+#define PACKED_MINUTE_SHIFT 6
+#define PACKED_HOUR_SHIFT 12
+#define PACKED_DAY_SHIFT 17
+#define PACKED_MONTH_SHIFT 22
+#define PACKED_YEAR_SHIFT 26
+#define PACKED_KEY_BITS 40
+
+#define RADIX_DIGIT_BITS 8
+#define RADIX_DIGIT_VALUES (1 << RADIX_DIGIT_BITS)
+#define RADIX_DIGIT_COUNT ((PACKED_KEY_BITS + RADIX_DIGIT_BITS - 1) / RADIX_DIGIT_BITS)
+
+// Returns the packed sort key for the given DateTime, which is assumed to be valid.
+uint64_t PackDateTime(const DateTime* dateTime)
 {
-    const size_t numDates = 8;
-    DateTime dates[numDates];
-
-    size_t distinctKeys[numDates] = { 0 };
-    size_t numDistinctKeys = 0;
+    return ((uint64_t)dateTime->year << PACKED_YEAR_SHIFT)
+        | ((uint64_t)dateTime->month << PACKED_MONTH_SHIFT)
+        | ((uint64_t)dateTime->day << PACKED_DAY_SHIFT)
+        | ((uint64_t)dateTime->hour << PACKED_HOUR_SHIFT)
+        | ((uint64_t)dateTime->minute << PACKED_MINUTE_SHIFT)
+        | ((uint64_t)dateTime->second << PACKED_SECOND_SHIFT);
+}
 
-    PopulateDateTimeFromIsoString("0000-01-01T00:00:00", &dates[0]);
-    PopulateDateTimeFromIsoString("0000-01-01T00:00:01", &dates[1]);
-    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[2]);
-    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[3]); // Copy
-    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[4]); // Copy
-    PopulateDateTimeFromIsoString("0000-01-01T01:01:01", &dates[5]);
-    PopulateDateTimeFromIsoString("1000-01-01T00:00:00", &dates[6]);
-    PopulateDateTimeFromIsoString("1000-01-01T00:00:00", &dates[7]); // Copy
+// Initializes the given DateTime from a key produced by PackDateTime.
+void UnpackDateTime(uint64_t packed, DateTime* dateTime)
+{
+    dateTime->year = (unsigned int)(packed >> PACKED_YEAR_SHIFT) & 0x3FFF;
+    dateTime->month = (unsigned int)(packed >> PACKED_MONTH_SHIFT) & 0xF;
+    dateTime->day = (unsigned int)(packed >> PACKED_DAY_SHIFT) & 0x1F;
+    dateTime->hour = (unsigned int)(packed >> PACKED_HOUR_SHIFT) & 0x1F;
+    dateTime->minute = (unsigned int)(packed >> PACKED_MINUTE_SHIFT) & 0x3F;
+    dateTime->second = (unsigned int)(packed >> PACKED_SECOND_SHIFT) & 0x3F;
+}
 
-    if (!DistinctDateTimes(dates, numDates, distinctKeys, &numDistinctKeys)) {
-        return false;
+// Resolutions at which DateTimes can be made distinct. Fields finer than the granularity are
+// truncated: to zero for times, and to the first for days.
+typedef enum granularity {
+    GRANULARITY_SECOND,
+    GRANULARITY_MINUTE,
+    GRANULARITY_HOUR,
+    GRANULARITY_DAY,
+    GRANULARITY_MONTH,
+    GRANULARITY_COUNT,
+} Granularity;
+
+static const char* GranularityNames[GRANULARITY_COUNT] = { "second", "minute", "hour", "day", "month" };
+
+// Truncates the given DateTime to the given granularity.
+void TruncateDateTime(DateTime* dateTime, Granularity granularity)
+{
+    switch (granularity) {
+    case GRANULARITY_MONTH:
+        dateTime->day = 1;
+        // Fall through
+    case GRANULARITY_DAY:
+        dateTime->hour = 0;
+        // Fall through
+    case GRANULARITY_HOUR:
+        dateTime->minute = 0;
+        // Fall through
+    case GRANULARITY_MINUTE:
+        dateTime->second = 0;
+        // Fall through
+    case GRANULARITY_SECOND:
+    default:
+        break;
     }
+}
 
-    // Three dates in the test set are copies and should be removed
-    if (numDistinctKeys != 5) {
-        return false;
+// Truncates each of the given list of DateTimes to the given granularity. The fields zeroed
+// are then shared by every DateTime, so the radix sorts skip their passes.
+void TruncateDateTimes(DateTime* dateTimes, size_t count, Granularity granularity)
+{
+    if (granularity == GRANULARITY_SECOND) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        TruncateDateTime(&dateTimes[i], granularity);
+    }
+}
+
+// Returns the given packed key truncated to the given granularity. Truncation keeps the order
+// of keys, so sorted keys stay sorted.
+uint64_t TruncatePackedKey(uint64_t packed, Granularity granularity)
+{
+    switch (granularity) {
+    case GRANULARITY_MONTH:
+        return (packed & ~((1ull << PACKED_MONTH_SHIFT) - 1)) | (1ull << PACKED_DAY_SHIFT);
+    case GRANULARITY_DAY:
+        return packed & ~((1ull << PACKED_DAY_SHIFT) - 1);
+    case GRANULARITY_HOUR:
+        return packed & ~((1ull << PACKED_HOUR_SHIFT) - 1);
+    case GRANULARITY_MINUTE:
+        return packed & ~((1ull << PACKED_MINUTE_SHIFT) - 1);
+    case GRANULARITY_SECOND:
+    default:
+        return packed;
+    }
+}
+
+// Sorts keys indexing into the given list of packed DateTimes into outKeys using an LSD
+// radix sort over 8-bit digits.
+//
+// The histograms for every digit are built in a single read of the packed keys. A digit whose
+// histogram has only one populated bucket cannot reorder anything, so its pass is skipped;
+// for dates clustered in a few years this leaves only the low digits to sort.
+bool RadixSortPackedKeys(const uint64_t* packedKeys, size_t count, size_t* outKeys)
+{
+    if (!packedKeys || !outKeys) {
+        return false;
+    }
+
+    size_t* histograms = calloc(RADIX_DIGIT_COUNT * RADIX_DIGIT_VALUES, sizeof(size_t));
+    size_t* scratch = calloc(count ? count : 1, sizeof(size_t));
+    if (histograms == NULL || scratch == NULL) {
+        free(histograms);
+        free(scratch);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t packed = packedKeys[i];
+        for (size_t digit = 0; digit < RADIX_DIGIT_COUNT; digit++) {
+            histograms[digit * RADIX_DIGIT_VALUES + ((packed >> (digit * RADIX_DIGIT_BITS)) & (RADIX_DIGIT_VALUES - 1))]++;
+        }
+        outKeys[i] = i;
+    }
+
+    // Ping-pong between the two key buffers, starting from outKeys
+    size_t* keys = outKeys;
+    size_t* sortedKeys = scratch;
+
+    for (size_t digit = 0; digit < RADIX_DIGIT_COUNT; digit++) {
+        size_t* histogram = &histograms[digit * RADIX_DIGIT_VALUES];
+        const unsigned int shift = digit * RADIX_DIGIT_BITS;
+
+        if (count > 0 && histogram[(packedKeys[0] >> shift) & (RADIX_DIGIT_VALUES - 1)] == count) {
+            continue;  // Every key shares this digit
+        }
+
+        // Exclusive prefix sums give the start index of each digit value
+        size_t sum = 0;
+        for (size_t i = 0; i < RADIX_DIGIT_VALUES; i++) {
+            size_t frequency = histogram[i];
+            histogram[i] = sum;
+            sum += frequency;
+        }
+
+        // Scatter forwards, which keeps the sort stable
+        for (size_t i = 0; i < count; i++) {
+            size_t key = keys[i];
+            sortedKeys[histogram[(packedKeys[key] >> shift) & (RADIX_DIGIT_VALUES - 1)]++] = key;
+        }
+
+        size_t* temp = keys;
+        keys = sortedKeys;
+        sortedKeys = temp;
+    }
+
+    if (keys != outKeys) {
+        memcpy(outKeys, keys, count * sizeof(size_t));
+    }
+
+    free(scratch);
+    free(histograms);
+    return true;
+}
+
+// Returns the packed key of each DateTime in the given list, in a buffer the caller must free,
+// or NULL if out of memory.
+uint64_t* PackDateTimes(const DateTime* dateTimes, size_t count)
+{
+    uint64_t* packedKeys = malloc((count ? count : 1) * sizeof(uint64_t));
+    if (packedKeys == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        packedKeys[i] = PackDateTime(&dateTimes[i]);
+    }
+
+    return packedKeys;
+}
+
+// Sorts the given list of DateTimes by packing each into a 64-bit key once, then radix
+// sorting the packed keys. Produces the same ordering as SortDateTimes.
+bool SortDateTimesPacked(const DateTime* dateTimes, size_t count, size_t* outKeys)
+{
+    if (!dateTimes || !outKeys) {
+        return false;
+    }
+
+    uint64_t* packedKeys = PackDateTimes(dateTimes, count);
+    if (packedKeys == NULL) {
+        return false;
+    }
+
+    bool success = RadixSortPackedKeys(packedKeys, count, outKeys);
+
+    free(packedKeys);
+    return success;
+}
+
+// A packed sort key stored next to the index of the DateTime it came from
+typedef struct sortRecord {
+    uint64_t key;   // From PackDateTime
+    size_t index;   // Position of the DateTime in the list being sorted
+} SortRecord;
+
+// Sorts the given records in place by key with a stable LSD radix sort over 8-bit digits.
+//
+// Unlike RadixSortPackedKeys, which gathers packedKeys[key] for each index it moves, every
+// pass reads the records sequentially and carries the key with its index, so no pass makes
+// random reads. This costs twice the memory per element, which pays off once the keys no
+// longer fit in cache.
+bool RadixSortRecords(SortRecord* records, size_t count)
+{
+    if (!records) {
+        return false;
+    }
+
+    size_t* histograms = calloc(RADIX_DIGIT_COUNT * RADIX_DIGIT_VALUES, sizeof(size_t));
+    SortRecord* scratch = malloc((count ? count : 1) * sizeof(SortRecord));
+    if (histograms == NULL || scratch == NULL) {
+        free(histograms);
+        free(scratch);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t key = records[i].key;
+        for (size_t digit = 0; digit < RADIX_DIGIT_COUNT; digit++) {
+            histograms[digit * RADIX_DIGIT_VALUES + ((key >> (digit * RADIX_DIGIT_BITS)) & (RADIX_DIGIT_VALUES - 1))]++;
+        }
+    }
+
+    // Ping-pong between the two record buffers, starting from records
+    SortRecord* from = records;
+    SortRecord* to = scratch;
+
+    for (size_t digit = 0; digit < RADIX_DIGIT_COUNT; digit++) {
+        size_t* histogram = &histograms[digit * RADIX_DIGIT_VALUES];
+        const unsigned int shift = digit * RADIX_DIGIT_BITS;
+
+        if (count > 0 && histogram[(records[0].key >> shift) & (RADIX_DIGIT_VALUES - 1)] == count) {
+            continue;  // Every key shares this digit
+        }
+
+        size_t sum = 0;
+        for (size_t i = 0; i < RADIX_DIGIT_VALUES; i++) {
+            size_t frequency = histogram[i];
+            histogram[i] = sum;
+            sum += frequency;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            to[histogram[(from[i].key >> shift) & (RADIX_DIGIT_VALUES - 1)]++] = from[i];
+        }
+
+        SortRecord* temp = from;
+        from = to;
+        to = temp;
+    }
+
+    if (from != records) {
+        memcpy(records, from, count * sizeof(SortRecord));
+    }
+
+    free(scratch);
+    free(histograms);
+    return true;
+}
+
+// Sorts the given list of DateTimes by radix sorting (packed key, index) records, then
+// copying the sorted indexes to outKeys. Produces the same ordering as SortDateTimes.
+bool SortDateTimesRecords(const DateTime* dateTimes, size_t count, size_t* outKeys)
+{
+    if (!dateTimes || !outKeys) {
+        return false;
+    }
+
+    SortRecord* records = malloc((count ? count : 1) * sizeof(SortRecord));
+    if (records == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        records[i].key = PackDateTime(&dateTimes[i]);
+        records[i].index = i;
+    }
+
+    bool success = RadixSortRecords(records, count);
+    for (size_t i = 0; success && i < count; i++) {
+        outKeys[i] = records[i].index;
+    }
+
+    free(records);
+    return success;
+}
+
+bool TestPackDateTime()
+{
+    DateTime date;
+    DateTime unpacked;
+
+    PopulateDateTimeFromIsoString("9999-12-31T23:59:59Z", &date);
+    UnpackDateTime(PackDateTime(&date), &unpacked);
+    if (!DateTimesEqual(&date, &unpacked)) {
+        return false;
+    }
+
+    // Packed keys must order the same way as DateTimeLessThan
+    DateTime earlier;
+    DateTime later;
+    PopulateDateTimeFromIsoString("2085-09-28T20:33:29Z", &earlier);
+    PopulateDateTimeFromIsoString("2085-10-01T00:00:00Z", &later);
+
+    return PackDateTime(&earlier) < PackDateTime(&later)
+        && PackDateTime(&date) > PackDateTime(&later);
+}
+
+bool TestSortDateTimesPacked()
+{
+    const size_t numDates = 12;
+    DateTime dates[numDates];
+    size_t expectedKeys[numDates] = { 0 };
+    size_t sortedKeys[numDates] = { 0 };
+
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[0]);
+    PopulateDateTimeFromIsoString("0000-01-02T01:01:01", &dates[1]);
+    PopulateDateTimeFromIsoString("0001-02-02T01:00:00", &dates[2]);
+    PopulateDateTimeFromIsoString("0001-02-02T00:00:00", &dates[3]);
+    PopulateDateTimeFromIsoString("0000-02-02T01:01:01", &dates[4]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:00:01", &dates[5]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:00:00", &dates[6]);
+    PopulateDateTimeFromIsoString("2000-01-01T01:01:01", &dates[7]);
+    PopulateDateTimeFromIsoString("0001-02-01T00:00:00", &dates[8]);
+    PopulateDateTimeFromIsoString("0001-02-02T01:01:01", &dates[9]);
+    PopulateDateTimeFromIsoString("0001-02-02T01:00:00", &dates[10]); // Copy of dates[2]
+    PopulateDateTimeFromIsoString("0001-01-01T00:00:00", &dates[11]);
+
+    if (!SortDateTimes(dates, numDates, expectedKeys)) {
+        return false;
+    }
+
+    if (!SortDateTimesPacked(dates, numDates, sortedKeys)) {
+        return false;
+    }
+
+    // Both sorts are stable, so the keys should match exactly
+    printf("Sorted Dates:\n");
+    for (size_t i = 0; i < numDates; i++) {
+        PrintDateTime(&dates[sortedKeys[i]]);
+
+        if (sortedKeys[i] != expectedKeys[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TestSortDateTimesRecords()
+{
+    const size_t numDates = 1000;
+    DateTime dates[numDates];
+    size_t expectedKeys[numDates];
+    size_t sortedKeys[numDates];
+
+    uint32_t state = 54321;
+    for (size_t i = 0; i < numDates; i++) {
+        state = state * 1664525 + 1013904223;
+        dates[i].year = 2000 + (state >> 28);
+        dates[i].month = 1 + (state >> 24) % 12;
+        dates[i].day = 1 + (state >> 19) % 28;
+        dates[i].hour = (state >> 14) % 24;
+        dates[i].minute = (state >> 8) % 60;
+        dates[i].second = (state >> 2) % 60;
+    }
+    dates[numDates - 1] = dates[0];  // A duplicate, whose relative order must be kept
+
+    if (!SortDateTimes(dates, numDates, expectedKeys)) {
+        return false;
+    }
+
+    if (!SortDateTimesRecords(dates, numDates, sortedKeys)) {
+        return false;
+    }
+
+    // Both sorts are stable, so the keys should match exactly
+    return memcmp(sortedKeys, expectedKeys, sizeof(sortedKeys)) == 0;
+}
+
+// Pipeline statistics are counted per thread, without locks, and summed when read. Each thread
+// claims a slot of counters the first time it counts anything and hands the slot back when it
+// finishes, leaving its counts in place for the next thread to add to. A slot only ever has one
+// writer, so counters are updated with relaxed loads and stores rather than atomic increments,
+// and a reporter can take a consistent-enough snapshot while a run is in progress.
+#define STATS_MAX_SLOTS 1024
+#define STATS_FLUSH_LINES 4096  // Lines counted locally before being published to a slot
+
+// Stages of the distinct pipeline timed by the statistics
+typedef enum pipelineStage {
+    PIPELINE_STAGE_INGEST,
+    PIPELINE_STAGE_SORT,
+    PIPELINE_STAGE_DEDUP,
+    PIPELINE_STAGE_WRITE,
+    PIPELINE_STAGE_COUNT,
+} PipelineStage;
+
+static const char* PipelineStageNames[PIPELINE_STAGE_COUNT] = { "ingest", "sort", "dedup", "write" };
+static const char* IsoParseErrorNames[ISO_PARSE_ERROR_COUNT] = { "none", "bad_digit", "bad_separator", "bad_tzd", "out_of_range" };
+
+typedef struct pipelineStats {
+    _Atomic uint64_t linesRead;
+    _Atomic uint64_t linesRejected[ISO_PARSE_ERROR_COUNT];
+    _Atomic uint64_t duplicatesRemoved;
+    _Atomic uint64_t stageNanoseconds[PIPELINE_STAGE_COUNT];
+} PipelineStats;
+
+typedef struct statsSlot {
+    _Alignas(64) PipelineStats stats;   // Aligned so that threads never share a cache line
+    bool inUse;
+} StatsSlot;
+
+static StatsSlot StatsSlots[STATS_MAX_SLOTS];
+static size_t StatsSlotCount;           // Slots that have ever been claimed
+static pthread_mutex_t StatsMutex = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local StatsSlot* ThreadStatsSlot;
+
+// Returns the current time of the monotonic clock in nanoseconds.
+uint64_t MonotonicNanoseconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// Returns the calling thread's statistics, claiming a slot for it if it doesn't have one yet.
+PipelineStats* ThreadPipelineStats()
+{
+    if (ThreadStatsSlot == NULL) {
+        pthread_mutex_lock(&StatsMutex);
+
+        StatsSlot* slot = NULL;
+        for (size_t i = 0; i < StatsSlotCount && slot == NULL; i++) {
+            if (!StatsSlots[i].inUse) {
+                slot = &StatsSlots[i];
+            }
+        }
+
+        if (slot == NULL) {
+            // With every slot taken, share the last one; counts may then be slightly low
+            slot = &StatsSlots[StatsSlotCount < STATS_MAX_SLOTS ? StatsSlotCount++ : STATS_MAX_SLOTS - 1];
+        }
+
+        slot->inUse = true;
+        ThreadStatsSlot = slot;
+
+        pthread_mutex_unlock(&StatsMutex);
+    }
+
+    return &ThreadStatsSlot->stats;
+}
+
+// Hands the calling thread's statistics slot back for reuse by another thread.
+void ReleaseThreadPipelineStats()
+{
+    if (ThreadStatsSlot != NULL) {
+        pthread_mutex_lock(&StatsMutex);
+        ThreadStatsSlot->inUse = false;
+        ThreadStatsSlot = NULL;
+        pthread_mutex_unlock(&StatsMutex);
+    }
+}
+
+// Adds the given value to a counter that only the calling thread writes.
+void StatsAdd(_Atomic uint64_t* counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+// Adds the time since the given start, from MonotonicNanoseconds, to the given stage.
+void StatsAddStageTime(PipelineStage stage, uint64_t startNanoseconds)
+{
+    StatsAdd(&ThreadPipelineStats()->stageNanoseconds[stage], MonotonicNanoseconds() - startNanoseconds);
+}
+
+// Sums the statistics of every thread into the given snapshot.
+void SnapshotPipelineStats(PipelineStats* outStats)
+{
+    memset(outStats, 0, sizeof(PipelineStats));
+
+    pthread_mutex_lock(&StatsMutex);
+    size_t slotCount = StatsSlotCount;
+    pthread_mutex_unlock(&StatsMutex);
+
+    for (size_t i = 0; i < slotCount; i++) {
+        const PipelineStats* stats = &StatsSlots[i].stats;
+
+        outStats->linesRead += atomic_load_explicit(&stats->linesRead, memory_order_relaxed);
+        outStats->duplicatesRemoved += atomic_load_explicit(&stats->duplicatesRemoved, memory_order_relaxed);
+        for (size_t error = 0; error < ISO_PARSE_ERROR_COUNT; error++) {
+            outStats->linesRejected[error] += atomic_load_explicit(&stats->linesRejected[error], memory_order_relaxed);
+        }
+        for (size_t stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+            outStats->stageNanoseconds[stage] += atomic_load_explicit(&stats->stageNanoseconds[stage], memory_order_relaxed);
+        }
+    }
+}
+
+// Zeroes the statistics of every thread. Only safe while no other thread is counting.
+void ResetPipelineStats()
+{
+    pthread_mutex_lock(&StatsMutex);
+    for (size_t i = 0; i < StatsSlotCount; i++) {
+        memset((void*)&StatsSlots[i].stats, 0, sizeof(PipelineStats));
+    }
+    pthread_mutex_unlock(&StatsMutex);
+}
+
+// Prints the given string to the given file stream as a quoted JSON string, escaping quotes,
+// backslashes and control characters.
+void FPrintJsonString(FILE* stream, const char* value)
+{
+    fputc('"', stream);
+    for (const unsigned char* c = (const unsigned char*)value; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(stream, "\\%c", *c);
+        }
+        else if (*c < 0x20) {
+            fprintf(stream, "\\u%04x", *c);
+        }
+        else {
+            fputc(*c, stream);
+        }
+    }
+    fputc('"', stream);
+}
+
+// Prints a snapshot of the pipeline statistics to the given file stream as a line of JSON.
+void FPrintPipelineStats(FILE* stream)
+{
+    PipelineStats stats;
+    SnapshotPipelineStats(&stats);
+
+    uint64_t linesRejected = 0;
+    for (size_t error = ISO_PARSE_ERROR_NONE + 1; error < ISO_PARSE_ERROR_COUNT; error++) {
+        linesRejected += stats.linesRejected[error];
+    }
+
+    fprintf(stream, "{\"lines_read\":%llu,\"lines_parsed\":%llu,\"lines_rejected\":{",
+        (unsigned long long)stats.linesRead, (unsigned long long)(stats.linesRead - linesRejected));
+    for (size_t error = ISO_PARSE_ERROR_NONE + 1; error < ISO_PARSE_ERROR_COUNT; error++) {
+        fprintf(stream, "%s\"%s\":%llu", error > ISO_PARSE_ERROR_NONE + 1 ? "," : "",
+            IsoParseErrorNames[error], (unsigned long long)stats.linesRejected[error]);
+    }
+
+    fprintf(stream, "},\"duplicates_removed\":%llu,\"stage_ns\":{", (unsigned long long)stats.duplicatesRemoved);
+    for (size_t stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        fprintf(stream, "%s\"%s\":%llu", stage > 0 ? "," : "",
+            PipelineStageNames[stage], (unsigned long long)stats.stageNanoseconds[stage]);
+    }
+    fprintf(stream, "}}\n");
+    fflush(stream);
+}
+
+// Waits for SIGUSR1, printing a snapshot of the pipeline statistics to stderr each time it arrives
+void* StatsReporterThread(void* arg)
+{
+    (void)arg;
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+
+    int signalNumber = 0;
+    while (sigwait(&signals, &signalNumber) == 0) {
+        FPrintPipelineStats(stderr);
+    }
+
+    return NULL;
+}
+
+// Starts a thread that prints live statistics to stderr on SIGUSR1. SIGUSR1 is blocked on the
+// calling thread, and so on every thread started after this, so only the reporter receives it.
+// Returns true if successful.
+bool StartStatsReporter()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+
+    pthread_t reporter;
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0
+        || pthread_create(&reporter, NULL, StatsReporterThread, NULL) != 0) {
+        return false;
+    }
+
+    return pthread_detach(reporter) == 0;
+}
+
+// Counts lines parsed by the calling thread, publishing the counts to its statistics in batches
+typedef struct lineCounter {
+    uint64_t linesRead;
+    uint64_t linesRejected[ISO_PARSE_ERROR_COUNT];
+} LineCounter;
+
+// Publishes the given counts to the calling thread's statistics and resets them.
+void FlushLineCounter(LineCounter* counter)
+{
+    PipelineStats* stats = ThreadPipelineStats();
+
+    StatsAdd(&stats->linesRead, counter->linesRead);
+    for (size_t error = 0; error < ISO_PARSE_ERROR_COUNT; error++) {
+        if (counter->linesRejected[error] > 0) {
+            StatsAdd(&stats->linesRejected[error], counter->linesRejected[error]);
+        }
+    }
+
+    memset(counter, 0, sizeof(LineCounter));
+}
+
+// Parses one line of input with PopulateDateTimeFromIsoCharsFast, counting it, and why it was
+// rejected if it was, in the given counter. Returns true if the line held a valid DateTime.
+bool ParseCountedLine(const char* line, size_t length, DateTime* dateTime, LineCounter* counter)
+{
+    counter->linesRead++;
+
+    bool success = PopulateDateTimeFromIsoCharsFast(line, length, dateTime);
+    if (!success) {
+        // Rejections are rare, so they are parsed again to find out why
+        IsoParseError error = ISO_PARSE_ERROR_NONE;
+        ParseIsoDateTime(line, length, dateTime, &error);
+        counter->linesRejected[error]++;
+    }
+
+    if (counter->linesRead == STATS_FLUSH_LINES) {
+        FlushLineCounter(counter);
+    }
+
+    return success;
+}
+
+bool TestPipelineStats()
+{
+    PipelineStats before;
+    PipelineStats after;
+    SnapshotPipelineStats(&before);
+
+    const char* lines[] = {
+        "2085-09-28T20:33:29Z",
+        "2085-09-28T08:03:29+12:30",
+        "2085-O9-28T20:33:29Z",
+        "2085-09-28 20:33:29Z",
+        "2085-09-28T20:33:29+24:00",
+        "2085-13-28T20:33:29Z",
+    };
+
+    LineCounter counter = { 0 };
+    DateTime date;
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        ParseCountedLine(lines[i], strlen(lines[i]), &date, &counter);
+    }
+    FlushLineCounter(&counter);
+
+    SnapshotPipelineStats(&after);
+    FPrintPipelineStats(stdout);
+
+    return after.linesRead - before.linesRead == 6
+        && after.linesRejected[ISO_PARSE_ERROR_BAD_DIGIT] - before.linesRejected[ISO_PARSE_ERROR_BAD_DIGIT] == 1
+        && after.linesRejected[ISO_PARSE_ERROR_BAD_SEPARATOR] - before.linesRejected[ISO_PARSE_ERROR_BAD_SEPARATOR] == 1
+        && after.linesRejected[ISO_PARSE_ERROR_BAD_TZD] - before.linesRejected[ISO_PARSE_ERROR_BAD_TZD] == 1
+        && after.linesRejected[ISO_PARSE_ERROR_OUT_OF_RANGE] - before.linesRejected[ISO_PARSE_ERROR_OUT_OF_RANGE] == 1;
+}
+
+// A function for RunOnThreads to call on a thread it started
+typedef struct threadStart {
+    void*(*func)(void*);
+    void* arg;
+} ThreadStart;
+
+void* RunThreadStart(void* arg)
+{
+    ThreadStart* start = (ThreadStart*)arg;
+    start->func(start->arg);
+
+    // The thread is finished, so its statistics slot can be reused
+    ReleaseThreadPipelineStats();
+    return NULL;
+}
+
+// Calls func once for each of threadCount arguments laid out argSize bytes apart in args,
+// running the calls concurrently and returning once all of them have finished. The first call
+// runs on the calling thread, as does any call whose thread could not be started.
+void RunOnThreads(void*(*func)(void*), void* args, size_t argSize, size_t threadCount)
+{
+    pthread_t* threads = calloc(threadCount, sizeof(pthread_t));
+    ThreadStart* starts = calloc(threadCount, sizeof(ThreadStart));
+    bool* started = calloc(threadCount, sizeof(bool));
+
+    for (size_t i = 1; i < threadCount && threads && starts && started; i++) {
+        starts[i].func = func;
+        starts[i].arg = (char*)args + i * argSize;
+        started[i] = pthread_create(&threads[i], NULL, RunThreadStart, &starts[i]) == 0;
+    }
+
+    for (size_t i = 0; i < threadCount; i++) {
+        if (i == 0 || !started || !started[i]) {
+            func((char*)args + i * argSize);
+        }
+    }
+
+    for (size_t i = 1; i < threadCount && started; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    free(started);
+    free(starts);
+    free(threads);
+}
+
+// Inputs smaller than this are sorted on one thread, as the cost of starting threads would
+// outweigh the gain
+#define RADIX_PARALLEL_MIN_COUNT (1 << 16)
+
+// One thread's share of a parallel radix sort: a contiguous slice of the key array being sorted
+typedef struct radixSortSlice {
+    const uint64_t* packedKeys;
+    const size_t* keys;                     // Keys to read this pass
+    size_t* sortedKeys;                     // Keys to write this pass
+    size_t begin;
+    size_t end;
+    unsigned int shift;                     // Position of this pass's digit within a packed key
+    uint64_t differingBits;                 // Bits of a packed key that differ within the slice
+    size_t histogram[RADIX_DIGIT_VALUES];   // Digit counts, then this slice's scatter offsets
+} RadixSortSlice;
+
+// Initializes the slice's keys in input order and finds which bits of its packed keys differ
+void* RadixInitSlice(void* arg)
+{
+    RadixSortSlice* slice = (RadixSortSlice*)arg;
+    uint64_t differingBits = 0;
+
+    for (size_t i = slice->begin; i < slice->end; i++) {
+        differingBits |= slice->packedKeys[i] ^ slice->packedKeys[slice->begin];
+        slice->sortedKeys[i] = i;
+    }
+
+    slice->differingBits = differingBits;
+    return NULL;
+}
+
+void* RadixHistogramSlice(void* arg)
+{
+    RadixSortSlice* slice = (RadixSortSlice*)arg;
+    memset(slice->histogram, 0, sizeof(slice->histogram));
+
+    for (size_t i = slice->begin; i < slice->end; i++) {
+        slice->histogram[(slice->packedKeys[slice->keys[i]] >> slice->shift) & (RADIX_DIGIT_VALUES - 1)]++;
+    }
+
+    return NULL;
+}
+
+void* RadixScatterSlice(void* arg)
+{
+    RadixSortSlice* slice = (RadixSortSlice*)arg;
+
+    for (size_t i = slice->begin; i < slice->end; i++) {
+        size_t key = slice->keys[i];
+        slice->sortedKeys[slice->histogram[(slice->packedKeys[key] >> slice->shift) & (RADIX_DIGIT_VALUES - 1)]++] = key;
+    }
+
+    return NULL;
+}
+
+// Same as RadixSortPackedKeys, but splits every pass across threadCount threads. Each thread
+// builds a histogram of its slice of the keys, an exclusive prefix sum over (digit, thread)
+// gives each thread its own scatter offsets, and each thread then scatters its slice. Slices
+// are scattered in order within each digit value, so the sort remains stable.
+//
+// Small inputs, or a threadCount of one, use the serial RadixSortPackedKeys.
+bool RadixSortPackedKeysParallel(const uint64_t* packedKeys, size_t count, size_t* outKeys, size_t threadCount)
+{
+    if (!packedKeys || !outKeys) {
+        return false;
+    }
+
+    if (threadCount <= 1 || count < RADIX_PARALLEL_MIN_COUNT) {
+        return RadixSortPackedKeys(packedKeys, count, outKeys);
+    }
+
+    RadixSortSlice* slices = calloc(threadCount, sizeof(RadixSortSlice));
+    size_t* scratch = calloc(count ? count : 1, sizeof(size_t));
+    if (slices == NULL || scratch == NULL) {
+        free(slices);
+        free(scratch);
+        return false;
+    }
+
+    for (size_t t = 0; t < threadCount; t++) {
+        slices[t].packedKeys = packedKeys;
+        slices[t].begin = count * t / threadCount;
+        slices[t].end = count * (t + 1) / threadCount;
+        slices[t].sortedKeys = outKeys;
+    }
+
+    RunOnThreads(RadixInitSlice, slices, sizeof(RadixSortSlice), threadCount);
+
+    // A digit that no key differs in cannot reorder anything, so its pass is skipped.
+    // Comparing each slice's first key with the very first key covers differences between slices.
+    uint64_t differingBits = 0;
+    for (size_t t = 0; t < threadCount; t++) {
+        differingBits |= slices[t].differingBits | (packedKeys[slices[t].begin] ^ packedKeys[0]);
+    }
+
+    // Ping-pong between the two key buffers, starting from outKeys
+    size_t* keys = outKeys;
+    size_t* sortedKeys = scratch;
+
+    for (size_t digit = 0; digit < RADIX_DIGIT_COUNT; digit++) {
+        const unsigned int shift = digit * RADIX_DIGIT_BITS;
+        if (((differingBits >> shift) & (RADIX_DIGIT_VALUES - 1)) == 0) {
+            continue;
+        }
+
+        for (size_t t = 0; t < threadCount; t++) {
+            slices[t].keys = keys;
+            slices[t].sortedKeys = sortedKeys;
+            slices[t].shift = shift;
+        }
+
+        RunOnThreads(RadixHistogramSlice, slices, sizeof(RadixSortSlice), threadCount);
+
+        // Exclusive prefix sums in (digit value, thread) order give each slice its start indices
+        size_t sum = 0;
+        for (size_t value = 0; value < RADIX_DIGIT_VALUES; value++) {
+            for (size_t t = 0; t < threadCount; t++) {
+                size_t frequency = slices[t].histogram[value];
+                slices[t].histogram[value] = sum;
+                sum += frequency;
+            }
+        }
+
+        RunOnThreads(RadixScatterSlice, slices, sizeof(RadixSortSlice), threadCount);
+
+        size_t* temp = keys;
+        keys = sortedKeys;
+        sortedKeys = temp;
+    }
+
+    if (keys != outKeys) {
+        memcpy(outKeys, keys, count * sizeof(size_t));
+    }
+
+    free(scratch);
+    free(slices);
+    return true;
+}
+
+// Same as SortDateTimesPacked, but sorts on threadCount threads.
+bool SortDateTimesPackedParallel(const DateTime* dateTimes, size_t count, size_t* outKeys, size_t threadCount)
+{
+    if (!dateTimes || !outKeys) {
+        return false;
+    }
+
+    uint64_t* packedKeys = PackDateTimes(dateTimes, count);
+    if (packedKeys == NULL) {
+        return false;
+    }
+
+    bool success = RadixSortPackedKeysParallel(packedKeys, count, outKeys, threadCount);
+
+    free(packedKeys);
+    return success;
+}
+
+bool TestRadixSortPackedKeysParallel()
+{
+    const size_t count = RADIX_PARALLEL_MIN_COUNT * 2 + 3;
+    uint64_t* packedKeys = malloc(count * sizeof(uint64_t));
+    size_t* expectedKeys = malloc(count * sizeof(size_t));
+    size_t* sortedKeys = malloc(count * sizeof(size_t));
+    bool success = packedKeys && expectedKeys && sortedKeys;
+
+    // Pseudo-random DateTimes over a few years, with plenty of duplicates to check stability
+    uint64_t state = 12345;
+    for (size_t i = 0; success && i < count; i++) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        DateTime date = {
+            .year = 2000 + (unsigned int)(state >> 60) % 4,
+            .month = 1 + (unsigned int)(state >> 40) % 12,
+            .day = 1 + (unsigned int)(state >> 32) % 28,
+            .hour = (unsigned int)(state >> 24) % 24,
+            .minute = (unsigned int)(state >> 16) % 60,
+            .second = (unsigned int)(state >> 56) % 4,
+        };
+        packedKeys[i] = PackDateTime(&date);
+    }
+
+    success = success && RadixSortPackedKeys(packedKeys, count, expectedKeys);
+
+    const size_t threadCounts[] = { 2, 3, 8 };
+    for (size_t t = 0; success && t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++) {
+        success = RadixSortPackedKeysParallel(packedKeys, count, sortedKeys, threadCounts[t])
+            && memcmp(sortedKeys, expectedKeys, count * sizeof(size_t)) == 0;
+        printf("%zu threads: %s\n", threadCounts[t], success ? "matches serial sort" : "differs from serial sort");
+    }
+
+    free(sortedKeys);
+    free(expectedKeys);
+    free(packedKeys);
+    return success;
+}
+
+// Signature shared by the DateTime sorts, so that DistinctDateTimesWithSort can use any of them
+typedef bool(*DateTimeSortFunc)(const DateTime*, size_t, size_t*);
+
+// Finds the keys of unique entries in the given list of keys, which index into the given list of
+// DateTimes in ascending order, and places them in outKeys. outKeys may be the same array as
+// sortedKeys, in which case the distinct keys are compacted in place. If outCounts isn't NULL,
+// the number of times each distinct DateTime occurs is placed at the same index in outCounts.
+bool DistinctSortedDateTimesCounted(const DateTime* dateTimes, const size_t* sortedKeys, size_t count, size_t* outKeys, size_t* outCounts, size_t* outNewCount)
+{
+    if (!dateTimes || !sortedKeys || !outKeys || !outNewCount) {
+        return false;
+    }
+
+    size_t newCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Equal dates are contiguous; if a date equals the previous distinct date then skip it
+        if (newCount > 0) {
+            const DateTime* prevDate = &dateTimes[outKeys[newCount - 1]];
+            const DateTime* curDate = &dateTimes[sortedKeys[i]];
+            if (DateTimesEqual(prevDate, curDate)) {
+                if (outCounts) {
+                    outCounts[newCount - 1]++;
+                }
+                continue;
+            }
+        }
+
+        outKeys[newCount] = sortedKeys[i];
+        if (outCounts) {
+            outCounts[newCount] = 1;
+        }
+        newCount++;
+    }
+
+    *outNewCount = newCount;
+    return true;
+}
+
+// Same as DistinctSortedDateTimesCounted, without counting occurrences.
+bool DistinctSortedDateTimes(const DateTime* dateTimes, const size_t* sortedKeys, size_t count, size_t* outKeys, size_t* outNewCount)
+{
+    return DistinctSortedDateTimesCounted(dateTimes, sortedKeys, count, outKeys, NULL, outNewCount);
+}
+
+// Same as DistinctDateTimes, but orders the DateTimes with the given sort. The sort must place
+// equal DateTimes next to each other in ascending order.
+bool DistinctDateTimesWithSort(const DateTime* dateTimes, size_t count, DateTimeSortFunc sort, size_t* outKeys, size_t* outNewCount)
+{
+    if (!sort || !outKeys || !outNewCount) {
+        return false;
+    }
+
+    // Sort into outKeys, then compact the distinct keys in place
+    bool success = sort(dateTimes, count, outKeys)
+        && DistinctSortedDateTimes(dateTimes, outKeys, count, outKeys, outNewCount);
+
+    if (!success) {
+        *outNewCount = 0;
+    }
+
+    return success;
+}
+
+// Finds the set of keys in the given list of DateTimes that correspond to unique entries and places
+// them in outKeys.
+//
+// This uses a radix sort to organize DateTimes in ascending order, then scans the ordered list for
+// unique keys. This has two implications:
+//
+//   1) The algorithm is not stable, i.e., elements in outKeys will not appear in the same order as the input list
+//   2) The algorithm scales linearly with the number of DateTimes
+//
+bool DistinctDateTimes(const DateTime* dateTimes, size_t count, size_t* outKeys, size_t* outNewCount)
+{
+    return DistinctDateTimesWithSort(dateTimes, count, SortDateTimes, outKeys, outNewCount);
+}
+
+bool TestDistinctDateTimes()
+{
+    const size_t numDates = 8;
+    DateTime dates[numDates];
+
+    size_t distinctKeys[numDates] = { 0 };
+    size_t numDistinctKeys = 0;
+
+    PopulateDateTimeFromIsoString("0000-01-01T00:00:00", &dates[0]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:00:01", &dates[1]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[2]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[3]); // Copy
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[4]); // Copy
+    PopulateDateTimeFromIsoString("0000-01-01T01:01:01", &dates[5]);
+    PopulateDateTimeFromIsoString("1000-01-01T00:00:00", &dates[6]);
+    PopulateDateTimeFromIsoString("1000-01-01T00:00:00", &dates[7]); // Copy
+
+    if (!DistinctDateTimes(dates, numDates, distinctKeys, &numDistinctKeys)) {
+        return false;
+    }
+
+    // Three dates in the test set are copies and should be removed
+    if (numDistinctKeys != 5) {
+        return false;
+    }
+
+    printf("Distinct Dates:\n");
+    for (size_t i = 0; i < numDistinctKeys; i++) {
+        DateTime* pCurDate = &dates[distinctKeys[i]];
+        PrintDateTime(pCurDate);
+
+        if (i > 0) {
+            DateTime* pPrevDate = &dates[distinctKeys[i-1]];
+            if (!DateTimeLessThan(pPrevDate, pCurDate)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool TestDistinctSortedDateTimesCounted()
+{
+    const size_t numDates = 6;
+    DateTime dates[numDates];
+    size_t keys[numDates];
+    size_t counts[numDates];
+    size_t numDistinctKeys = 0;
+
+    PopulateDateTimeFromIsoString("2000-01-01T00:00:00Z", &dates[0]);
+    PopulateDateTimeFromIsoString("1999-01-01T00:00:00Z", &dates[1]);
+    PopulateDateTimeFromIsoString("2000-01-01T00:00:00Z", &dates[2]); // Copy of dates[0]
+    PopulateDateTimeFromIsoString("2001-01-01T00:00:00Z", &dates[3]);
+    PopulateDateTimeFromIsoString("2000-01-01T00:00:00Z", &dates[4]); // Copy of dates[0]
+    PopulateDateTimeFromIsoString("2001-01-01T00:00:00Z", &dates[5]); // Copy of dates[3]
+
+    // Compacting in place, as WriteDistinctDateTimes does
+    bool success = SortDateTimes(dates, numDates, keys)
+        && DistinctSortedDateTimesCounted(dates, keys, numDates, keys, counts, &numDistinctKeys)
+        && numDistinctKeys == 3;
+
+    const unsigned int expectedYears[] = { 1999, 2000, 2001 };
+    const size_t expectedCounts[] = { 1, 3, 2 };
+    for (size_t i = 0; success && i < numDistinctKeys; i++) {
+        success = dates[keys[i]].year == expectedYears[i] && counts[i] == expectedCounts[i];
+    }
+
+    return success;
+}
+
+// Returns the smallest power of two that is greater than or equal to the given value.
+size_t NextPowerOfTwo(size_t value)
+{
+    size_t power = 1;
+    while (power < value) {
+        power <<= 1;
+    }
+    return power;
+}
+
+// Maps a packed DateTime key onto a slot of a hash table of 2^(64 - shift) slots using
+// Fibonacci hashing, which spreads the mostly-sequential packed keys across the table. The
+// slot comes from the top bits of the product, which depend on every bit of the key.
+size_t HashPackedKey(uint64_t packed, unsigned int shift)
+{
+    return (size_t)((packed * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+// Finds the set of keys in the given list of DateTimes that correspond to unique entries and places
+// them in outKeys, in the order they first appear in the input list.
+//
+// Unlike DistinctDateTimes this does not sort; each DateTime is packed and inserted into an
+// open-addressing hash set (linear probing, sized to at least twice the input count so it never
+// needs to grow). This has two implications:
+//
+//   1) The algorithm is stable, i.e., outKeys holds the first occurrence of each DateTime in input order
+//   2) The algorithm makes a single pass over the DateTimes
+//
+bool DistinctDateTimesHashed(const DateTime* dateTimes, size_t count, size_t* outKeys, size_t* outNewCount)
+{
+    if (!dateTimes || !outKeys || !outNewCount) {
+        return false;
+    }
+
+    // Slots hold packed keys offset by one so that zero can mark an empty slot
+    const size_t slotCount = NextPowerOfTwo(count * 2 + 1);
+    const size_t slotMask = slotCount - 1;
+    const unsigned int slotShift = 64 - (unsigned int)__builtin_ctzll(slotCount);
+    uint64_t* slots = calloc(slotCount, sizeof(uint64_t));  // calloc should initialize memory to 0
+    if (slots == NULL) {
+        return false;
+    }
+
+    size_t newCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        const uint64_t entry = PackDateTime(&dateTimes[i]) + 1;
+        size_t slot = HashPackedKey(entry, slotShift);
+
+        while (slots[slot] != 0 && slots[slot] != entry) {
+            slot = (slot + 1) & slotMask;
+        }
+
+        if (slots[slot] == 0) {
+            slots[slot] = entry;
+            outKeys[newCount] = i;
+            newCount++;
+        }
+    }
+
+    *outNewCount = newCount;
+    free(slots);
+
+    return true;
+}
+
+bool TestDistinctDateTimesHashed()
+{
+    const size_t numDates = 8;
+    DateTime dates[numDates];
+
+    size_t distinctKeys[numDates] = { 0 };
+    size_t numDistinctKeys = 0;
+
+    PopulateDateTimeFromIsoString("1000-01-01T00:00:00", &dates[0]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:00:01", &dates[1]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[2]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[3]); // Copy
+    PopulateDateTimeFromIsoString("0000-01-01T00:00:00", &dates[4]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[5]); // Copy
+    PopulateDateTimeFromIsoString("1000-01-01T00:00:00", &dates[6]); // Copy
+    PopulateDateTimeFromIsoString("0000-01-01T01:01:01", &dates[7]);
+
+    if (!DistinctDateTimesHashed(dates, numDates, distinctKeys, &numDistinctKeys)) {
+        return false;
+    }
+
+    // First occurrences, in input order
+    const size_t expected[] = { 0, 1, 2, 4, 7 };
+    if (numDistinctKeys != sizeof(expected) / sizeof(expected[0])) {
+        return false;
     }
 
     printf("Distinct Dates:\n");
     for (size_t i = 0; i < numDistinctKeys; i++) {
-        DateTime* pCurDate = &dates[distinctKeys[i]];
-        PrintDateTime(pCurDate);
+        PrintDateTime(&dates[distinctKeys[i]]);
+
+        if (distinctKeys[i] != expected[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// A DateTimeBitmap records a set of DateTimes at one-second resolution as a two-level,
+// roaring-style bitmap. The first level has a slot per year, each lazily allocated with a
+// container for every (month, day) of that year. A day's container starts as a sorted array of
+// the seconds of the day that are present and is converted into a bitmap of all 86,400 seconds
+// once the array would be larger than the bitmap.
+//
+// Setting a bit per DateTime, then visiting set bits in order, yields the distinct DateTimes in
+// ascending order without sorting and without any key arrays.
+#define DAY_BITMAP_WORDS (SECONDS_PER_DAY / 64)
+#define DAY_ARRAY_MAX_CARDINALITY (SECONDS_PER_DAY / 32)  // Past this an array of uint32_t outgrows a bitmap
+#define DAY_ARRAY_MIN_CAPACITY 4
+#define BITMAP_YEAR_COUNT 10000
+#define BITMAP_DAYS_PER_YEAR (12 * 31)
+
+typedef struct dayContainer {
+    size_t cardinality;     // Number of seconds present in the day
+    size_t capacity;        // Capacity of seconds; unused once bits is allocated
+    uint32_t* seconds;      // Sorted seconds of the day (array container)
+    uint64_t* bits;         // One bit per second of the day (bitmap container)
+} DayContainer;
+
+typedef struct dateTimeBitmap {
+    DayContainer** years;   // BITMAP_YEAR_COUNT entries, each NULL or BITMAP_DAYS_PER_YEAR containers
+    size_t count;           // Number of distinct DateTimes in the set
+} DateTimeBitmap;
+
+// Initializes the given bitmap to the empty set. Returns true if successful.
+bool DateTimeBitmapInit(DateTimeBitmap* bitmap)
+{
+    if (!bitmap) {
+        return false;
+    }
+
+    bitmap->years = calloc(BITMAP_YEAR_COUNT, sizeof(DayContainer*));  // calloc should initialize memory to 0
+    bitmap->count = 0;
+
+    return bitmap->years != NULL;
+}
+
+// Frees all memory owned by the given bitmap.
+void DateTimeBitmapFree(DateTimeBitmap* bitmap)
+{
+    if (!bitmap || !bitmap->years) {
+        return;
+    }
+
+    for (size_t year = 0; year < BITMAP_YEAR_COUNT; year++) {
+        DayContainer* days = bitmap->years[year];
+        if (days == NULL) {
+            continue;
+        }
+
+        for (size_t day = 0; day < BITMAP_DAYS_PER_YEAR; day++) {
+            free(days[day].seconds);
+            free(days[day].bits);
+        }
+        free(days);
+    }
+
+    free(bitmap->years);
+    bitmap->years = NULL;
+    bitmap->count = 0;
+}
+
+// Converts the given array container into a bitmap container.
+bool DayContainerToBitmap(DayContainer* container)
+{
+    container->bits = calloc(DAY_BITMAP_WORDS, sizeof(uint64_t));  // calloc should initialize memory to 0
+    if (container->bits == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < container->cardinality; i++) {
+        uint32_t second = container->seconds[i];
+        container->bits[second / 64] |= (uint64_t)1 << (second % 64);
+    }
+
+    free(container->seconds);
+    container->seconds = NULL;
+    container->capacity = 0;
+
+    return true;
+}
+
+// Adds the given second of the day to the given container.
+// Returns true if successful; outInserted is set to false if the second was already present.
+bool DayContainerInsert(DayContainer* container, uint32_t second, bool* outInserted)
+{
+    *outInserted = false;
+
+    if (container->bits) {
+        uint64_t mask = (uint64_t)1 << (second % 64);
+        if ((container->bits[second / 64] & mask) == 0) {
+            container->bits[second / 64] |= mask;
+            container->cardinality++;
+            *outInserted = true;
+        }
+        return true;
+    }
+
+    // Binary search for the insertion point in the sorted array
+    size_t lo = 0;
+    size_t hi = container->cardinality;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (container->seconds[mid] < second) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    if (lo < container->cardinality && container->seconds[lo] == second) {
+        return true;
+    }
+
+    if (container->cardinality == DAY_ARRAY_MAX_CARDINALITY) {
+        return DayContainerToBitmap(container) && DayContainerInsert(container, second, outInserted);
+    }
+
+    if (container->cardinality == container->capacity) {
+        size_t capacity = container->capacity ? container->capacity * 2 : DAY_ARRAY_MIN_CAPACITY;
+        uint32_t* seconds = realloc(container->seconds, capacity * sizeof(uint32_t));
+        if (seconds == NULL) {
+            return false;
+        }
+        container->seconds = seconds;
+        container->capacity = capacity;
+    }
+
+    memmove(&container->seconds[lo + 1], &container->seconds[lo], (container->cardinality - lo) * sizeof(uint32_t));
+    container->seconds[lo] = second;
+    container->cardinality++;
+    *outInserted = true;
+
+    return true;
+}
+
+// Adds the given DateTime, which is assumed to be valid, to the given bitmap.
+// Returns true if successful; outInserted is set to false if the DateTime was already present.
+bool DateTimeBitmapAdd(DateTimeBitmap* bitmap, const DateTime* dateTime, bool* outInserted)
+{
+    *outInserted = false;
+    if (!bitmap || !bitmap->years || !dateTime) {
+        return false;
+    }
+
+    DayContainer** days = &bitmap->years[dateTime->year];
+    if (*days == NULL) {
+        *days = calloc(BITMAP_DAYS_PER_YEAR, sizeof(DayContainer));  // calloc should initialize memory to 0
+        if (*days == NULL) {
+            return false;
+        }
+    }
+
+    DayContainer* container = &(*days)[(dateTime->month - 1) * 31 + (dateTime->day - 1)];
+    uint32_t second = dateTime->hour * 3600 + dateTime->minute * 60 + dateTime->second;
+
+    if (!DayContainerInsert(container, second, outInserted)) {
+        return false;
+    }
+
+    if (*outInserted) {
+        bitmap->count++;
+    }
+
+    return true;
+}
+
+// Adds the given DateTime, which is assumed to be valid, to the given bitmap.
+// Returns true if successful.
+bool DateTimeBitmapInsert(DateTimeBitmap* bitmap, const DateTime* dateTime)
+{
+    bool inserted;
+    return DateTimeBitmapAdd(bitmap, dateTime, &inserted);
+}
+
+// Returns true if the given DateTime, which is assumed to be valid, is in the given bitmap.
+bool DateTimeBitmapContains(const DateTimeBitmap* bitmap, const DateTime* dateTime)
+{
+    if (!bitmap || !bitmap->years || !dateTime || !bitmap->years[dateTime->year]) {
+        return false;
+    }
+
+    const DayContainer* container = &bitmap->years[dateTime->year][(dateTime->month - 1) * 31 + (dateTime->day - 1)];
+    uint32_t second = dateTime->hour * 3600 + dateTime->minute * 60 + dateTime->second;
+
+    if (container->bits) {
+        return (container->bits[second / 64] >> (second % 64)) & 1;
+    }
+
+    size_t lo = 0;
+    size_t hi = container->cardinality;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (container->seconds[mid] < second) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return lo < container->cardinality && container->seconds[lo] == second;
+}
+
+// Calls visit with each second in the given day container as dateTime, whose date fields are
+// already set, in ascending order. If filter is true, only seconds whose packed key is in
+// [firstKey, lastKey] are visited.
+void DayContainerForEach(const DayContainer* container, DateTime* dateTime, bool filter, uint64_t firstKey, uint64_t lastKey, void(*visit)(const DateTime*, void*), void* context)
+{
+    if (container->bits) {
+        for (size_t word = 0; word < DAY_BITMAP_WORDS; word++) {
+            uint64_t bits = container->bits[word];
+            while (bits) {
+                uint32_t second = (uint32_t)(word * 64) + (uint32_t)__builtin_ctzll(bits);
+                bits &= bits - 1;  // Clear lowest set bit
+
+                dateTime->hour = second / 3600;
+                dateTime->minute = (second / 60) % 60;
+                dateTime->second = second % 60;
+                if (!filter || (PackDateTime(dateTime) >= firstKey && PackDateTime(dateTime) <= lastKey)) {
+                    visit(dateTime, context);
+                }
+            }
+        }
+    }
+    else {
+        for (size_t i = 0; i < container->cardinality; i++) {
+            uint32_t second = container->seconds[i];
+
+            dateTime->hour = second / 3600;
+            dateTime->minute = (second / 60) % 60;
+            dateTime->second = second % 60;
+            if (!filter || (PackDateTime(dateTime) >= firstKey && PackDateTime(dateTime) <= lastKey)) {
+                visit(dateTime, context);
+            }
+        }
+    }
+}
+
+// Calls visit with each DateTime in the given bitmap whose packed key from PackDateTime is in
+// [*firstKey, lastKey], in ascending order, stopping after the day that brings the number
+// visited to maxCount or more. Advances *firstKey past the last day visited. Returns true if
+// the range may hold more DateTimes.
+bool DateTimeBitmapForEachInRangeLimited(const DateTimeBitmap* bitmap, uint64_t* firstKey, uint64_t lastKey, size_t maxCount, void(*visit)(const DateTime*, void*), void* context)
+{
+    if (!bitmap || !bitmap->years || !visit || *firstKey > lastKey) {
+        return false;
+    }
+
+    const uint64_t firstYear = *firstKey >> PACKED_YEAR_SHIFT;
+    size_t visited = 0;
+    const uint64_t lastYear = lastKey >> PACKED_YEAR_SHIFT;
+
+    DateTime dateTime;
+    for (size_t year = (size_t)firstYear; year <= lastYear && year < BITMAP_YEAR_COUNT; year++) {
+        const DayContainer* days = bitmap->years[year];
+        if (days == NULL) {
+            continue;
+        }
+
+        dateTime.year = (unsigned int)year;
+        for (size_t day = 0; day < BITMAP_DAYS_PER_YEAR; day++) {
+            const DayContainer* container = &days[day];
+            if (container->cardinality == 0) {
+                continue;
+            }
+
+            dateTime.month = (unsigned int)(day / 31) + 1;
+            dateTime.day = (unsigned int)(day % 31) + 1;
+            dateTime.hour = 0;
+            dateTime.minute = 0;
+            dateTime.second = 0;
+
+            // Only the days the range starts or ends in need each second checked
+            const uint64_t dayFirstKey = PackDateTime(&dateTime);
+            const uint64_t dayLastKey = dayFirstKey | ((1ull << PACKED_DAY_SHIFT) - 1);
+            if (dayLastKey < *firstKey || dayFirstKey > lastKey) {
+                continue;
+            }
+
+            bool filter = dayFirstKey < *firstKey || dayLastKey > lastKey;
+            DayContainerForEach(container, &dateTime, filter, *firstKey, lastKey, visit, context);
+
+            visited += container->cardinality;
+            if (visited >= maxCount) {
+                *firstKey = dayLastKey + 1;
+                return dayLastKey < lastKey;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Calls visit with each DateTime in the given bitmap whose packed key from PackDateTime is in
+// [firstKey, lastKey], in ascending order.
+void DateTimeBitmapForEachInRange(const DateTimeBitmap* bitmap, uint64_t firstKey, uint64_t lastKey, void(*visit)(const DateTime*, void*), void* context)
+{
+    DateTimeBitmapForEachInRangeLimited(bitmap, &firstKey, lastKey, SIZE_MAX, visit, context);
+}
+
+// Calls visit with each DateTime in the given bitmap, in ascending order.
+void DateTimeBitmapForEach(const DateTimeBitmap* bitmap, void(*visit)(const DateTime*, void*), void* context)
+{
+    DateTimeBitmapForEachInRange(bitmap, 0, UINT64_MAX, visit, context);
+}
+
+// Adds the given list of DateTimes to the given, initialized bitmap, leaving it holding the
+// distinct DateTimes of the list.
+bool DistinctDateTimesBitmap(const DateTime* dateTimes, size_t count, DateTimeBitmap* outBitmap)
+{
+    if (!dateTimes || !outBitmap) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!DateTimeBitmapInsert(outBitmap, &dateTimes[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Bitmap visitor that appends each DateTime to the DateTime buffer given as context
+void CollectDateTime(const DateTime* dateTime, void* context)
+{
+    DateTime** cursor = (DateTime**)context;
+    **cursor = *dateTime;
+    (*cursor)++;
+}
+
+bool TestDistinctDateTimesBitmap()
+{
+    const size_t numDates = 8;
+    DateTime dates[numDates];
+    DateTime distinctDates[numDates];
+
+    PopulateDateTimeFromIsoString("1000-01-01T00:00:00", &dates[0]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:00:01", &dates[1]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[2]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[3]); // Copy
+    PopulateDateTimeFromIsoString("0000-01-01T00:00:00", &dates[4]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:01:01", &dates[5]); // Copy
+    PopulateDateTimeFromIsoString("1000-01-01T00:00:00", &dates[6]); // Copy
+    PopulateDateTimeFromIsoString("9999-12-31T23:59:59", &dates[7]);
+
+    DateTimeBitmap bitmap;
+    if (!DateTimeBitmapInit(&bitmap)) {
+        return false;
+    }
+
+    bool success = DistinctDateTimesBitmap(dates, numDates, &bitmap) && bitmap.count == 5;
+
+    DateTime* cursor = distinctDates;
+    DateTimeBitmapForEach(&bitmap, CollectDateTime, &cursor);
+    success = success && (size_t)(cursor - distinctDates) == bitmap.count;
+
+    // Fill one day past the array container limit to exercise the bitmap container
+    DateTime date;
+    PopulateDateTimeFromIsoString("2085-09-28T00:00:00", &date);
+    for (unsigned int second = 0; second < SECONDS_PER_DAY; second += 7) {
+        date.hour = second / 3600;
+        date.minute = (second / 60) % 60;
+        date.second = second % 60;
+        success = success && DateTimeBitmapInsert(&bitmap, &date) && DateTimeBitmapInsert(&bitmap, &date);
+    }
+    success = success && bitmap.count == 5 + (SECONDS_PER_DAY + 6) / 7;
+
+    DateTimeBitmapFree(&bitmap);
+
+    if (!success) {
+        return false;
+    }
+
+    printf("Distinct Dates:\n");
+    for (size_t i = 0; i < (size_t)(cursor - distinctDates); i++) {
+        PrintDateTime(&distinctDates[i]);
+
+        if (i > 0 && !DateTimeLessThan(&distinctDates[i - 1], &distinctDates[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// An arena reserves one range of address space up front and hands out pieces of it by bumping
+// an offset, so buffers sized from the input are never reallocated and copied. Pages are only
+// backed when first touched, so reserving for the largest possible input costs nothing until
+// it's used.
+#define ARENA_ALIGNMENT 64                      // Cache line
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct arena {
+    char* base;         // Start of the reserved address space, or NULL
+    size_t reserved;    // Bytes of address space reserved
+    size_t used;        // Bytes handed out since the arena was initialized
+} Arena;
+
+// Reserves at least the given number of bytes of address space for the given arena.
+//
+// With hugePages, explicit huge pages are tried first. They are committed when mapped, so if
+// the administrator hasn't set aside enough the mapping fails here rather than on first touch,
+// and the arena falls back to normal pages advised for transparent huge pages. Either way a
+// large input takes up to 512 times fewer page faults. Returns true if successful.
+bool ArenaInit(Arena* arena, size_t reserve, bool hugePages)
+{
+    if (!arena) {
+        return false;
+    }
+
+    arena->base = NULL;
+    arena->reserved = 0;
+    arena->used = 0;
+
+    // Rounding up to whole huge pages costs only address space
+    const size_t reserved = (reserve / ARENA_HUGE_PAGE_SIZE + 1) * ARENA_HUGE_PAGE_SIZE;
+    void* base = MAP_FAILED;
+    if (hugePages) {
+        base = mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        if (hugePages) {
+            madvise(base, reserved, MADV_HUGEPAGE);
+        }
+    }
+
+    arena->base = base;
+    arena->reserved = reserved;
+    return true;
+}
+
+// Returns the given number of bytes from the given arena, aligned to a cache line, or NULL if
+// the arena isn't initialized or is exhausted. Memory handed out is only released by
+// ArenaFree.
+void* ArenaAlloc(Arena* arena, size_t size)
+{
+    if (!arena || !arena->base) {
+        return NULL;
+    }
+
+    const size_t start = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (start > arena->reserved || size > arena->reserved - start) {
+        return NULL;
+    }
+
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+// Same as ArenaAlloc, but falls back to malloc if the arena is NULL or can't satisfy the
+// request, setting outMalloced so that the caller knows to free the memory.
+void* ArenaAllocOrMalloc(Arena* arena, size_t size, bool* outMalloced)
+{
+    void* memory = ArenaAlloc(arena, size);
+    *outMalloced = memory == NULL;
+    return memory ? memory : malloc(size ? size : 1);
+}
+
+void ArenaFree(Arena* arena)
+{
+    if (arena && arena->base) {
+        munmap(arena->base, arena->reserved);
+        arena->base = NULL;
+        arena->reserved = 0;
+        arena->used = 0;
+    }
+}
+
+bool TestArena()
+{
+    Arena arena;
+    if (!ArenaInit(&arena, 1000, false)) {
+        return false;
+    }
+
+    // Pieces are aligned and disjoint, and the reservation is whole huge pages
+    char* first = ArenaAlloc(&arena, 3);
+    char* second = ArenaAlloc(&arena, 100);
+    bool success = first != NULL && second != NULL && arena.reserved == ARENA_HUGE_PAGE_SIZE
+        && (uintptr_t)first % ARENA_ALIGNMENT == 0 && (uintptr_t)second % ARENA_ALIGNMENT == 0
+        && second >= first + 3;
+    if (success) {
+        memset(first, 1, 3);
+        memset(second, 2, 100);
+        success = first[2] == 1;
+    }
+
+    // An exhausted arena refuses, and the fallback comes from malloc
+    bool malloced = false;
+    success = success && ArenaAlloc(&arena, arena.reserved) == NULL;
+    void* fallback = ArenaAllocOrMalloc(&arena, arena.reserved, &malloced);
+    success = success && fallback != NULL && malloced;
+    free(fallback);
+
+    ArenaFree(&arena);
+    success = success && ArenaAlloc(&arena, 1) == NULL;
+
+    // Huge pages fall back to normal ones when none are set aside
+    success = success && ArenaInit(&arena, 1, true) && ArenaAlloc(&arena, 1) != NULL;
+    ArenaFree(&arena);
+
+    return success;
+}
+
+// Returns the most DateTimes that lines of ISO 8601 date strings in the given number of bytes
+// can hold. Every valid line has at least ISO_GMT_LEN characters, and all but the last are
+// followed by a newline.
+size_t DateTimeCountBound(size_t bytes)
+{
+    return bytes / (ISO_GMT_LEN + 1) + 1;
+}
+
+// Returns DateTimeCountBound for the current size of the given file if it's a regular file,
+// or for an empty file otherwise.
+size_t FileDateTimeCountBound(FILE* stream)
+{
+    struct stat fileStat;
+    if (fstat(fileno(stream), &fileStat) == 0 && S_ISREG(fileStat.st_mode) && fileStat.st_size > 0) {
+        return DateTimeCountBound((size_t)fileStat.st_size);
+    }
+    return DateTimeCountBound(0);
+}
+
+// Returns the size of the longest prefix of the given input, ending at a line boundary, for
+// which DateTimeCountBound is at most maxCount. This is the whole input if it fits.
+size_t FittingInputSize(const char* input, size_t size, size_t maxCount)
+{
+    if (maxCount == 0) {
+        return 0;
+    }
+    if (DateTimeCountBound(size) <= maxCount) {
+        return size;
+    }
+
+    // DateTimeCountBound of this many bytes is exactly maxCount
+    const size_t maxSize = maxCount * (ISO_GMT_LEN + 1) - 1;
+    const char* newline = memrchr(input, '\n', maxSize);
+    return newline ? (size_t)(newline - input) + 1 : 0;
+}
+
+// Doubles the given buffer of n bytes, which must come from malloc. Returns false, leaving the
+// buffer as it was, if out of memory.
+bool GrowDateTimeBuffer(DateTime** dateTimeBuff, size_t* n)
+{
+    const size_t size = *n ? *n * 2 : sizeof(DateTime);
+    DateTime* grown = (DateTime*)realloc(*dateTimeBuff, size);
+    if (grown == NULL) {
+        return false;
+    }
+
+    *dateTimeBuff = grown;
+    *n = size;
+    return true;
+}
+
+// Reads the given file containing ISO 8601 format date strings on each line into
+// a DateTime buffer. If dateTimeBuff is NULL and n is 0 a buffer will be initialized
+// for the caller. Regardless, it is the caller's responsibility to free the buffer
+// when finished with it.
+//
+// A buffer that fills up is grown with realloc, so a buffer supplied by the caller must come
+// from malloc unless it has room for every DateTime the input can hold.
+#define MAX_ISO_DATE_LEN 25;
+size_t IngestDateTimes(DateTime** dateTimeBuff, size_t* n, FILE* stream)
+{
+    if (!dateTimeBuff || !n || !stream) {
+        return 0;
+    }
+
+    // If caller didn't allocate dateTimeBuff (and no size is provided) we can allocate it. A
+    // regular file bounds the number of DateTimes it holds, so the buffer is sized once rather
+    // than doubling; it still grows if the file does while being read
+    if (*dateTimeBuff == NULL) {
+        if (*n == 0) {
+            const size_t bound = FileDateTimeCountBound(stream);
+            *dateTimeBuff = (DateTime*)calloc(bound, sizeof(DateTime));
+            if (*dateTimeBuff == NULL) {
+                return 0;
+            }
+            *n = bound * sizeof(DateTime);
+        }
+        else { // If user provided a non-zero size but no dateTimeBuff, then fail
+            return 0;
+        }
+    }
+    
+    char* buff;
+    size_t buffSize = MAX_ISO_DATE_LEN;
+
+    buff = (char*)malloc(buffSize * sizeof(char));
+    if (buff == NULL) {
+        return 0;
+    }
+
+    ssize_t chars = 0;
+    size_t validDateTimes = 0;
+    LineCounter counter = { 0 };
+
+    while (!feof(stream)) {
+        chars = getline(&buff, &buffSize, stream);
+        if (chars > 0) {
+            // If we're out of space, allocate more, or stop with what was read if there is none
+            const size_t spaceRemaining = *n - (validDateTimes * sizeof(DateTime));
+            if (spaceRemaining < sizeof(DateTime) && !GrowDateTimeBuffer(dateTimeBuff, n)) {
+                break;
+            }
+
+            if (ParseCountedLine(buff, strlen(buff), &(*dateTimeBuff)[validDateTimes], &counter)) {
+                validDateTimes++;
+            }
+        }
+        else {
+            break;  // End of file, or a read error
+        }
+    }
+
+    FlushLineCounter(&counter);
+    free(buff);
+
+    return validDateTimes;
+}
+
+// Memory maps the whole of the given file for reading, advising the kernel that it will be
+// read sequentially. Returns NULL if the file is empty or cannot be mapped; otherwise the
+// caller must munmap the returned mapping of outSize bytes.
+const char* MapInputFile(FILE* stream, size_t* outSize)
+{
+    int fd = fileno(stream);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0) {
+        return NULL;
+    }
+
+    const size_t fileSize = (size_t)fileStat.st_size;
+    const char* mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    madvise((void*)mapping, fileSize, MADV_SEQUENTIAL);
+
+    *outSize = fileSize;
+    return mapping;
+}
+
+// Returns whether the given file is an empty regular file, which MapInputFile can't map but
+// which holds no lines rather than being unreadable.
+bool IsEmptyRegularFile(FILE* stream)
+{
+    struct stat fileStat;
+    return fstat(fileno(stream), &fileStat) == 0 && S_ISREG(fileStat.st_mode) && fileStat.st_size == 0;
+}
+
+// Parses the ISO 8601 date string on each line in [begin, end) in place, appending valid
+// DateTimes to the given buffer of n bytes after the first count entries and growing the
+// buffer as needed, stopping early if it can't be grown. Lines are counted in the calling
+// thread's statistics unless countLines is false. Returns the new number of DateTimes in the
+// buffer.
+size_t ParseDateTimeLines(const char* begin, const char* end, DateTime** dateTimeBuff, size_t* n, size_t count, bool countLines)
+{
+    LineCounter counter = { 0 };
+    size_t validDateTimes = count;
+    const char* line = begin;
+
+    while (line < end) {
+        const char* newline = memchr(line, '\n', (size_t)(end - line));
+        const char* lineEnd = newline ? newline : end;
+
+        // If we're out of space, allocate more, or stop with what was parsed if there is none
+        const size_t spaceRemaining = *n - (validDateTimes * sizeof(DateTime));
+        if (spaceRemaining < sizeof(DateTime) && !GrowDateTimeBuffer(dateTimeBuff, n)) {
+            break;
+        }
+
+        DateTime* dateTime = &(*dateTimeBuff)[validDateTimes];
+        const size_t length = (size_t)(lineEnd - line);
+        if (countLines ? ParseCountedLine(line, length, dateTime, &counter) : PopulateDateTimeFromIsoCharsFast(line, length, dateTime)) {
+            validDateTimes++;
+        }
+
+        line = lineEnd + 1;
+    }
+
+    if (countLines) {
+        FlushLineCounter(&counter);
+    }
+
+    return validDateTimes;
+}
+
+// Reads the given file containing ISO 8601 format date strings on each line into a DateTime
+// buffer, the same as IngestDateTimes, but memory maps the file and parses each line in place.
+// This avoids stdio's line handling and copying each line out of the stream, so stream must
+// refer to a regular file that can be mapped.
+//
+// A buffer supplied by the caller is never reallocated, so it may come from an arena: lines
+// past those it is sure to hold, such as lines appended since it was sized for the file, are
+// left unread.
+//
+// Sets outCount to the number of DateTimes read. Returns false if the file can't be mapped,
+// such as when it is a pipe, as opposed to holding no DateTimes.
+bool IngestDateTimesMapped(DateTime** dateTimeBuff, size_t* n, FILE* stream, size_t* outCount)
+{
+    *outCount = 0;
+    if (!dateTimeBuff || !n || !stream) {
+        return false;
+    }
+    const bool callerBuffer = *dateTimeBuff != NULL;
+
+    // If caller didn't allocate dateTimeBuff (and no size is provided) we can allocate it,
+    // with room for every DateTime the file can hold so that it never grows
+    if (*dateTimeBuff == NULL) {
+        if (*n == 0) {
+            const size_t bound = FileDateTimeCountBound(stream);
+            *dateTimeBuff = (DateTime*)calloc(bound, sizeof(DateTime));
+            if (*dateTimeBuff == NULL) {
+                return false;
+            }
+            *n = bound * sizeof(DateTime);
+        }
+        else { // If user provided a non-zero size but no dateTimeBuff, then fail
+            return false;
+        }
+    }
+
+    size_t fileSize = 0;
+    const char* mapping = MapInputFile(stream, &fileSize);
+    if (mapping == NULL) {
+        return IsEmptyRegularFile(stream);
+    }
+
+    const size_t inputSize = callerBuffer ? FittingInputSize(mapping, fileSize, *n / sizeof(DateTime)) : fileSize;
+    *outCount = ParseDateTimeLines(mapping, mapping + inputSize, dateTimeBuff, n, 0, true);
+
+    munmap((void*)mapping, fileSize);
+
+    return true;
+}
+
+bool TestIngestDateTimesMapped()
+{
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        return false;
+    }
+
+    // Last line is deliberately left without a newline
+    fputs("2085-09-28T20:33:29Z\n"
+        "Hello, world!\n"
+        "2085-09-28T08:03:29+12:30\r\n"
+        "\n"
+        "2085-09-28T20:33:29", file);
+    fflush(file);
+
+    DateTime* dates = NULL;
+    size_t datesSize = 0;
+    size_t numDates = 0;
+    bool success = IngestDateTimesMapped(&dates, &datesSize, file, &numDates);
+
+    DateTime expected;
+    PopulateDateTimeFromIsoString("2085-09-28T20:33:29Z", &expected);
+
+    success = success && numDates == 2
+        && DateTimesEqual(&dates[0], &expected)
+        && DateTimesEqual(&dates[1], &expected);
+    free(dates);
+
+    // A buffer from the caller too small for the file, as when it grew after the buffer was
+    // sized, is filled with the whole lines it is sure to hold and not reallocated
+    Arena arena = { 0 };
+    success = success && ArenaInit(&arena, 2 * sizeof(DateTime), false);
+    DateTime* slots = ArenaAlloc(&arena, 2 * sizeof(DateTime));
+    dates = slots;
+    datesSize = 2 * sizeof(DateTime);
+    success = success && IngestDateTimesMapped(&dates, &datesSize, file, &numDates) && numDates == 1
+        && dates == slots && DateTimesEqual(&dates[0], &expected);
+    ArenaFree(&arena);
+    fclose(file);
+
+    // A pipe can't be mapped, which is an error rather than an input with no DateTimes
+    int pipeFds[2];
+    FILE* pipeFile = NULL;
+    success = success && pipe(pipeFds) == 0;
+    if (success) {
+        close(pipeFds[1]);
+        pipeFile = fdopen(pipeFds[0], "r");
+        success = pipeFile != NULL;
+    }
+    dates = NULL;
+    datesSize = 0;
+    success = success && !IngestDateTimesMapped(&dates, &datesSize, pipeFile, &numDates) && numDates == 0;
+    free(dates);
+    if (pipeFile) {
+        fclose(pipeFile);
+    }
+
+    // An empty file holds no DateTimes but isn't an error
+    FILE* emptyFile = tmpfile();
+    dates = NULL;
+    datesSize = 0;
+    success = success && emptyFile != NULL && IngestDateTimesMapped(&dates, &datesSize, emptyFile, &numDates) && numDates == 0;
+    free(dates);
+    if (emptyFile) {
+        fclose(emptyFile);
+    }
+
+    return success;
+}
+
+// DateTimes are always written in the fixed-width form YYYY-MM-DDThh:mm:ssZ followed by a
+// newline, so output can be formatted with table lookups instead of printf, and the size of
+// the output is known up front.
+#define ISO_LINE_LEN (ISO_GMT_LEN + 1)
+#define DATE_TIME_WRITER_BUFFER_SIZE (ISO_LINE_LEN * 64 * 1024)
+
+// Two ASCII digits for each value in [0, 99]
+static const char TwoDigits[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Writes the given DateTime, which is assumed to be valid, to dst in ISO 8601 format followed by
+// a newline. Writes exactly ISO_LINE_LEN characters and no null terminator; the output is the
+// same as FPrintDateTime's.
+void FormatDateTime(char* dst, const DateTime* dateTime)
+{
+    memcpy(&dst[0], &TwoDigits[(dateTime->year / 100) * 2], 2);
+    memcpy(&dst[2], &TwoDigits[(dateTime->year % 100) * 2], 2);
+    dst[4] = '-';
+    memcpy(&dst[5], &TwoDigits[dateTime->month * 2], 2);
+    dst[7] = '-';
+    memcpy(&dst[8], &TwoDigits[dateTime->day * 2], 2);
+    dst[10] = 'T';
+    memcpy(&dst[11], &TwoDigits[dateTime->hour * 2], 2);
+    dst[13] = ':';
+    memcpy(&dst[14], &TwoDigits[dateTime->minute * 2], 2);
+    dst[16] = ':';
+    memcpy(&dst[17], &TwoDigits[dateTime->second * 2], 2);
+    dst[19] = 'Z';
+    dst[20] = '\n';
+}
+
+// Writes all of the given buffer to the given file descriptor. Returns true if successful.
+bool WriteAll(int fd, const char* buffer, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, buffer, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        buffer += written;
+        size -= (size_t)written;
+    }
+
+    return true;
+}
+
+// Formats DateTimes into a large buffer that is written to a file descriptor only when full,
+// bypassing stdio and its per-call format parsing.
+typedef struct dateTimeWriter {
+    int fd;
+    char* buffer;           // DATE_TIME_WRITER_BUFFER_SIZE bytes
+    size_t used;            // Bytes of buffer waiting to be written
+    bool failed;            // True once any write has failed
+} DateTimeWriter;
+
+// Initializes the given writer to write to the given file stream, which is flushed first so
+// that earlier output stays in order. Returns true if successful.
+bool DateTimeWriterInit(DateTimeWriter* writer, FILE* stream)
+{
+    if (!writer) {
+        return false;
+    }
+
+    writer->fd = -1;
+    writer->buffer = NULL;
+    writer->used = 0;
+    writer->failed = false;
+
+    if (!stream || fflush(stream) != 0) {
+        return false;
+    }
+
+    writer->fd = fileno(stream);
+    if (writer->fd < 0) {
+        return false;
+    }
+
+    writer->buffer = malloc(DATE_TIME_WRITER_BUFFER_SIZE);
+    return writer->buffer != NULL;
+}
+
+// Writes any buffered output. Returns true if all output so far has been written.
+bool DateTimeWriterFlush(DateTimeWriter* writer)
+{
+    if (writer->used > 0 && !writer->failed) {
+        writer->failed = !WriteAll(writer->fd, writer->buffer, writer->used);
+    }
+    writer->used = 0;
+
+    return !writer->failed;
+}
+
+// Adds the given DateTime to the given writer's output.
+void DateTimeWriterPut(DateTimeWriter* writer, const DateTime* dateTime)
+{
+    if (writer->used + ISO_LINE_LEN > DATE_TIME_WRITER_BUFFER_SIZE) {
+        DateTimeWriterFlush(writer);
+    }
+
+    FormatDateTime(&writer->buffer[writer->used], dateTime);
+    writer->used += ISO_LINE_LEN;
+}
+
+// Longest line DateTimeWriterPutCount writes: a date, a tab, up to 20 digits and a newline
+#define COUNT_LINE_MAX_LEN (ISO_GMT_LEN + 1 + 20 + 1)
+
+// Adds the given DateTime to the given writer's output as a line of the date, a tab and the
+// given count.
+void DateTimeWriterPutCount(DateTimeWriter* writer, const DateTime* dateTime, size_t count)
+{
+    if (writer->used + COUNT_LINE_MAX_LEN > DATE_TIME_WRITER_BUFFER_SIZE) {
+        DateTimeWriterFlush(writer);
+    }
+
+    char* dst = &writer->buffer[writer->used];
+    FormatDateTime(dst, dateTime);
+    dst[ISO_GMT_LEN] = '\t';  // Replaces the newline
+
+    // Digits come out least significant first
+    char digits[20];
+    size_t digitCount = 0;
+    do {
+        digits[digitCount++] = (char)('0' + count % 10);
+        count /= 10;
+    } while (count > 0);
+
+    for (size_t i = 0; i < digitCount; i++) {
+        dst[ISO_GMT_LEN + 1 + i] = digits[digitCount - 1 - i];
+    }
+    dst[ISO_GMT_LEN + 1 + digitCount] = '\n';
+
+    writer->used += ISO_GMT_LEN + 2 + digitCount;
+}
+
+// Flushes and frees the given writer. Returns true if all output was written.
+bool DateTimeWriterFree(DateTimeWriter* writer)
+{
+    bool success = DateTimeWriterFlush(writer);
+
+    free(writer->buffer);
+    writer->buffer = NULL;
+
+    return success;
+}
+
+// Bitmap visitor that adds each DateTime to the DateTimeWriter given as context
+void DateTimeWriterVisitor(const DateTime* dateTime, void* context)
+{
+    DateTimeWriterPut((DateTimeWriter*)context, dateTime);
+}
+
+// One thread's share of WriteDateTimesMapped
+typedef struct formatSlice {
+    const DateTime* dateTimes;
+    const size_t* keys;
+    size_t begin;
+    size_t end;
+    char* output;           // Start of the whole mapped output
+} FormatSlice;
+
+void* FormatSliceThread(void* arg)
+{
+    FormatSlice* slice = (FormatSlice*)arg;
+
+    for (size_t i = slice->begin; i < slice->end; i++) {
+        FormatDateTime(&slice->output[i * ISO_LINE_LEN], &slice->dateTimes[slice->keys[i]]);
+    }
+
+    return NULL;
+}
+
+// Writes the DateTimes at the given keys to the given file stream, which must refer to an empty
+// regular file. The file's blocks for exactly count lines are allocated up front and the file
+// memory mapped, and slices of the keys are formatted straight into the mapping on threadCount
+// threads. Allocating the blocks first means a full disk fails here rather than with SIGBUS
+// while a thread writes to the mapping.
+//
+// Returns false if the file can't be allocated or mapped. Sets outUntouched to whether the file
+// was left empty, so that the DateTimes can still be written another way.
+bool WriteDateTimesMapped(FILE* stream, const DateTime* dateTimes, const size_t* keys, size_t count, size_t threadCount, bool* outUntouched)
+{
+    *outUntouched = true;
+    if (!stream || !dateTimes || !keys || count == 0 || threadCount == 0 || fflush(stream) != 0) {
+        return false;
+    }
+
+    int fd = fileno(stream);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode) || fileStat.st_size != 0) {
+        return false;
+    }
+
+    const size_t outputSize = count * ISO_LINE_LEN;
+    if (posix_fallocate(fd, 0, (off_t)outputSize) != 0) {
+        *outUntouched = ftruncate(fd, 0) == 0;
+        return false;
+    }
+
+    char* output = mmap(NULL, outputSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    FormatSlice* slices = calloc(threadCount, sizeof(FormatSlice));
+    if (output == MAP_FAILED || slices == NULL) {
+        if (output != MAP_FAILED) {
+            munmap(output, outputSize);
+        }
+        free(slices);
+        *outUntouched = ftruncate(fd, 0) == 0;
+        return false;
+    }
+
+    for (size_t t = 0; t < threadCount; t++) {
+        slices[t].dateTimes = dateTimes;
+        slices[t].keys = keys;
+        slices[t].begin = count * t / threadCount;
+        slices[t].end = count * (t + 1) / threadCount;
+        slices[t].output = output;
+    }
+
+    RunOnThreads(FormatSliceThread, slices, sizeof(FormatSlice), threadCount);
+
+    free(slices);
+    munmap(output, outputSize);
+
+    // Anything written to the stream after this must follow the mapped output
+    if (lseek(fd, 0, SEEK_END) != (off_t)outputSize) {
+        *outUntouched = false;
+        return false;
+    }
+
+    return true;
+}
+
+// Writes the DateTimes at the given keys to the given file stream. With more than one thread
+// they are formatted in parallel into a mapping of the output file where possible; otherwise
+// they are formatted through a DateTimeWriter, unless the mapped write failed after changing
+// the file.
+bool WriteDateTimes(FILE* stream, const DateTime* dateTimes, const size_t* keys, size_t count, size_t threadCount)
+{
+    bool untouched = true;
+    if (threadCount > 1 && WriteDateTimesMapped(stream, dateTimes, keys, count, threadCount, &untouched)) {
+        return true;
+    }
+    if (!untouched) {
+        return false;
+    }
+
+    DateTimeWriter writer;
+    if (!DateTimeWriterInit(&writer, stream)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        DateTimeWriterPut(&writer, &dateTimes[keys[i]]);
+    }
+
+    return DateTimeWriterFree(&writer);
+}
+
+// A distinct DateTime, by its key, with the number of times it occurs
+typedef struct dateTimeCount {
+    size_t key;
+    size_t count;
+} DateTimeCount;
+
+// Returns true if lhs ranks below rhs: it occurs less often, or as often but is later.
+bool DateTimeCountRanksBelow(const DateTime* dateTimes, const DateTimeCount* lhs, const DateTimeCount* rhs)
+{
+    if (lhs->count != rhs->count) {
+        return lhs->count < rhs->count;
+    }
+    return DateTimeLessThan(&dateTimes[rhs->key], &dateTimes[lhs->key]);
+}
+
+// Restores the min-heap property of the given heap, whose root ranks lowest, for the subtree at
+// the given position.
+void DateTimeCountHeapSiftDown(const DateTime* dateTimes, DateTimeCount* heap, size_t heapCount, size_t pos)
+{
+    while (true) {
+        size_t lowest = pos;
+        size_t left = pos * 2 + 1;
+        size_t right = left + 1;
+
+        if (left < heapCount && DateTimeCountRanksBelow(dateTimes, &heap[left], &heap[lowest])) {
+            lowest = left;
+        }
+        if (right < heapCount && DateTimeCountRanksBelow(dateTimes, &heap[right], &heap[lowest])) {
+            lowest = right;
+        }
+        if (lowest == pos) {
+            return;
+        }
+
+        DateTimeCount temp = heap[pos];
+        heap[pos] = heap[lowest];
+        heap[lowest] = temp;
+        pos = lowest;
+    }
+}
+
+// Finds the topCount most frequent of the given distinct DateTimes, selected by keys with their
+// occurrences in counts, and places them in outTop from most to least frequent; ties are broken
+// by the earlier date. outTop must hold topCount entries. Uses a heap of topCount entries, so
+// the whole set is never sorted. Returns the number of entries placed.
+size_t TopDateTimeCounts(const DateTime* dateTimes, const size_t* keys, const size_t* counts, size_t count, size_t topCount, DateTimeCount* outTop)
+{
+    size_t heapCount = 0;
+    for (size_t i = 0; i < count && topCount > 0; i++) {
+        DateTimeCount entry = { keys[i], counts[i] };
+
+        if (heapCount < topCount) {
+            // Sift the new entry up from the bottom
+            size_t pos = heapCount++;
+            while (pos > 0 && DateTimeCountRanksBelow(dateTimes, &entry, &outTop[(pos - 1) / 2])) {
+                outTop[pos] = outTop[(pos - 1) / 2];
+                pos = (pos - 1) / 2;
+            }
+            outTop[pos] = entry;
+        }
+        else if (DateTimeCountRanksBelow(dateTimes, &outTop[0], &entry)) {
+            outTop[0] = entry;
+            DateTimeCountHeapSiftDown(dateTimes, outTop, heapCount, 0);
+        }
+    }
+
+    // Repeatedly moving the lowest ranked entry to the end leaves the highest ranked first
+    for (size_t end = heapCount; end > 1; end--) {
+        DateTimeCount temp = outTop[0];
+        outTop[0] = outTop[end - 1];
+        outTop[end - 1] = temp;
+        DateTimeCountHeapSiftDown(dateTimes, outTop, end - 1, 0);
+    }
+
+    return heapCount;
+}
+
+// Prints each of the given distinct DateTimes, selected by keys, with its number of occurrences
+// from counts to the given file stream as a line of the date, a tab and the count. If topCount
+// isn't 0, only the topCount most frequent are printed, most frequent first; otherwise all are
+// printed in the order of keys. Returns true if successful.
+bool WriteDateTimeCounts(FILE* stream, const DateTime* dateTimes, const size_t* keys, const size_t* counts, size_t count, size_t topCount)
+{
+    DateTimeWriter writer;
+    if (!DateTimeWriterInit(&writer, stream)) {
+        return false;
+    }
+
+    if (topCount == 0) {
+        for (size_t i = 0; i < count; i++) {
+            DateTimeWriterPutCount(&writer, &dateTimes[keys[i]], counts[i]);
+        }
+        return DateTimeWriterFree(&writer);
+    }
+
+    DateTimeCount* top = malloc(topCount * sizeof(DateTimeCount));
+    if (top == NULL) {
+        DateTimeWriterFree(&writer);
+        return false;
+    }
+
+    size_t found = TopDateTimeCounts(dateTimes, keys, counts, count, topCount, top);
+    for (size_t i = 0; i < found; i++) {
+        DateTimeWriterPutCount(&writer, &dateTimes[top[i].key], top[i].count);
+    }
+
+    free(top);
+    return DateTimeWriterFree(&writer);
+}
+
+bool TestWriteDateTimeCounts()
+{
+    const size_t numDates = 5;
+    DateTime dates[numDates];
+    PopulateDateTimeFromIsoString("2001-01-01T00:00:00Z", &dates[0]);
+    PopulateDateTimeFromIsoString("2002-01-01T00:00:00Z", &dates[1]);
+    PopulateDateTimeFromIsoString("2003-01-01T00:00:00Z", &dates[2]);
+    PopulateDateTimeFromIsoString("2004-01-01T00:00:00Z", &dates[3]);
+    PopulateDateTimeFromIsoString("2005-01-01T00:00:00Z", &dates[4]);
+
+    const size_t keys[] = { 0, 1, 2, 3, 4 };
+    const size_t counts[] = { 7, 12345678901, 7, 1, 12 };
+
+    // The two dates seen 7 times tie; the earlier ranks higher
+    const char* expected[] = {
+        "2002-01-01T00:00:00Z\t12345678901\n"
+        "2005-01-01T00:00:00Z\t12\n"
+        "2001-01-01T00:00:00Z\t7\n",
+        "2001-01-01T00:00:00Z\t7\n"
+        "2002-01-01T00:00:00Z\t12345678901\n"
+        "2003-01-01T00:00:00Z\t7\n"
+        "2004-01-01T00:00:00Z\t1\n"
+        "2005-01-01T00:00:00Z\t12\n",
+    };
+    const size_t topCounts[] = { 3, 0 };
+
+    bool success = true;
+    for (size_t t = 0; success && t < 2; t++) {
+        FILE* file = tmpfile();
+        char output[256] = { 0 };
+
+        success = file && WriteDateTimeCounts(file, dates, keys, counts, numDates, topCounts[t])
+            && pread(fileno(file), output, sizeof(output) - 1, 0) >= 0
+            && strcmp(output, expected[t]) == 0;
+
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    return success;
+}
+
+// At day or month granularity there are only BITMAP_YEAR_COUNT * BITMAP_DAYS_PER_YEAR possible
+// DateTimes, so a dense bitmap of 3.72M bits (465 KiB) holds any set of them, and scanning it
+// yields the distinct days in ascending order without sorting.
+#define DAY_INDEX_COUNT (BITMAP_YEAR_COUNT * BITMAP_DAYS_PER_YEAR)
+#define DAY_INDEX_WORDS ((DAY_INDEX_COUNT + 63) / 64)
+
+// Prints the distinct days of the given list of DateTimes, which must be truncated to day or
+// month granularity, to the given file stream in ascending order, and sets outDistinctCount to
+// how many there were. Returns true if successful.
+bool WriteDistinctDays(FILE* stream, const DateTime* dateTimes, size_t count, size_t* outDistinctCount)
+{
+    uint64_t* days = calloc(DAY_INDEX_WORDS, sizeof(uint64_t));  // calloc should initialize memory to 0
+    DateTimeWriter writer;
+    if (days == NULL || !DateTimeWriterInit(&writer, stream)) {
+        free(days);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const DateTime* dateTime = &dateTimes[i];
+        size_t index = (size_t)dateTime->year * BITMAP_DAYS_PER_YEAR + (dateTime->month - 1) * 31 + (dateTime->day - 1);
+        days[index / 64] |= (uint64_t)1 << (index % 64);
+    }
+
+    size_t distinctCount = 0;
+    DateTime day = { 0 };
+    for (size_t word = 0; word < DAY_INDEX_WORDS; word++) {
+        uint64_t bits = days[word];
+        while (bits) {
+            size_t index = word * 64 + (size_t)__builtin_ctzll(bits);
+            bits &= bits - 1;  // Clear lowest set bit
+
+            day.year = (unsigned int)(index / BITMAP_DAYS_PER_YEAR);
+            day.month = (unsigned int)((index % BITMAP_DAYS_PER_YEAR) / 31) + 1;
+            day.day = (unsigned int)(index % 31) + 1;
+            DateTimeWriterPut(&writer, &day);
+            distinctCount++;
+        }
+    }
+
+    free(days);
+    *outDistinctCount = distinctCount;
+    return DateTimeWriterFree(&writer);
+}
+
+bool TestWriteDistinctDays()
+{
+    const size_t numDates = 5;
+    DateTime dates[numDates];
+    PopulateDateTimeFromIsoString("2085-09-28T20:33:29Z", &dates[0]);
+    PopulateDateTimeFromIsoString("2085-09-27T23:59:59Z", &dates[1]);
+    PopulateDateTimeFromIsoString("0000-01-01T00:00:00Z", &dates[2]);
+    PopulateDateTimeFromIsoString("9999-12-31T23:59:59Z", &dates[3]);
+    PopulateDateTimeFromIsoString("2085-09-28T00:00:00Z", &dates[4]);
+
+    const char* expected[] = {
+        "0000-01-01T00:00:00Z\n2085-09-27T00:00:00Z\n2085-09-28T00:00:00Z\n9999-12-31T00:00:00Z\n",
+        "0000-01-01T00:00:00Z\n2085-09-01T00:00:00Z\n9999-12-01T00:00:00Z\n",
+    };
+    const Granularity granularities[] = { GRANULARITY_DAY, GRANULARITY_MONTH };
+    const size_t expectedCounts[] = { 4, 3 };
+
+    bool success = true;
+    for (size_t g = 0; success && g < 2; g++) {
+        TruncateDateTimes(dates, numDates, granularities[g]);
+
+        FILE* file = tmpfile();
+        char output[256] = { 0 };
+        size_t distinctCount = 0;
+
+        success = file && WriteDistinctDays(file, dates, numDates, &distinctCount)
+            && distinctCount == expectedCounts[g]
+            && pread(fileno(file), output, sizeof(output) - 1, 0) >= 0
+            && strcmp(output, expected[g]) == 0;
+
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    // Truncating packed keys matches truncating the DateTimes
+    DateTime date;
+    DateTime truncated;
+    PopulateDateTimeFromIsoString("2085-09-28T20:33:29Z", &date);
+    for (size_t g = 0; success && g < GRANULARITY_COUNT; g++) {
+        truncated = date;
+        TruncateDateTime(&truncated, (Granularity)g);
+        success = TruncatePackedKey(PackDateTime(&date), (Granularity)g) == PackDateTime(&truncated);
+    }
+
+    return success;
+}
+
+bool TestFormatDateTime()
+{
+    const char* isoStrings[] = {
+        "0000-01-01T00:00:00Z",
+        "0001-02-03T04:05:06Z",
+        "2085-09-28T20:33:29Z",
+        "9999-12-31T23:59:59Z",
+    };
+    const size_t numDates = sizeof(isoStrings) / sizeof(isoStrings[0]);
+
+    DateTime dates[numDates];
+    size_t keys[numDates];
+    char expected[ISO_LINE_LEN + 1];
+    char formatted[ISO_LINE_LEN + 1] = { '\0' };
+
+    for (size_t i = 0; i < numDates; i++) {
+        PopulateDateTimeFromIsoString(isoStrings[i], &dates[i]);
+        keys[i] = numDates - 1 - i;
+
+        snprintf(expected, sizeof(expected), "%s\n", isoStrings[i]);
+        FormatDateTime(formatted, &dates[i]);
+        printf("%s", formatted);
+
+        if (memcmp(formatted, expected, ISO_LINE_LEN) != 0) {
+            return false;
+        }
+    }
+
+    // Both the buffered and the mapped writers should match FPrintDateTime
+    FILE* expectedOutput = tmpfile();
+    FILE* bufferedOutput = tmpfile();
+    FILE* mappedOutput = tmpfile();
+    bool success = expectedOutput && bufferedOutput && mappedOutput;
+    bool untouched = true;
+
+    for (size_t i = 0; success && i < numDates; i++) {
+        FPrintDateTime(expectedOutput, &dates[keys[i]]);
+    }
+
+    success = success
+        && WriteDateTimes(bufferedOutput, dates, keys, numDates, 1)
+        && WriteDateTimesMapped(mappedOutput, dates, keys, numDates, 3, &untouched);
+
+    char expectedText[ISO_LINE_LEN * numDates];
+    char bufferedText[ISO_LINE_LEN * numDates];
+    char mappedText[ISO_LINE_LEN * numDates];
+
+    if (success) {
+        rewind(expectedOutput);
+        rewind(bufferedOutput);
+        rewind(mappedOutput);
+
+        success = fread(expectedText, 1, sizeof(expectedText), expectedOutput) == sizeof(expectedText)
+            && fread(bufferedText, 1, sizeof(bufferedText), bufferedOutput) == sizeof(bufferedText)
+            && fread(mappedText, 1, sizeof(mappedText), mappedOutput) == sizeof(mappedText)
+            && fgetc(mappedOutput) == EOF
+            && memcmp(expectedText, bufferedText, sizeof(expectedText)) == 0
+            && memcmp(expectedText, mappedText, sizeof(expectedText)) == 0;
+    }
+
+    if (expectedOutput) {
+        fclose(expectedOutput);
+    }
+    if (bufferedOutput) {
+        fclose(bufferedOutput);
+    }
+    if (mappedOutput) {
+        fclose(mappedOutput);
+    }
+
+    return success;
+}
+
+// External-memory distinct: when the DateTimes don't fit in memory, the input is read in runs
+// that fit within a memory budget. Each run is sorted, deduplicated and spilled to a temporary
+// file as packed 64-bit keys, and a final k-way merge of the runs removes duplicates across
+// runs while streaming to the output.
+#define EXTERNAL_RUN_BYTES_PER_DATE (sizeof(uint64_t) + 2 * sizeof(size_t))  // Packed key plus sort keys
+#define EXTERNAL_MERGE_BUFFER_KEYS 8192
+#define KEY_RUN_EXHAUSTED UINT64_MAX    // Sorts after every packed key
+
+// A run of packed keys in ascending order, read back in blocks: either a run of distinct keys
+// spilled to a temporary file, or the lines of an input that is already sorted, parsed as the
+// merge reaches them
+typedef struct keyRun {
+    FILE* stream;           // Temporary file of the run, or NULL for sorted text
+    const char* text;       // Lines of the sorted text not yet parsed
+    const char* textEnd;
+    Granularity granularity;// Of the keys parsed from text
+    LineCounter counter;    // Lines parsed from text
+    uint64_t* buffer;       // EXTERNAL_MERGE_BUFFER_KEYS keys
+    size_t bufferCount;     // Number of keys in buffer
+    size_t bufferPos;       // Position of the next key to read from buffer
+    uint64_t current;       // Key at the head of the run, or KEY_RUN_EXHAUSTED
+    bool readFailed;        // Whether reading stream failed before its end
+} KeyRun;
+
+// Parses the given run's text into its buffer until the buffer is full or the text ends.
+// Returns the number of keys parsed.
+size_t KeyRunParseText(KeyRun* run)
+{
+    size_t count = 0;
+    DateTime dateTime;
+
+    while (count < EXTERNAL_MERGE_BUFFER_KEYS && run->text < run->textEnd) {
+        const char* newline = memchr(run->text, '\n', (size_t)(run->textEnd - run->text));
+        const char* lineEnd = newline ? newline : run->textEnd;
+
+        if (ParseCountedLine(run->text, (size_t)(lineEnd - run->text), &dateTime, &run->counter)) {
+            run->buffer[count++] = TruncatePackedKey(PackDateTime(&dateTime), run->granularity);
+        }
+        run->text = lineEnd + 1;
+    }
+
+    return count;
+}
+
+// Reads the next key of the given run into current. Returns false when the run is exhausted,
+// or when reading it failed, which also sets readFailed.
+bool KeyRunAdvance(KeyRun* run)
+{
+    if (run->bufferPos == run->bufferCount) {
+        run->bufferCount = run->stream ? fread(run->buffer, sizeof(uint64_t), EXTERNAL_MERGE_BUFFER_KEYS, run->stream) : KeyRunParseText(run);
+        run->bufferPos = 0;
+
+        if (run->bufferCount == 0) {
+            run->readFailed = run->stream != NULL && ferror(run->stream);
+            run->current = KEY_RUN_EXHAUSTED;
+            return false;
+        }
+    }
+
+    run->current = run->buffer[run->bufferPos++];
+    return true;
+}
+
+// A loser tree picks the run with the smallest current key with one comparison per level of
+// a binary tree over the runs. Run i is leaf runCount + i and node p has children 2p and
+// 2p + 1. Each internal node holds the run that lost the match played there, and node 0 holds
+// the overall winner, so after the winner advances only the matches on its path to the root
+// are replayed, against the losers already in place. A heap would compare both children at
+// every level instead.
+
+// Plays the matches of the subtree at the given node, recording the loser of each, and
+// returns the subtree's winner
+size_t LoserTreeBuild(const KeyRun* runs, size_t runCount, size_t* nodes, size_t node)
+{
+    if (node >= runCount) {
+        return node - runCount;
+    }
+
+    const size_t left = LoserTreeBuild(runs, runCount, nodes, node * 2);
+    const size_t right = LoserTreeBuild(runs, runCount, nodes, node * 2 + 1);
+    const bool leftWins = runs[left].current <= runs[right].current;
+
+    nodes[node] = leftWins ? right : left;
+    return leftWins ? left : right;
+}
+
+// Replays the matches of the winner in nodes[0], whose current key has changed, from its
+// leaf to the root
+void LoserTreeReplay(const KeyRun* runs, size_t runCount, size_t* nodes)
+{
+    size_t winner = nodes[0];
+    for (size_t node = (winner + runCount) / 2; node > 0; node /= 2) {
+        if (runs[nodes[node]].current < runs[winner].current) {
+            const size_t loser = winner;
+            winner = nodes[node];
+            nodes[node] = loser;
+        }
+    }
+
+    nodes[0] = winner;
+}
+
+// Merges the given runs of sorted packed keys, printing each key that is distinct across all
+// runs to the given file stream in ascending order. Returns true if successful.
+bool MergeKeyRuns(KeyRun* runs, size_t runCount, FILE* stream)
+{
+    DateTimeWriter writer;
+    size_t* nodes = calloc(runCount + 1, sizeof(size_t));
+    if (nodes == NULL || !DateTimeWriterInit(&writer, stream)) {
+        free(nodes);
+        return false;
+    }
+
+    for (size_t i = 0; i < runCount; i++) {
+        if (runs[i].stream) {
+            rewind(runs[i].stream);
+        }
+        KeyRunAdvance(&runs[i]);
+    }
+
+    if (runCount > 0) {
+        nodes[0] = LoserTreeBuild(runs, runCount, nodes, 1);
+    }
+
+    bool anyWritten = false;
+    uint64_t lastKey = 0;
+    uint64_t duplicates = 0;
+    DateTime dateTime;
+
+    while (runCount > 0 && runs[nodes[0]].current != KEY_RUN_EXHAUSTED) {
+        KeyRun* run = &runs[nodes[0]];
+
+        // Spilled runs are already distinct, but sorted text and different runs can repeat keys
+        if (!anyWritten || run->current != lastKey) {
+            UnpackDateTime(run->current, &dateTime);
+            DateTimeWriterPut(&writer, &dateTime);
+            lastKey = run->current;
+            anyWritten = true;
+        }
+        else {
+            duplicates++;
+        }
+
+        KeyRunAdvance(run);
+        LoserTreeReplay(runs, runCount, nodes);
+    }
+
+    StatsAdd(&ThreadPipelineStats()->duplicatesRemoved, duplicates);
+    free(nodes);
+
+    bool success = DateTimeWriterFree(&writer);
+    for (size_t i = 0; i < runCount; i++) {
+        success = success && !runs[i].readFailed;
+    }
+
+    return success;
+}
+
+// Reads up to maxCount valid DateTimes from the given stream of ISO 8601 date strings, one per
+// line, as packed keys. Returns the number of keys read.
+size_t IngestPackedKeys(uint64_t* packedKeys, size_t maxCount, FILE* stream, char** lineBuff, size_t* lineBuffSize)
+{
+    size_t count = 0;
+    DateTime dateTime;
+    LineCounter counter = { 0 };
+
+    while (count < maxCount) {
+        ssize_t chars = getline(lineBuff, lineBuffSize, stream);
+        if (chars < 0) {
+            break;
+        }
+
+        if (ParseCountedLine(*lineBuff, strlen(*lineBuff), &dateTime, &counter)) {
+            packedKeys[count++] = PackDateTime(&dateTime);
+        }
+    }
+
+    FlushLineCounter(&counter);
+    return count;
+}
+
+// Gathers the packed keys of unsorted text, from any number of streams, into sorted runs of
+// distinct keys spilled to temporary files, each run holding as many keys as fit within a
+// memory budget
+typedef struct keyRunBuilder {
+    size_t capacity;        // Keys per run
+    Granularity granularity;
+    uint64_t* packedKeys;   // capacity keys, allocated when first needed
+    size_t* sortedKeys;     // capacity sort keys
+    size_t count;           // Keys waiting to be spilled
+    char* lineBuff;
+    size_t lineBuffSize;
+    KeyRun* runs;           // Spilled runs, and any others added with KeyRunBuilderAddRun
+    size_t runCount;
+} KeyRunBuilder;
+
+void KeyRunBuilderInit(KeyRunBuilder* builder, size_t memoryBudget, Granularity granularity)
+{
+    memset(builder, 0, sizeof(KeyRunBuilder));
+    builder->capacity = memoryBudget / EXTERNAL_RUN_BYTES_PER_DATE;
+    if (builder->capacity == 0) {
+        builder->capacity = 1;
+    }
+    builder->granularity = granularity;
+}
+
+// Adds an empty run to the given builder. Returns the run, or NULL if it couldn't be added.
+KeyRun* KeyRunBuilderAddRun(KeyRunBuilder* builder)
+{
+    KeyRun* grownRuns = realloc(builder->runs, (builder->runCount + 1) * sizeof(KeyRun));
+    if (grownRuns == NULL) {
+        return NULL;
+    }
+    builder->runs = grownRuns;
+
+    KeyRun* run = &builder->runs[builder->runCount++];
+    memset(run, 0, sizeof(KeyRun));
+    return run;
+}
+
+// Sorts the keys waiting in the given builder and spills the distinct ones as a run.
+// Returns true if successful.
+bool KeyRunBuilderSpill(KeyRunBuilder* builder)
+{
+    if (builder->count == 0) {
+        return true;
+    }
+
+    const size_t count = builder->count;
+    builder->count = 0;
+    if (!RadixSortPackedKeys(builder->packedKeys, count, builder->sortedKeys)) {
+        return false;
+    }
+
+    KeyRun* run = KeyRunBuilderAddRun(builder);
+    if (run == NULL) {
+        return false;
+    }
+    run->stream = tmpfile();
+    if (run->stream == NULL) {
+        builder->runCount--;
+        return false;
+    }
+
+    // Equal keys are now contiguous; only the first of each is written
+    bool success = true;
+    uint64_t duplicates = 0;
+    for (size_t i = 0; success && i < count; i++) {
+        uint64_t key = builder->packedKeys[builder->sortedKeys[i]];
+        if (i == 0 || builder->packedKeys[builder->sortedKeys[i - 1]] != key) {
+            success = fwrite(&key, sizeof(uint64_t), 1, run->stream) == 1;
+        }
+        else {
+            duplicates++;
+        }
+    }
+    StatsAdd(&ThreadPipelineStats()->duplicatesRemoved, duplicates);
+
+    // Write errors of buffered data only show once it is flushed
+    return success && fflush(run->stream) == 0 && !ferror(run->stream);
+}
+
+// Reads the given stream of ISO 8601 date strings, one per line, to its end into the given
+// builder, spilling a run whenever the builder is full. Returns true if successful.
+bool KeyRunBuilderAddStream(KeyRunBuilder* builder, FILE* stream)
+{
+    if (builder->packedKeys == NULL) {
+        builder->packedKeys = malloc(builder->capacity * sizeof(uint64_t));
+        builder->sortedKeys = malloc(builder->capacity * sizeof(size_t));
+        if (builder->packedKeys == NULL || builder->sortedKeys == NULL) {
+            return false;
+        }
+    }
+
+    while (true) {
+        const size_t space = builder->capacity - builder->count;
+        const size_t count = IngestPackedKeys(&builder->packedKeys[builder->count], space, stream, &builder->lineBuff, &builder->lineBuffSize);
+        if (builder->granularity != GRANULARITY_SECOND) {
+            for (size_t i = builder->count; i < builder->count + count; i++) {
+                builder->packedKeys[i] = TruncatePackedKey(builder->packedKeys[i], builder->granularity);
+            }
+        }
+        builder->count += count;
+
+        // A stream that ends before the builder fills leaves its keys to share a run with the next
+        if (count < space) {
+            return true;
+        }
+        if (!KeyRunBuilderSpill(builder)) {
+            return false;
+        }
+    }
+}
+
+// Spills any keys still waiting in the given builder and releases the memory used to build
+// runs, then merges its runs to the given file stream. Returns true if successful.
+bool KeyRunBuilderMerge(KeyRunBuilder* builder, FILE* stream)
+{
+    bool success = KeyRunBuilderSpill(builder);
+
+    free(builder->lineBuff);
+    free(builder->sortedKeys);
+    free(builder->packedKeys);
+    builder->lineBuff = NULL;
+    builder->sortedKeys = NULL;
+    builder->packedKeys = NULL;
+
+    for (size_t i = 0; success && i < builder->runCount; i++) {
+        builder->runs[i].buffer = malloc(EXTERNAL_MERGE_BUFFER_KEYS * sizeof(uint64_t));
+        success = builder->runs[i].buffer != NULL;
+    }
+
+    return success && MergeKeyRuns(builder->runs, builder->runCount, stream);
+}
+
+// Frees the given builder and its runs
+void KeyRunBuilderFree(KeyRunBuilder* builder)
+{
+    for (size_t i = 0; i < builder->runCount; i++) {
+        free(builder->runs[i].buffer);
+        if (builder->runs[i].stream) {
+            fclose(builder->runs[i].stream);  // Temporary files are removed once closed
+        }
+        FlushLineCounter(&builder->runs[i].counter);
+    }
+    free(builder->runs);
+    free(builder->lineBuff);
+    free(builder->sortedKeys);
+    free(builder->packedKeys);
+    memset(builder, 0, sizeof(KeyRunBuilder));
+}
+
+// Finds the distinct DateTimes in the given input stream of ISO 8601 date strings, one per line,
+// and prints them to the given output stream in ascending order, the same as DistinctDateTimes,
+// while holding at most memoryBudget bytes of DateTimes in memory at once.
+bool WriteDistinctDateTimesExternal(FILE* inStream, FILE* outStream, size_t memoryBudget)
+{
+    if (!inStream || !outStream) {
+        return false;
+    }
+
+    KeyRunBuilder builder;
+    KeyRunBuilderInit(&builder, memoryBudget, GRANULARITY_SECOND);
+
+    bool success = KeyRunBuilderAddStream(&builder, inStream) && KeyRunBuilderMerge(&builder, outStream);
+
+    KeyRunBuilderFree(&builder);
+    return success;
+}
+
+bool TestWriteDistinctDateTimesExternal()
+{
+    FILE* input = tmpfile();
+    FILE* expectedOutput = tmpfile();
+    FILE* output = tmpfile();
+    if (input == NULL || expectedOutput == NULL || output == NULL) {
+        return false;
+    }
+
+    // Duplicates spread across the whole input, so that they land in different runs
+    for (size_t i = 0; i < 1000; i++) {
+        fprintf(input, "%04zu-%02zu-28T20:33:%02zuZ\n", 2000 + i % 3, i % 12 + 1, i % 37);
+        if (i % 50 == 0) {
+            fprintf(input, "Not a date\n");
+        }
+    }
+    rewind(input);
+
+    DateTime* datesBuffer = NULL;
+    size_t datesBufferSize = 0;
+    size_t count = IngestDateTimes(&datesBuffer, &datesBufferSize, input);
+
+    size_t* distinctKeys = malloc(count * sizeof(size_t));
+    size_t numDistinctKeys = 0;
+    bool success = distinctKeys && DistinctDateTimes(datesBuffer, count, distinctKeys, &numDistinctKeys);
+    for (size_t i = 0; success && i < numDistinctKeys; i++) {
+        FPrintDateTime(expectedOutput, &datesBuffer[distinctKeys[i]]);
+    }
+    free(distinctKeys);
+    free(datesBuffer);
+
+    // A budget of 100 DateTimes per run forces several runs
+    rewind(input);
+    success = success && WriteDistinctDateTimesExternal(input, output, 100 * EXTERNAL_RUN_BYTES_PER_DATE);
+    printf("%zu distinct dates\n", numDistinctKeys);
+
+    rewind(expectedOutput);
+    rewind(output);
+    int expectedChar;
+    int outputChar;
+    do {
+        expectedChar = fgetc(expectedOutput);
+        outputChar = fgetc(output);
+        success = success && expectedChar == outputChar;
+    } while (success && expectedChar != EOF);
+
+    fclose(output);
+    fclose(expectedOutput);
+    fclose(input);
+
+    return success;
+}
+
+// Merge distinct finds the distinct union of many input files, many of which are often sorted
+// already, such as earlier output. Each input is checked for being sorted first. Sorted inputs
+// are merged straight from their mapped text, parsed as the merge reaches each line, so they
+// are never held in memory. Unsorted inputs are gathered into sorted runs within a memory
+// budget, as by the external engine, and the loser tree of MergeKeyRuns merges both kinds
+// while streaming the output.
+
+// Returns true if the valid DateTimes on the lines in [begin, end) are in ascending order at
+// the given granularity, stopping at the first that isn't. Lines aren't counted, as they are
+// parsed again to be merged or sorted.
+bool DateTimeTextIsSorted(const char* begin, const char* end, Granularity granularity)
+{
+    uint64_t lastKey = 0;
+    DateTime dateTime;
+
+    for (const char* line = begin; line < end; ) {
+        const char* newline = memchr(line, '\n', (size_t)(end - line));
+        const char* lineEnd = newline ? newline : end;
+
+        if (PopulateDateTimeFromIsoCharsFast(line, (size_t)(lineEnd - line), &dateTime)) {
+            const uint64_t key = TruncatePackedKey(PackDateTime(&dateTime), granularity);
+            if (key < lastKey) {
+                return false;
+            }
+            lastKey = key;
+        }
+        line = lineEnd + 1;
+    }
+
+    return true;
+}
+
+// Finds the distinct DateTimes, at the given granularity, of the given files of ISO 8601 date
+// strings, one per line, and prints them to the given output stream in ascending order. A path
+// of "-" reads standard input. Files that are already sorted are merged in place; the others
+// are sorted holding at most memoryBudget bytes of DateTimes in memory at once. Returns true
+// if successful.
+bool WriteDistinctDateTimesMerged(const char* const* paths, size_t pathCount, Granularity granularity, size_t memoryBudget, FILE* outStream)
+{
+    if ((!paths && pathCount > 0) || !outStream) {
+        return false;
+    }
+
+    KeyRunBuilder builder;
+    KeyRunBuilderInit(&builder, memoryBudget, granularity);
+
+    // Sorted inputs stay mapped until the merge is done
+    const char** mappings = calloc(pathCount + 1, sizeof(const char*));
+    size_t* mappingSizes = calloc(pathCount + 1, sizeof(size_t));
+    bool success = mappings != NULL && mappingSizes != NULL;
+
+    for (size_t i = 0; success && i < pathCount; i++) {
+        const bool isStdin = strcmp(paths[i], "-") == 0;
+        FILE* stream = isStdin ? stdin : fopen(paths[i], "r");
+        if (stream == NULL) {
+            success = false;
+            break;
+        }
+
+        // Inputs that can't be mapped, such as pipes, are sorted
+        size_t mappingSize = 0;
+        const char* mapping = MapInputFile(stream, &mappingSize);
+        if (mapping && DateTimeTextIsSorted(mapping, mapping + mappingSize, granularity)) {
+            KeyRun* run = KeyRunBuilderAddRun(&builder);
+            success = run != NULL;
+            if (success) {
+                run->text = mapping;
+                run->textEnd = mapping + mappingSize;
+                run->granularity = granularity;
+                mappings[i] = mapping;
+                mappingSizes[i] = mappingSize;
+            }
+            else {
+                munmap((void*)mapping, mappingSize);
+            }
+        }
+        else {
+            if (mapping) {
+                munmap((void*)mapping, mappingSize);
+            }
+            success = KeyRunBuilderAddStream(&builder, stream);
+        }
+
+        if (!isStdin) {
+            fclose(stream);
+        }
+    }
+
+    success = success && KeyRunBuilderMerge(&builder, outStream);
+    KeyRunBuilderFree(&builder);
+
+    for (size_t i = 0; mappings && i < pathCount; i++) {
+        if (mappings[i]) {
+            munmap((void*)mappings[i], mappingSizes[i]);
+        }
+    }
+    free(mappings);
+    free(mappingSizes);
+
+    return success;
+}
+
+bool TestWriteDistinctDateTimesMerged()
+{
+    // Order is by instant, so a sorted file may have offsets that sort differently as text
+    const char sortedText[] = "1999-12-31T23:00:00-02:00\n2000-01-01T00:30:00Z\n2000-01-01T00:30:00Z\n";
+    const char unsortedText[] = "2000-01-01T00:30:00Z\n1999-12-31T23:00:00-02:00\n";
+    const char sameHourText[] = "2000-01-01T00:30:00Z\n2000-01-01T00:10:00Z\n";
+    bool success = DateTimeTextIsSorted(sortedText, sortedText + sizeof(sortedText) - 1, GRANULARITY_SECOND)
+        && !DateTimeTextIsSorted(unsortedText, unsortedText + sizeof(unsortedText) - 1, GRANULARITY_SECOND)
+        && !DateTimeTextIsSorted(sameHourText, sameHourText + sizeof(sameHourText) - 1, GRANULARITY_SECOND)
+        && DateTimeTextIsSorted(sameHourText, sameHourText + sizeof(sameHourText) - 1, GRANULARITY_HOUR);
+
+    char directory[] = "/tmp/distinct-dates-test-XXXXXX";
+    if (!success || mkdtemp(directory) == NULL) {
+        return false;
+    }
+
+    // Sorted files, with duplicates within and across them, unsorted files, an empty file and
+    // files without a final newline
+    enum { fileCount = 12 };
+    char paths[fileCount][sizeof(directory) + 16];
+    const char* pathList[fileCount];
+
+    for (unsigned int f = 0; success && f < fileCount; f++) {
+        snprintf(paths[f], sizeof(paths[f]), "%s/%02u.txt", directory, f);
+        pathList[f] = paths[f];
+
+        FILE* file = fopen(paths[f], "w");
+        if (file == NULL) {
+            success = false;
+            break;
+        }
+
+        const bool sorted = f % 3 != 0;
+        const unsigned int lines = (f == 4) ? 0 : 500 + f * 50;
+        for (unsigned int i = 0; i < lines; i++) {
+            if (i % 17 == 0) {
+                fprintf(file, "Not a date %u\n", i);
+            }
+
+            const unsigned int value = sorted ? (i / 2) * (f + 1) : (i * 7919) % lines;
+            fprintf(file, "%04u-%02u-%02uT%02u:%02u:%02uZ\n", 2000 + value / 3000, value / 250 % 12 + 1, value / 10 % 25 + 1,
+                value % 10 * 2, value % 10 * 5, value % 10 * 3);
+        }
+        if (f % 5 == 1) {
+            fputs("2099-12-31T23:59:59Z", file);
+        }
+
+        success = fclose(file) == 0;
+
+        // Both kinds of input are merged
+        file = success ? fopen(paths[f], "r") : NULL;
+        size_t mappingSize = 0;
+        const char* mapping = file ? MapInputFile(file, &mappingSize) : NULL;
+        success = (mapping == NULL) ? lines == 0 : DateTimeTextIsSorted(mapping, mapping + mappingSize, GRANULARITY_SECOND) == sorted;
+        if (mapping) {
+            munmap((void*)mapping, mappingSize);
+        }
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    // Parsing every file and finding the distinct DateTimes as a whole
+    DateTime* dates = NULL;
+    size_t numDates = 0;
+    for (unsigned int f = 0; success && f < fileCount; f++) {
+        FILE* file = fopen(paths[f], "r");
+        success = file != NULL;
+        if (success) {
+            DateTime* fileDates = NULL;
+            size_t fileDatesSize = 0;
+            size_t numFileDates = 0;
+            success = IngestDateTimesMapped(&fileDates, &fileDatesSize, file, &numFileDates);
+            dates = realloc(dates, (numDates + numFileDates + 1) * sizeof(DateTime));
+            memcpy(&dates[numDates], fileDates, numFileDates * sizeof(DateTime));
+            numDates += numFileDates;
+            free(fileDates);
+            fclose(file);
+        }
+    }
+    success = success && numDates > 0;
+
+    const Granularity granularities[] = { GRANULARITY_SECOND, GRANULARITY_DAY };
+    for (size_t g = 0; success && g < sizeof(granularities) / sizeof(granularities[0]); g++) {
+        DateTime* truncated = malloc(numDates * sizeof(DateTime));
+        size_t* distinctKeys = malloc(numDates * sizeof(size_t));
+        size_t numDistinctKeys = 0;
+        FILE* expectedOutput = tmpfile();
+        FILE* output = tmpfile();
+        success = truncated && distinctKeys && expectedOutput && output;
+
+        if (success) {
+            memcpy(truncated, dates, numDates * sizeof(DateTime));
+            TruncateDateTimes(truncated, numDates, granularities[g]);
+            success = DistinctDateTimes(truncated, numDates, distinctKeys, &numDistinctKeys);
+        }
+        for (size_t i = 0; success && i < numDistinctKeys; i++) {
+            FPrintDateTime(expectedOutput, &truncated[distinctKeys[i]]);
+        }
+
+        // A budget of 100 DateTimes per run spills the unsorted files in several runs
+        success = success && WriteDistinctDateTimesMerged(pathList, fileCount, granularities[g], 100 * EXTERNAL_RUN_BYTES_PER_DATE, output);
+        printf("%s: %zu distinct dates\n", GranularityNames[granularities[g]], numDistinctKeys);
+
+        if (success) {
+            rewind(expectedOutput);
+            rewind(output);
+        }
+        int expectedChar;
+        int outputChar;
+        do {
+            expectedChar = success ? fgetc(expectedOutput) : EOF;
+            outputChar = success ? fgetc(output) : EOF;
+            success = success && expectedChar == outputChar;
+        } while (success && expectedChar != EOF);
+
+        free(truncated);
+        free(distinctKeys);
+        if (expectedOutput) {
+            fclose(expectedOutput);
+        }
+        if (output) {
+            fclose(output);
+        }
+    }
+
+    // A missing file fails the merge
+    FILE* output = tmpfile();
+    const char* missing[] = { paths[1], "/nonexistent/dates.txt" };
+    success = success && output && !WriteDistinctDateTimesMerged(missing, 2, GRANULARITY_SECOND, 1024, output);
+    if (output) {
+        fclose(output);
+    }
+
+    free(dates);
+    for (unsigned int f = 0; f < fileCount; f++) {
+        unlink(paths[f]);
+    }
+    rmdir(directory);
+
+    return success;
+}
+
+// A date cache holds the DateTimes ingested from a text file as packed keys, so that later runs
+// over the same input can map it instead of parsing it again. The file is a DateCacheHeader
+// followed by count keys from PackDateTime, all in native byte order.
+#define DATE_CACHE_MAGIC "DDCACHE"  // Eight bytes with the null terminator
+#define DATE_CACHE_VERSION 1
+
+typedef enum dateCacheFlags {
+    DATE_CACHE_SORTED = 1 << 0,     // Keys are in ascending order
+    DATE_CACHE_DISTINCT = 1 << 1,   // No key appears twice
+} DateCacheFlags;
+
+typedef struct dateCacheHeader {
+    char magic[8];          // DATE_CACHE_MAGIC
+    uint32_t version;       // DATE_CACHE_VERSION
+    uint32_t flags;         // DateCacheFlags describing the keys
+    uint64_t count;         // Number of keys after the header
+    uint64_t checksum;      // ChecksumPackedKeys of the keys
+} DateCacheHeader;
+
+#define DATE_CACHE_CHECKSUM_SEED 0xcbf29ce484222325ull
+
+// Continues a 64-bit FNV-1a hash from the given hash over the given packed keys, a word at a
+// time. The checksum of a date cache starts from DATE_CACHE_CHECKSUM_SEED.
+uint64_t ChecksumPackedKeys(uint64_t hash, const uint64_t* packedKeys, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        hash ^= packedKeys[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Writes the given list of DateTimes to the given file stream as a date cache.
+// Returns true if successful.
+bool WriteDateCache(FILE* stream, const DateTime* dateTimes, size_t count)
+{
+    if (!stream || (!dateTimes && count > 0)) {
+        return false;
+    }
+
+    uint64_t* packedKeys = malloc((count ? count : 1) * sizeof(uint64_t));
+    if (packedKeys == NULL) {
+        return false;
+    }
+
+    DateCacheHeader header = { DATE_CACHE_MAGIC, DATE_CACHE_VERSION, DATE_CACHE_SORTED | DATE_CACHE_DISTINCT, count, 0 };
+    for (size_t i = 0; i < count; i++) {
+        packedKeys[i] = PackDateTime(&dateTimes[i]);
+
+        if (i > 0 && packedKeys[i] <= packedKeys[i - 1]) {
+            header.flags &= ~DATE_CACHE_DISTINCT;
+            if (packedKeys[i] < packedKeys[i - 1]) {
+                header.flags &= ~DATE_CACHE_SORTED;
+            }
+        }
+    }
+    header.checksum = ChecksumPackedKeys(DATE_CACHE_CHECKSUM_SEED, packedKeys, count);
+
+    bool success = fwrite(&header, sizeof(header), 1, stream) == 1
+        && fwrite(packedKeys, sizeof(uint64_t), count, stream) == count
+        && fflush(stream) == 0;
+
+    free(packedKeys);
+    return success;
+}
+
+// Memory maps the date cache in the given file stream, copying its header to outHeader and
+// its size to outSize. Returns the mapping, whose keys start right after the header, or NULL
+// if the file is not a valid date cache. The caller unmaps it with munmap.
+const char* MapDateCache(FILE* stream, DateCacheHeader* outHeader, size_t* outSize)
+{
+    if (!stream || !outHeader || !outSize) {
+        return NULL;
+    }
+
+    size_t fileSize = 0;
+    const char* mapping = MapInputFile(stream, &fileSize);
+    if (mapping == NULL) {
+        return NULL;
+    }
+
+    bool valid = fileSize >= sizeof(DateCacheHeader);
+    if (valid) {
+        memcpy(outHeader, mapping, sizeof(DateCacheHeader));
+        valid = memcmp(outHeader->magic, DATE_CACHE_MAGIC, sizeof(outHeader->magic)) == 0
+            && outHeader->version == DATE_CACHE_VERSION
+            && outHeader->count == (fileSize - sizeof(DateCacheHeader)) / sizeof(uint64_t)
+            && (fileSize - sizeof(DateCacheHeader)) % sizeof(uint64_t) == 0
+            && outHeader->checksum == ChecksumPackedKeys(DATE_CACHE_CHECKSUM_SEED, (const uint64_t*)(mapping + sizeof(DateCacheHeader)), outHeader->count);
+    }
+
+    if (!valid) {
+        munmap((void*)mapping, fileSize);
+        return NULL;
+    }
+
+    *outSize = fileSize;
+    return mapping;
+}
+
+// Reads DateTimes from the date cache in the given file stream, setting outCount to the number
+// read. Follows the same conventions as IngestDateTimes for dateTimeBuff and n, except that a
+// buffer supplied by the caller is never reallocated. Returns false if the file is missing,
+// truncated or fails its checksum, or holds more DateTimes than the caller's buffer; an empty
+// but valid cache is not an error.
+bool IngestDateTimesCached(DateTime** dateTimeBuff, size_t* n, FILE* stream, size_t* outCount)
+{
+    *outCount = 0;
+    if (!dateTimeBuff || !n || !stream || (*dateTimeBuff == NULL && *n != 0)) {
+        return false;
+    }
+
+    DateCacheHeader header;
+    size_t mappingSize = 0;
+    const char* mapping = MapDateCache(stream, &header, &mappingSize);
+    if (mapping == NULL) {
+        return false;
+    }
+
+    size_t count = (size_t)header.count;
+    if (*dateTimeBuff != NULL && *n < count * sizeof(DateTime)) {
+        munmap((void*)mapping, mappingSize);
+        return false;
+    }
+    if (*n < count * sizeof(DateTime)) {
+        DateTime* grown = realloc(*dateTimeBuff, count * sizeof(DateTime));
+        if (grown == NULL) {
+            munmap((void*)mapping, mappingSize);
+            return false;
+        }
+        *dateTimeBuff = grown;
+        *n = count * sizeof(DateTime);
+    }
+
+    const uint64_t* packedKeys = (const uint64_t*)(mapping + sizeof(DateCacheHeader));
+    for (size_t i = 0; i < count; i++) {
+        UnpackDateTime(packedKeys[i], &(*dateTimeBuff)[i]);
+    }
+
+    munmap((void*)mapping, mappingSize);
+    *outCount = count;
+    return true;
+}
+
+// Prints the distinct DateTimes of a date cache whose keys are sorted, truncated to the given
+// granularity, to the given file stream without sorting or building a set. Sorted keys give the
+// same output from every engine, since input order is then ascending. Returns false if the
+// cache is not sorted.
+bool WriteDistinctDateTimesSortedCache(const DateCacheHeader* header, const uint64_t* packedKeys, Granularity granularity, FILE* stream)
+{
+    if (!header || !(header->flags & DATE_CACHE_SORTED)) {
+        return false;
+    }
+
+    DateTimeWriter writer;
+    if (!DateTimeWriterInit(&writer, stream)) {
+        return false;
+    }
+
+    // Equal keys are adjacent, and stay adjacent once truncated
+    DateTime dateTime;
+    uint64_t lastKey = 0;
+    for (size_t i = 0; i < header->count; i++) {
+        uint64_t key = TruncatePackedKey(packedKeys[i], granularity);
+        if (i == 0 || key != lastKey) {
+            UnpackDateTime(key, &dateTime);
+            DateTimeWriterPut(&writer, &dateTime);
+            lastKey = key;
+        }
+    }
+
+    return DateTimeWriterFree(&writer);
+}
+
+bool TestDateCache()
+{
+    const size_t numDates = 4;
+    DateTime dates[numDates];
+    PopulateDateTimeFromIsoString("2085-09-28T20:33:29Z", &dates[0]);
+    PopulateDateTimeFromIsoString("2085-09-28T20:33:29Z", &dates[1]);
+    PopulateDateTimeFromIsoString("2085-09-28T20:33:30Z", &dates[2]);
+    PopulateDateTimeFromIsoString("1999-12-31T23:59:59Z", &dates[3]);
+
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        return false;
+    }
+
+    // Flags are detected from the keys; prefixes of the list are sorted but not distinct, and
+    // then sorted and distinct
+    bool success = true;
+    const size_t counts[] = { numDates, 3, 1 };
+    const uint32_t expectedFlags[] = { 0, DATE_CACHE_SORTED, DATE_CACHE_SORTED | DATE_CACHE_DISTINCT };
+
+    for (size_t c = 0; success && c < sizeof(counts) / sizeof(counts[0]); c++) {
+        success = ftruncate(fileno(file), 0) == 0 && fseek(file, 0, SEEK_SET) == 0
+            && WriteDateCache(file, dates, counts[c]);
+
+        DateCacheHeader header;
+        size_t mappingSize = 0;
+        const char* mapping = success ? MapDateCache(file, &header, &mappingSize) : NULL;
+        success = mapping != NULL && header.count == counts[c] && header.flags == expectedFlags[c];
+        if (mapping) {
+            munmap((void*)mapping, mappingSize);
+        }
+    }
+
+    // Reload the full list
+    success = success && ftruncate(fileno(file), 0) == 0 && fseek(file, 0, SEEK_SET) == 0
+        && WriteDateCache(file, dates, numDates);
+
+    DateTime* loaded = NULL;
+    size_t loadedSize = 0;
+    size_t numLoaded = 0;
+    success = success && IngestDateTimesCached(&loaded, &loadedSize, file, &numLoaded) && numLoaded == numDates;
+    for (size_t i = 0; success && i < numDates; i++) {
+        success = DateTimesEqual(&loaded[i], &dates[i]);
+    }
+    free(loaded);
+
+    // A corrupted key must fail the checksum
+    uint64_t corrupt = 0;
+    success = success && fseek(file, sizeof(DateCacheHeader), SEEK_SET) == 0
+        && fwrite(&corrupt, sizeof(corrupt), 1, file) == 1 && fflush(file) == 0;
+
+    loaded = NULL;
+    loadedSize = 0;
+    success = success && !IngestDateTimesCached(&loaded, &loadedSize, file, &numLoaded) && numLoaded == 0;
+    free(loaded);
+
+    // So must a truncated one, while an empty one is valid
+    loaded = NULL;
+    loadedSize = 0;
+    success = success && ftruncate(fileno(file), sizeof(DateCacheHeader) + sizeof(uint64_t) / 2) == 0
+        && !IngestDateTimesCached(&loaded, &loadedSize, file, &numLoaded);
+    success = success && ftruncate(fileno(file), 0) == 0 && fseek(file, 0, SEEK_SET) == 0
+        && WriteDateCache(file, dates, 0) && IngestDateTimesCached(&loaded, &loadedSize, file, &numLoaded) && numLoaded == 0;
+    free(loaded);
+
+    fclose(file);
+    return success;
+}
+
+// A distinct index is a date cache flagged sorted and distinct, holding every date seen so far.
+// Appending a batch to it merges the batch's distinct dates in one pass over the index.
+#define DATE_INDEX_MERGE_BUFFER_KEYS 4096
+
+// Writes the given keys to a date cache being built in the given file stream, folding them
+// into the running checksum. Returns true if successful.
+bool WriteDateIndexKeys(FILE* stream, const uint64_t* packedKeys, size_t count, uint64_t* checksum)
+{
+    *checksum = ChecksumPackedKeys(*checksum, packedKeys, count);
+    return fwrite(packedKeys, sizeof(uint64_t), count, stream) == count;
+}
+
+// Creates a file with a unique name beside the file at the given path, for a replacement that
+// is then renamed over it, with the permissions of the file at the path if there is one, or
+// those fopen would give a new file. A unique name keeps concurrent writers apart, and being
+// beside the path keeps the rename within one file system. Returns the opened file, setting
+// outTempPath to its path for the caller to free, or NULL on failure.
+FILE* CreateReplacementFile(const char* path, char** outTempPath)
+{
+    *outTempPath = NULL;
+    const size_t tempPathLength = strlen(path) + sizeof(".XXXXXX");
+    char* tempPath = malloc(tempPathLength);
+    if (tempPath == NULL) {
+        return NULL;
+    }
+    snprintf(tempPath, tempPathLength, "%s.XXXXXX", path);
+
+    const mode_t umaskBits = umask(0);
+    umask(umaskBits);
+    mode_t mode = 0666 & ~umaskBits;
+    struct stat pathStat;
+    if (stat(path, &pathStat) == 0) {
+        mode = pathStat.st_mode & 07777;
+    }
+
+    FILE* file = NULL;
+    int fd = mkstemp(tempPath);
+    if (fd >= 0) {
+        file = (fchmod(fd, mode) == 0) ? fdopen(fd, "wb") : NULL;
+        if (file == NULL) {
+            close(fd);
+            remove(tempPath);
+        }
+    }
+
+    if (file == NULL) {
+        free(tempPath);
+        return NULL;
+    }
+
+    *outTempPath = tempPath;
+    return file;
+}
+
+// Merges the distinct DateTimes in the given list, selected in ascending order by
+// distinctKeys, into the distinct index at indexPath, which is created if it doesn't exist.
+// Dates not already in the index are printed to newStream and counted in outNewCount.
+//
+// The merged index is written to a file from CreateReplacementFile and renamed over the old
+// one once complete, so the index is replaced atomically and a failed append leaves it
+// untouched. The new dates are printed only once the rename has committed them, so a failed
+// append prints none. Returns true if successful.
+bool AppendToDateIndex(const char* indexPath, const DateTime* dateTimes, const size_t* distinctKeys, size_t distinctCount, FILE* newStream, size_t* outNewCount)
+{
+    if (!indexPath || (!dateTimes && distinctCount > 0) || (!distinctKeys && distinctCount > 0) || !newStream || !outNewCount) {
+        return false;
+    }
+
+    // A missing index is an empty one; any other index must be sorted and distinct
+    DateCacheHeader header = { DATE_CACHE_MAGIC, DATE_CACHE_VERSION, DATE_CACHE_SORTED | DATE_CACHE_DISTINCT, 0, 0 };
+    const char* mapping = NULL;
+    size_t mappingSize = 0;
+
+    FILE* indexFile = fopen(indexPath, "rb");
+    if (indexFile != NULL) {
+        mapping = MapDateCache(indexFile, &header, &mappingSize);
+        fclose(indexFile);
+
+        if (mapping == NULL || header.flags != (DATE_CACHE_SORTED | DATE_CACHE_DISTINCT)) {
+            if (mapping) {
+                munmap((void*)mapping, mappingSize);
+            }
+            return false;
+        }
+    }
+    else if (errno != ENOENT) {
+        return false;
+    }
+
+    const uint64_t* indexKeys = mapping ? (const uint64_t*)(mapping + sizeof(DateCacheHeader)) : NULL;
+    const size_t indexCount = (size_t)header.count;
+
+    char* tempPath = NULL;
+    uint64_t* buffer = malloc(DATE_INDEX_MERGE_BUFFER_KEYS * sizeof(uint64_t));
+    FILE* tempFile = buffer ? CreateReplacementFile(indexPath, &tempPath) : NULL;
+
+    // The header is written again once the count and checksum are known
+    bool success = tempFile != NULL && fwrite(&header, sizeof(header), 1, tempFile) == 1;
+
+    uint64_t checksum = DATE_CACHE_CHECKSUM_SEED;
+    size_t mergedCount = 0;
+    size_t newCount = 0;
+    size_t buffered = 0;
+    size_t indexPos = 0;
+    size_t batchPos = 0;
+
+    while (success && (indexPos < indexCount || batchPos < distinctCount)) {
+        uint64_t batchKey = batchPos < distinctCount ? PackDateTime(&dateTimes[distinctKeys[batchPos]]) : UINT64_MAX;
+
+        if (indexPos < indexCount && indexKeys[indexPos] <= batchKey) {
+            if (indexKeys[indexPos] == batchKey) {
+                batchPos++;  // Already in the index
+            }
+            buffer[buffered++] = indexKeys[indexPos++];
+        }
+        else {
+            newCount++;
+            buffer[buffered++] = batchKey;
+            batchPos++;
+        }
+
+        if (buffered == DATE_INDEX_MERGE_BUFFER_KEYS) {
+            success = WriteDateIndexKeys(tempFile, buffer, buffered, &checksum);
+            mergedCount += buffered;
+            buffered = 0;
+        }
+    }
+
+    if (success) {
+        success = WriteDateIndexKeys(tempFile, buffer, buffered, &checksum);
+        mergedCount += buffered;
+    }
+
+    if (success) {
+        header.count = mergedCount;
+        header.checksum = checksum;
+        success = fseek(tempFile, 0, SEEK_SET) == 0
+            && fwrite(&header, sizeof(header), 1, tempFile) == 1
+            && fflush(tempFile) == 0
+            && fsync(fileno(tempFile)) == 0;
+    }
+
+    if (tempFile != NULL) {
+        success = (fclose(tempFile) == 0) && success;
+        success = success && rename(tempPath, indexPath) == 0;
+        if (!success) {
+            remove(tempPath);
+        }
+    }
+
+    // The dates new to the index are those of the batch missing from the old index
+    if (success) {
+        DateTimeWriter writer;
+        success = DateTimeWriterInit(&writer, newStream);
+
+        size_t indexPos = 0;
+        for (size_t batchPos = 0; success && batchPos < distinctCount; batchPos++) {
+            const uint64_t batchKey = PackDateTime(&dateTimes[distinctKeys[batchPos]]);
+            while (indexPos < indexCount && indexKeys[indexPos] < batchKey) {
+                indexPos++;
+            }
+            if (indexPos == indexCount || indexKeys[indexPos] != batchKey) {
+                DateTimeWriterPut(&writer, &dateTimes[distinctKeys[batchPos]]);
+            }
+        }
+
+        success = success && DateTimeWriterFree(&writer);
+    }
+
+    if (mapping) {
+        munmap((void*)mapping, mappingSize);
+    }
+    free(buffer);
+    free(tempPath);
+
+    *outNewCount = newCount;
+    return success;
+}
+
+bool TestAppendToDateIndex()
+{
+    char indexPath[] = "/tmp/distinct-dates-indexXXXXXX";
+    int fd = mkstemp(indexPath);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    remove(indexPath);  // Appending must create a missing index
+
+    FILE* newDates = tmpfile();
+    if (newDates == NULL) {
+        return false;
+    }
+
+    // Each batch of years is appended in turn; the second repeats a date within itself
+    // and two from the first
+    const unsigned int batches[][4] = { { 2001, 1999, 2003, 2001 }, { 2000, 2003, 2000, 1999 }, { 2003, 2003, 2003, 2003 } };
+    const size_t expectedNewCounts[] = { 3, 1, 0 };
+    const size_t numBatches = sizeof(batches) / sizeof(batches[0]);
+
+    bool success = true;
+    for (size_t b = 0; success && b < numBatches; b++) {
+        DateTime dates[4];
+        size_t distinctKeys[4];
+        size_t numDistinctKeys = 0;
+        size_t newCount = 0;
+
+        for (size_t i = 0; i < 4; i++) {
+            PopulateDateTimeFromIsoString("2000-06-15T12:30:45Z", &dates[i]);
+            dates[i].year = batches[b][i];
+        }
+
+        success = DistinctDateTimes(dates, 4, distinctKeys, &numDistinctKeys)
+            && AppendToDateIndex(indexPath, dates, distinctKeys, numDistinctKeys, newDates, &newCount)
+            && newCount == expectedNewCounts[b];
+    }
+
+    // An append that can't be committed reports no new dates
+    DateTime lostDate;
+    const size_t lostKey = 0;
+    size_t lostCount = 0;
+    PopulateDateTimeFromIsoString("1990-06-15T12:30:45Z", &lostDate);
+    success = success && !AppendToDateIndex("/nonexistent-directory/index", &lostDate, &lostKey, 1, newDates, &lostCount);
+
+    // The index holds each year once, in order
+    const unsigned int expectedYears[] = { 1999, 2000, 2001, 2003 };
+    FILE* indexFile = fopen(indexPath, "rb");
+    DateCacheHeader header;
+    size_t mappingSize = 0;
+    const char* mapping = (success && indexFile) ? MapDateCache(indexFile, &header, &mappingSize) : NULL;
+    success = mapping != NULL && header.count == 4;
+
+    for (size_t i = 0; success && i < 4; i++) {
+        DateTime date;
+        UnpackDateTime(((const uint64_t*)(mapping + sizeof(DateCacheHeader)))[i], &date);
+        success = date.year == expectedYears[i];
+    }
+
+    if (mapping) {
+        munmap((void*)mapping, mappingSize);
+    }
+    if (indexFile) {
+        fclose(indexFile);
+    }
+
+    // The new dates were reported in the order they were appended
+    char line[64];
+    const char* expectedNewDates[] = {
+        "1999-06-15T12:30:45Z\n", "2001-06-15T12:30:45Z\n", "2003-06-15T12:30:45Z\n", "2000-06-15T12:30:45Z\n",
+    };
+    rewind(newDates);
+    for (size_t i = 0; success && i < 4; i++) {
+        success = fgets(line, sizeof(line), newDates) && strcmp(line, expectedNewDates[i]) == 0;
+    }
+    success = success && fgets(line, sizeof(line), newDates) == NULL;
+
+    fclose(newDates);
+    remove(indexPath);
+    return success;
+}
+
+// A date server keeps a DateTimeBitmap of distinct DateTimes resident and answers requests over
+// a Unix domain socket, one request per line. Replies are one line each, in request order, so
+// clients can pipeline as many requests as they like without waiting:
+//
+//   INSERT date       NEW if the date was added, OLD if already present
+//   CONTAINS date     YES or NO
+//   COUNT             Number of distinct dates
+//   RANGE first last  Each distinct date in [first, last] on its own line, then END
+//   SHUTDOWN          BYE, then the server stops
+//
+// Malformed requests are answered with a line starting ERR. Connections are served from a
+// single epoll event loop; a connection whose replies back up stops being read until they are
+// sent, so one slow client can't grow the server's memory without bound. A RANGE reply is
+// produced a day at a time as the previous part is sent, for the same reason.
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_SIZE (64 * 1024)
+#define SERVER_MAX_LINE 4096                // Longer requests are refused and the connection closed
+#define SERVER_MAX_PENDING_OUTPUT (1 << 20) // Bytes of unsent replies before input is paused
+
+typedef struct serverConnection {
+    int fd;
+    char* in;                   // Received bytes not yet handled
+    size_t inLength;
+    size_t inCapacity;
+    char* out;                  // Replies not yet sent
+    size_t outLength;
+    size_t outCapacity;
+    size_t outSent;             // Bytes of out already sent
+    bool readClosed;            // The client has finished sending
+    bool failed;                // The connection should be dropped
+    bool rangeOpen;             // A RANGE reply is partly appended
+    uint64_t rangeNext;         // Packed key the open RANGE reply continues from
+    uint64_t rangeLast;         // Packed key the open RANGE reply ends at
+    struct serverConnection* next;
+    struct serverConnection* prev;
+} ServerConnection;
+
+typedef struct dateServer {
+    DateTimeBitmap dates;
+    int epollFd;
+    int listenFd;
+    bool running;
+    ServerConnection* connections;
+} DateServer;
+
+// Appends the given bytes to the connection's replies. Returns false if out of memory.
+bool ServerConnectionAppend(ServerConnection* connection, const char* data, size_t length)
+{
+    if (connection->outLength + length > connection->outCapacity) {
+        size_t capacity = connection->outCapacity ? connection->outCapacity : 4096;
+        while (capacity < connection->outLength + length) {
+            capacity *= 2;
+        }
+
+        char* out = realloc(connection->out, capacity);
+        if (out == NULL) {
+            connection->failed = true;
+            return false;
+        }
+        connection->out = out;
+        connection->outCapacity = capacity;
+    }
+
+    memcpy(connection->out + connection->outLength, data, length);
+    connection->outLength += length;
+    return true;
+}
+
+bool ServerConnectionReply(ServerConnection* connection, const char* reply)
+{
+    return ServerConnectionAppend(connection, reply, strlen(reply));
+}
+
+// DateTimeBitmap visitor appending each DateTime to the ServerConnection given as context
+void ServerConnectionVisitor(const DateTime* dateTime, void* context)
+{
+    char line[ISO_LINE_LEN];
+    FormatDateTime(line, dateTime);
+    ServerConnectionAppend((ServerConnection*)context, line, ISO_LINE_LEN);
+}
+
+// Returns the number of bytes of replies on the connection not yet sent.
+size_t ServerConnectionPending(const ServerConnection* connection)
+{
+    return connection->outLength - connection->outSent;
+}
+
+// Appends the next days of the connection's open RANGE reply until its unsent replies reach
+// SERVER_MAX_PENDING_OUTPUT, and END once the range is exhausted.
+void ServerContinueRange(DateServer* server, ServerConnection* connection)
+{
+    while (connection->rangeOpen && !connection->failed && ServerConnectionPending(connection) < SERVER_MAX_PENDING_OUTPUT) {
+        const size_t maxCount = (SERVER_MAX_PENDING_OUTPUT - ServerConnectionPending(connection)) / ISO_LINE_LEN + 1;
+        connection->rangeOpen = DateTimeBitmapForEachInRangeLimited(&server->dates, &connection->rangeNext, connection->rangeLast,
+            maxCount, ServerConnectionVisitor, connection);
+
+        if (!connection->rangeOpen) {
+            ServerConnectionReply(connection, "END\n");
+        }
+    }
+}
+
+// Parses the next space separated date in the request at *request, advancing past it.
+bool ServerParseDate(char** request, DateTime* dateTime)
+{
+    char* start = *request;
+    while (*start == ' ') {
+        start++;
+    }
+
+    char* end = start;
+    while (*end != ' ' && *end != '\0') {
+        end++;
+    }
+
+    *request = end;
+    return end > start && PopulateDateTimeFromIsoCharsFast(start, (size_t)(end - start), dateTime);
+}
+
+// Handles the given null terminated request line, appending its reply to the connection.
+void ServerHandleRequest(DateServer* server, ServerConnection* connection, char* request)
+{
+    char* args = strchr(request, ' ');
+    if (args != NULL) {
+        *args++ = '\0';
+    }
+    else {
+        args = request + strlen(request);
+    }
+
+    DateTime first;
+    DateTime last;
+
+    if (strcmp(request, "INSERT") == 0) {
+        bool inserted = false;
+        if (!ServerParseDate(&args, &first)) {
+            ServerConnectionReply(connection, "ERR invalid date\n");
+        }
+        else if (!DateTimeBitmapAdd(&server->dates, &first, &inserted)) {
+            ServerConnectionReply(connection, "ERR out of memory\n");
+        }
+        else {
+            ServerConnectionReply(connection, inserted ? "NEW\n" : "OLD\n");
+        }
+    }
+    else if (strcmp(request, "CONTAINS") == 0) {
+        if (!ServerParseDate(&args, &first)) {
+            ServerConnectionReply(connection, "ERR invalid date\n");
+        }
+        else {
+            ServerConnectionReply(connection, DateTimeBitmapContains(&server->dates, &first) ? "YES\n" : "NO\n");
+        }
+    }
+    else if (strcmp(request, "COUNT") == 0) {
+        char reply[32];
+        snprintf(reply, sizeof(reply), "%zu\n", server->dates.count);
+        ServerConnectionReply(connection, reply);
+    }
+    else if (strcmp(request, "RANGE") == 0) {
+        if (!ServerParseDate(&args, &first) || !ServerParseDate(&args, &last)) {
+            ServerConnectionReply(connection, "ERR invalid date\n");
+        }
+        else {
+            connection->rangeOpen = true;
+            connection->rangeNext = PackDateTime(&first);
+            connection->rangeLast = PackDateTime(&last);
+            ServerContinueRange(server, connection);
+        }
+    }
+    else if (strcmp(request, "SHUTDOWN") == 0) {
+        ServerConnectionReply(connection, "BYE\n");
+        server->running = false;
+    }
+    else {
+        ServerConnectionReply(connection, "ERR unknown request\n");
+    }
+}
+
+// Continues any open RANGE reply, then handles complete request lines received on the
+// connection, until its unsent replies reach SERVER_MAX_PENDING_OUTPUT. Returns true if it
+// stopped because of the replies.
+bool ServerHandleRequests(DateServer* server, ServerConnection* connection)
+{
+    if (connection->in == NULL) {
+        return false;
+    }
+
+    size_t handled = 0;
+    bool limited = false;
+    while (!connection->failed) {
+        // Later requests wait until an open RANGE reply is complete, so replies stay in order
+        ServerContinueRange(server, connection);
+        if ((limited = ServerConnectionPending(connection) >= SERVER_MAX_PENDING_OUTPUT)) {
+            break;
+        }
+
+        char* line = connection->in + handled;
+        char* newline = memchr(line, '\n', connection->inLength - handled);
+        if (newline == NULL) {
+            // A final request without a newline is handled once the client stops sending
+            if (!connection->readClosed || handled == connection->inLength) {
+                break;
+            }
+            newline = connection->in + connection->inLength;
+        }
+
+        size_t length = (size_t)(newline - line);
+        handled += length + (handled + length < connection->inLength ? 1 : 0);
+        if (length > 0 && line[length - 1] == '\r') {
+            length--;
+        }
+
+        if (length > 0) {
+            line[length] = '\0';
+            ServerHandleRequest(server, connection, line);
+        }
+    }
+
+    memmove(connection->in, connection->in + handled, connection->inLength - handled);
+    connection->inLength -= handled;
+
+    if (connection->inLength > SERVER_MAX_LINE && memchr(connection->in, '\n', connection->inLength) == NULL) {
+        ServerConnectionReply(connection, "ERR request too long\n");
+        connection->failed = true;
+    }
+
+    return limited;
+}
+
+// Sends as much of the connection's replies as the socket accepts.
+void ServerSendReplies(ServerConnection* connection)
+{
+    while (connection->outSent < connection->outLength) {
+        ssize_t sent = send(connection->fd, connection->out + connection->outSent, connection->outLength - connection->outSent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                connection->failed = true;
+            }
+            break;
+        }
+        connection->outSent += (size_t)sent;
+    }
+
+    if (connection->outSent == connection->outLength) {
+        connection->outSent = 0;
+        connection->outLength = 0;
+    }
+}
+
+// Alternates between handling requests and sending replies until the connection needs to wait
+// for the socket.
+void ServerServiceConnection(DateServer* server, ServerConnection* connection)
+{
+    bool limited;
+    do {
+        limited = ServerHandleRequests(server, connection);
+        ServerSendReplies(connection);
+    } while (limited && !connection->failed && ServerConnectionPending(connection) == 0);
+}
+
+void ServerCloseConnection(DateServer* server, ServerConnection* connection)
+{
+    epoll_ctl(server->epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+
+    if (connection->prev) {
+        connection->prev->next = connection->next;
+    }
+    else {
+        server->connections = connection->next;
+    }
+    if (connection->next) {
+        connection->next->prev = connection->prev;
+    }
+
+    free(connection->in);
+    free(connection->out);
+    free(connection);
+}
+
+// Reads what is available on the connection and services it, then closes it or updates the
+// events it waits for.
+void ServerOnConnectionEvent(DateServer* server, ServerConnection* connection, uint32_t events)
+{
+    bool paused = ServerConnectionPending(connection) >= SERVER_MAX_PENDING_OUTPUT;
+
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !paused && !connection->readClosed) {
+        // One byte more than is read leaves room to null terminate a final request
+        if (connection->inCapacity - connection->inLength < SERVER_READ_SIZE + 1) {
+            char* in = realloc(connection->in, connection->inLength + SERVER_READ_SIZE + 1);
+            if (in == NULL) {
+                ServerCloseConnection(server, connection);
+                return;
+            }
+            connection->in = in;
+            connection->inCapacity = connection->inLength + SERVER_READ_SIZE + 1;
+        }
+
+        ssize_t received = recv(connection->fd, connection->in + connection->inLength, SERVER_READ_SIZE, 0);
+        if (received > 0) {
+            connection->inLength += (size_t)received;
+        }
+        else if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            connection->readClosed = true;
+        }
+    }
+
+    ServerServiceConnection(server, connection);
+
+    bool pending = ServerConnectionPending(connection) > 0;
+    if (connection->failed || (connection->readClosed && !pending)) {
+        ServerCloseConnection(server, connection);
+        return;
+    }
+
+    // Wait for room to send while replies are pending, and for input while there's room
+    struct epoll_event event = { 0 };
+    event.data.ptr = connection;
+    event.events = (pending ? EPOLLOUT : 0)
+        | ((connection->readClosed || ServerConnectionPending(connection) >= SERVER_MAX_PENDING_OUTPUT) ? 0 : EPOLLIN);
+    epoll_ctl(server->epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+void ServerAcceptConnections(DateServer* server)
+{
+    for (;;) {
+        int fd = accept4(server->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;  // No more pending connections, or a transient error
+        }
+
+        ServerConnection* connection = calloc(1, sizeof(ServerConnection));
+        struct epoll_event event = { 0 };
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+
+        if (connection == NULL || epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            free(connection);
+            close(fd);
+            continue;
+        }
+
+        connection->fd = fd;
+        connection->next = server->connections;
+        if (server->connections) {
+            server->connections->prev = connection;
+        }
+        server->connections = connection;
+    }
+}
+
+// Creates a listening Unix domain socket at the given path, replacing any stale socket file.
+// Returns the socket, or -1 on failure, including when the path names anything but a socket.
+int OpenServerSocket(const char* socketPath)
+{
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    if (!socketPath || strlen(socketPath) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat pathStat;
+    if (lstat(socketPath, &pathStat) == 0) {
+        if (!S_ISSOCK(pathStat.st_mode) || unlink(socketPath) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    else if (errno != ENOENT) {
+        close(fd);
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Serves date requests on the given listening socket from OpenServerSocket until a client
+// requests SHUTDOWN, then closes the socket. Returns true if the server shut down cleanly.
+bool ServeDates(int listenFd)
+{
+    DateServer server = { 0 };
+    server.listenFd = listenFd;
+    server.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    server.running = true;
+
+    struct epoll_event event = { 0 };
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;  // Marks the listening socket
+
+    bool success = server.epollFd >= 0
+        && DateTimeBitmapInit(&server.dates)
+        && epoll_ctl(server.epollFd, EPOLL_CTL_ADD, listenFd, &event) == 0;
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (success && server.running) {
+        int count = epoll_wait(server.epollFd, events, SERVER_MAX_EVENTS, -1);
+        if (count < 0) {
+            success = errno == EINTR;
+            continue;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                ServerAcceptConnections(&server);
+            }
+            else {
+                ServerOnConnectionEvent(&server, (ServerConnection*)events[i].data.ptr, events[i].events);
+            }
+        }
+    }
+
+    while (server.connections) {
+        ServerCloseConnection(&server, server.connections);
+    }
+
+    DateTimeBitmapFree(&server.dates);
+    if (server.epollFd >= 0) {
+        close(server.epollFd);
+    }
+    close(listenFd);
+
+    return success;
+}
+
+// Connects to the date server at the given socket path, sends everything read from inFd as
+// requests and copies the replies to outFd until the server closes the connection. Sending and
+// receiving are interleaved, so requests can be pipelined without either side blocking.
+// Returns true if successful.
+bool RunDateClient(const char* socketPath, int inFd, int outFd)
+{
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    if (!socketPath || strlen(socketPath) >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return false;
+    }
+
+    char* sendBuff = malloc(SERVER_READ_SIZE);
+    char* receiveBuff = malloc(SERVER_READ_SIZE);
+    size_t sendLength = 0;
+    size_t sendOffset = 0;
+    bool inputDone = false;
+    bool success = sendBuff != NULL && receiveBuff != NULL;
+
+    while (success) {
+        struct pollfd fds[2] = {
+            { .fd = fd, .events = POLLIN | (sendOffset < sendLength ? POLLOUT : 0) },
+            { .fd = (inputDone || sendOffset < sendLength) ? -1 : inFd, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            success = errno == EINTR;
+            continue;
+        }
+
+        if (fds[1].revents) {
+            ssize_t length = read(inFd, sendBuff, SERVER_READ_SIZE);
+            if (length > 0) {
+                sendLength = (size_t)length;
+                sendOffset = 0;
+            }
+            else {
+                inputDone = true;
+                shutdown(fd, SHUT_WR);  // The server closes once it has replied to everything
+            }
+        }
+
+        if (fds[0].revents & POLLOUT) {
+            ssize_t sent = send(fd, sendBuff + sendOffset, sendLength - sendOffset, MSG_NOSIGNAL);
+            success = sent >= 0;
+            sendOffset += sent > 0 ? (size_t)sent : 0;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t received = recv(fd, receiveBuff, SERVER_READ_SIZE, 0);
+            if (received <= 0) {
+                success = received == 0;
+                break;
+            }
+
+            for (ssize_t written = 0; success && written < received; ) {
+                ssize_t chunk = write(outFd, receiveBuff + written, (size_t)(received - written));
+                success = chunk > 0;
+                written += chunk > 0 ? chunk : 0;
+            }
+        }
+    }
+
+    free(receiveBuff);
+    free(sendBuff);
+    close(fd);
+    return success;
+}
+
+void* ServeDatesThread(void* arg)
+{
+    ServeDates(*(int*)arg);
+    return NULL;
+}
+
+bool TestDateServer()
+{
+    char socketPath[] = "/tmp/distinct-dates-serverXXXXXX";
+    int tempFd = mkstemp(socketPath);
+    if (tempFd < 0) {
+        return false;
+    }
+    close(tempFd);
+
+    // Only a stale socket is replaced, never the regular file mkstemp left at the path
+    bool refused = OpenServerSocket(socketPath) < 0;
+    unlink(socketPath);
+
+    int listenFd = OpenServerSocket(socketPath);
+    pthread_t thread;
+    if (listenFd < 0 || pthread_create(&thread, NULL, ServeDatesThread, &listenFd) != 0) {
+        unlink(socketPath);
+        return false;
+    }
+
+    // Every request goes in one write, so the server sees them pipelined
+    const char* requests =
+        "INSERT 2085-09-28T20:33:29Z\n"
+        "INSERT 2085-09-28T08:03:29+12:30\n"
+        "INSERT 2001-01-01T00:00:00Z\n"
+        "INSERT 2085-09-28T20:33:30Z\r\n"
+        "INSERT not a date\n"
+        "CONTAINS 2001-01-01T00:00:00Z\n"
+        "CONTAINS 2001-01-01T00:00:01Z\n"
+        "COUNT\n"
+        "RANGE 2085-09-28T20:33:29Z 2100-01-01T00:00:00Z\n"
+        "FROB\n"
+        "SHUTDOWN";
+    const char* expected =
+        "NEW\nOLD\nNEW\nNEW\nERR invalid date\n"
+        "YES\nNO\n"
+        "3\n"
+        "2085-09-28T20:33:29Z\n2085-09-28T20:33:30Z\nEND\n"
+        "ERR unknown request\n"
+        "BYE\n";
+
+    FILE* input = tmpfile();
+    FILE* output = tmpfile();
+    bool success = input && output && fputs(requests, input) >= 0 && fflush(input) == 0 && fseek(input, 0, SEEK_SET) == 0
+        && RunDateClient(socketPath, fileno(input), fileno(output));
+
+    pthread_join(thread, NULL);
+    unlink(socketPath);
+
+    char replies[512] = { 0 };
+    success = success && refused && pread(fileno(output), replies, sizeof(replies) - 1, 0) >= 0
+        && strcmp(replies, expected) == 0;
+    printf("%s", replies);
+
+    if (input) {
+        fclose(input);
+    }
+    if (output) {
+        fclose(output);
+    }
+    return success;
+}
+
+bool TestServerRangeReply()
+{
+    DateServer server = { 0 };
+    ServerConnection connection = { 0 };
+    char request[] = "RANGE 2000-01-01T00:00:00Z 2000-12-31T23:59:59Z\nCOUNT\n";
+
+    // Four days of every second, far more than SERVER_MAX_PENDING_OUTPUT, and more outside the range
+    const size_t dayCount = 4;
+    bool inserted;
+    bool success = DateTimeBitmapInit(&server.dates);
+    DateTime dateTime = { 2000, 3, 1, 0, 0, 0 };
+    for (unsigned int day = 1; success && day <= dayCount + 1; day++) {
+        dateTime.year = (day <= dayCount) ? 2000 : 2001;
+        dateTime.day = day;
+        for (unsigned int second = 0; success && second < SECONDS_PER_DAY; second++) {
+            dateTime.hour = second / 3600;
+            dateTime.minute = (second / 60) % 60;
+            dateTime.second = second % 60;
+            success = DateTimeBitmapAdd(&server.dates, &dateTime, &inserted);
+        }
+    }
+
+    connection.in = request;
+    connection.inLength = strlen(request);
+
+    // Each pass sends everything pending, as a client keeping up would let it
+    size_t dates = 0;
+    uint64_t lastKey = 0;
+    bool ended = false;
+    char count[32];
+    while (success && !ended) {
+        ServerHandleRequests(&server, &connection);
+        success = !connection.failed && ServerConnectionPending(&connection) <= SERVER_MAX_PENDING_OUTPUT + SECONDS_PER_DAY * ISO_LINE_LEN;
+
+        for (size_t offset = 0; success && offset < connection.outLength; offset += ISO_LINE_LEN) {
+            if (memcmp(connection.out + offset, "END\n", 4) == 0) {
+                snprintf(count, sizeof(count), "%zu\n", server.dates.count);
+                ended = connection.outLength - offset - 4 == strlen(count) && memcmp(connection.out + offset + 4, count, strlen(count)) == 0;
+                success = ended;
+                break;
+            }
+
+            success = PopulateDateTimeFromIsoCharsFast(connection.out + offset, ISO_LINE_LEN - 1, &dateTime)
+                && (dates == 0 || PackDateTime(&dateTime) > lastKey);
+            lastKey = PackDateTime(&dateTime);
+            dates++;
+        }
+        connection.outLength = 0;
+    }
+
+    printf("%zu dates in range\n", dates);
+    free(connection.out);
+    DateTimeBitmapFree(&server.dates);
+    return success && dates == dayCount * SECONDS_PER_DAY;
+}
+
+// A range index answers point lookups, range counts and range dumps over sorted distinct
+// packed keys while reading only O(log n) cache lines per query, from a file that any number
+// of processes can map read-only and share through the page cache.
+//
+// It is a static B+ tree of RANGE_INDEX_FANOUT keys to a node, one node per cache line. The
+// leaf level is the keys themselves in order; each level above holds the first key of every
+// node of the level below. Every level is padded to whole nodes with RANGE_INDEX_PADDING,
+// which sorts after any packed key. The file is a RangeIndexHeader followed by the levels,
+// root first, in native byte order. Shapes of the levels follow from the count alone.
+#define RANGE_INDEX_MAGIC "DDRANGE"     // Eight bytes with the null terminator
+#define RANGE_INDEX_VERSION 1
+#define RANGE_INDEX_FANOUT 8            // Keys in a 64-byte node
+#define RANGE_INDEX_MAX_LEVELS 16       // Enough for any count of 40-bit keys
+#define RANGE_INDEX_PADDING UINT64_MAX
+
+typedef struct rangeIndexHeader {
+    char magic[8];          // RANGE_INDEX_MAGIC
+    uint32_t version;       // RANGE_INDEX_VERSION
+    uint32_t levelCount;    // Number of levels, including the leaves
+    uint64_t count;         // Number of keys in the leaves, not counting padding
+    uint64_t checksum;      // ChecksumPackedKeys of every level, root first
+    uint64_t reserved[4];   // Zero; pads the header to a node so nodes stay cache line aligned
+} RangeIndexHeader;
+
+// A range index mapped with MapRangeIndex
+typedef struct rangeIndex {
+    const char* mapping;
+    size_t mappingSize;
+    size_t count;                                   // Number of keys
+    size_t levelCount;
+    const uint64_t* levels[RANGE_INDEX_MAX_LEVELS]; // Nodes of each level, root first
+} RangeIndex;
+
+// Computes the number of nodes in each level of a range index over count keys into
+// outNodes, leaves first. Returns the number of levels, which is 0 for no keys.
+size_t RangeIndexLevelNodes(size_t count, size_t outNodes[RANGE_INDEX_MAX_LEVELS])
+{
+    size_t levelCount = 0;
+    size_t keys = count;
+    while (keys > 0 && levelCount < RANGE_INDEX_MAX_LEVELS) {
+        outNodes[levelCount] = (keys + RANGE_INDEX_FANOUT - 1) / RANGE_INDEX_FANOUT;
+        keys = (outNodes[levelCount] > 1) ? outNodes[levelCount] : 0;
+        levelCount++;
+    }
+    return levelCount;
+}
+
+// Writes the given ascending distinct packed keys to the given file stream as a range index.
+// Returns true if successful.
+bool WriteRangeIndex(FILE* stream, const uint64_t* packedKeys, size_t count)
+{
+    if (!stream || (!packedKeys && count > 0)) {
+        return false;
+    }
+
+    size_t levelNodes[RANGE_INDEX_MAX_LEVELS];
+    const size_t levelCount = RangeIndexLevelNodes(count, levelNodes);
+
+    // Every level is built in one buffer, leaves first, so the levels above are a fraction of it
+    size_t totalKeys = 0;
+    size_t levelStarts[RANGE_INDEX_MAX_LEVELS];
+    for (size_t level = 0; level < levelCount; level++) {
+        levelStarts[level] = totalKeys;
+        totalKeys += levelNodes[level] * RANGE_INDEX_FANOUT;
+    }
+
+    uint64_t* nodes = malloc((totalKeys ? totalKeys : 1) * sizeof(uint64_t));
+    if (nodes == NULL) {
+        return false;
+    }
+
+    const uint64_t* below = packedKeys;
+    size_t belowCount = count;
+    for (size_t level = 0; level < levelCount; level++) {
+        uint64_t* keys = nodes + levelStarts[level];
+        const size_t stride = (level == 0) ? 1 : RANGE_INDEX_FANOUT;
+        const size_t keyCount = (level == 0) ? count : (belowCount + RANGE_INDEX_FANOUT - 1) / RANGE_INDEX_FANOUT;
+
+        for (size_t i = 0; i < keyCount; i++) {
+            keys[i] = below[i * stride];
+        }
+        for (size_t i = keyCount; i < levelNodes[level] * RANGE_INDEX_FANOUT; i++) {
+            keys[i] = RANGE_INDEX_PADDING;
+        }
+
+        below = keys;
+        belowCount = keyCount;
+    }
+
+    RangeIndexHeader header = { RANGE_INDEX_MAGIC, RANGE_INDEX_VERSION, (uint32_t)levelCount, count, DATE_CACHE_CHECKSUM_SEED, { 0 } };
+    for (size_t level = levelCount; level-- > 0;) {
+        header.checksum = ChecksumPackedKeys(header.checksum, nodes + levelStarts[level], levelNodes[level] * RANGE_INDEX_FANOUT);
+    }
+
+    bool success = fwrite(&header, sizeof(header), 1, stream) == 1;
+    for (size_t level = levelCount; success && level-- > 0;) {
+        const size_t keyCount = levelNodes[level] * RANGE_INDEX_FANOUT;
+        success = fwrite(nodes + levelStarts[level], sizeof(uint64_t), keyCount, stream) == keyCount;
+    }
+    success = success && fflush(stream) == 0;
+
+    free(nodes);
+    return success;
+}
+
+// Writes the distinct DateTimes in the given list to the file at the given path as a range
+// index. The index is written to a file from CreateReplacementFile and renamed into place, so
+// processes that have the old index mapped keep reading it undisturbed. Returns true if
+// successful.
+bool SaveRangeIndex(const char* indexPath, const DateTime* dateTimes, size_t count)
+{
+    if (!indexPath || (!dateTimes && count > 0)) {
+        return false;
+    }
+
+    uint64_t* packedKeys = PackDateTimes(dateTimes, count);
+    size_t* keys = malloc((count ? count : 1) * sizeof(size_t));
+    uint64_t* distinctKeys = malloc((count ? count : 1) * sizeof(uint64_t));
+    char* tempPath = NULL;
+
+    bool success = packedKeys != NULL && keys != NULL && distinctKeys != NULL
+        && RadixSortPackedKeys(packedKeys, count, keys);
+    size_t distinctCount = 0;
+
+    for (size_t i = 0; success && i < count; i++) {
+        const uint64_t key = packedKeys[keys[i]];
+        if (distinctCount == 0 || key != distinctKeys[distinctCount - 1]) {
+            distinctKeys[distinctCount++] = key;
+        }
+    }
+
+    FILE* tempFile = NULL;
+    if (success) {
+        tempFile = CreateReplacementFile(indexPath, &tempPath);
+        success = tempFile != NULL && WriteRangeIndex(tempFile, distinctKeys, distinctCount)
+            && fsync(fileno(tempFile)) == 0;
+    }
+
+    if (tempFile != NULL) {
+        success = (fclose(tempFile) == 0) && success;
+        success = success && rename(tempPath, indexPath) == 0;
+        if (!success) {
+            remove(tempPath);
+        }
+    }
+
+    free(packedKeys);
+    free(keys);
+    free(distinctKeys);
+    free(tempPath);
+    return success;
+}
+
+// Memory maps the range index in the given file stream into the given RangeIndex, checking
+// its shape. Verifying the checksum reads every node, so queries that should touch only
+// O(log n) cache lines leave it to whoever built or copied the index.
+// Returns false if the file is not a valid range index. Release it with UnmapRangeIndex.
+bool MapRangeIndex(FILE* stream, RangeIndex* index, bool verifyChecksum)
+{
+    if (!stream || !index) {
+        return false;
+    }
+
+    size_t fileSize = 0;
+    const char* mapping = MapInputFile(stream, &fileSize);
+    if (mapping == NULL) {
+        return false;
+    }
+    madvise((void*)mapping, fileSize, MADV_RANDOM);
+
+    RangeIndexHeader header;
+    size_t levelNodes[RANGE_INDEX_MAX_LEVELS];
+    size_t levelCount = 0;
+    size_t totalKeys = 0;
+
+    bool valid = fileSize >= sizeof(RangeIndexHeader);
+    if (valid) {
+        memcpy(&header, mapping, sizeof(RangeIndexHeader));
+        levelCount = RangeIndexLevelNodes((size_t)header.count, levelNodes);
+        for (size_t level = 0; level < levelCount; level++) {
+            totalKeys += levelNodes[level] * RANGE_INDEX_FANOUT;
+        }
+
+        valid = memcmp(header.magic, RANGE_INDEX_MAGIC, sizeof(header.magic)) == 0
+            && header.version == RANGE_INDEX_VERSION
+            && header.levelCount == levelCount
+            && header.count < ((uint64_t)1 << 48)
+            && fileSize - sizeof(RangeIndexHeader) == totalKeys * sizeof(uint64_t);
+    }
+
+    const uint64_t* nodes = (const uint64_t*)(mapping + sizeof(RangeIndexHeader));
+    if (valid && verifyChecksum) {
+        valid = header.checksum == ChecksumPackedKeys(DATE_CACHE_CHECKSUM_SEED, nodes, totalKeys);
+    }
+
+    if (!valid) {
+        munmap((void*)mapping, fileSize);
+        return false;
+    }
+
+    index->mapping = mapping;
+    index->mappingSize = fileSize;
+    index->count = (size_t)header.count;
+    index->levelCount = levelCount;
+    for (size_t level = 0; level < levelCount; level++) {
+        index->levels[level] = nodes;
+        nodes += levelNodes[levelCount - 1 - level] * RANGE_INDEX_FANOUT;
+    }
+    return true;
+}
+
+void UnmapRangeIndex(RangeIndex* index)
+{
+    if (index && index->mapping) {
+        munmap((void*)index->mapping, index->mappingSize);
+        index->mapping = NULL;
+    }
+}
+
+// Returns the position in the leaves of the first key not less than the given packed key, or
+// the index's count if every key is less. Reads one node from each level.
+size_t RangeIndexLowerBound(const RangeIndex* index, uint64_t packed)
+{
+    size_t node = 0;
+    for (size_t level = 0; level < index->levelCount; level++) {
+        // Counting instead of searching keeps the node's comparisons free of branches
+        const uint64_t* keys = index->levels[level] + node * RANGE_INDEX_FANOUT;
+        size_t less = 0;
+        for (size_t i = 0; i < RANGE_INDEX_FANOUT; i++) {
+            less += keys[i] < packed;
+        }
+
+        // Only the last child starting below the key can hold the first key not below it; if
+        // that child is all below, it's the first key of the next child, found at the leaves
+        if (level + 1 == index->levelCount) {
+            return node * RANGE_INDEX_FANOUT + less;
+        }
+        node = node * RANGE_INDEX_FANOUT + (less > 0 ? less - 1 : 0);
+    }
+    return 0;
+}
+
+// Returns the packed key at the given position in the leaves of the given range index.
+uint64_t RangeIndexKey(const RangeIndex* index, size_t position)
+{
+    return index->levels[index->levelCount - 1][position];
+}
+
+bool RangeIndexContains(const RangeIndex* index, const DateTime* dateTime)
+{
+    const uint64_t packed = PackDateTime(dateTime);
+    const size_t position = RangeIndexLowerBound(index, packed);
+    return position < index->count && RangeIndexKey(index, position) == packed;
+}
+
+// Returns the number of keys in the given range index between the given DateTimes, inclusive.
+size_t RangeIndexCount(const RangeIndex* index, const DateTime* first, const DateTime* last)
+{
+    const uint64_t firstKey = PackDateTime(first);
+    const uint64_t lastKey = PackDateTime(last);
+    if (firstKey > lastKey) {
+        return 0;
+    }
+    return RangeIndexLowerBound(index, lastKey + 1) - RangeIndexLowerBound(index, firstKey);
+}
+
+// Calls the given visitor, in ascending order, with each DateTime in the given range index
+// between the given DateTimes, inclusive. The keys after the first are read sequentially.
+void RangeIndexForEachInRange(const RangeIndex* index, const DateTime* first, const DateTime* last, void(*visit)(const DateTime*, void*), void* context)
+{
+    const uint64_t lastKey = PackDateTime(last);
+    DateTime dateTime;
+    for (size_t i = RangeIndexLowerBound(index, PackDateTime(first)); i < index->count && RangeIndexKey(index, i) <= lastKey; i++) {
+        UnpackDateTime(RangeIndexKey(index, i), &dateTime);
+        visit(&dateTime, context);
+    }
+}
+
+// Range visitor writing each DateTime to the file stream given as context
+void RangeQueryVisitor(const DateTime* dateTime, void* context)
+{
+    char line[ISO_LINE_LEN];
+    FormatDateTime(line, dateTime);
+    fwrite(line, 1, ISO_LINE_LEN, (FILE*)context);
+}
+
+// Answers queries read from the given input stream, one per line, against the given range
+// index, writing one reply per query to the given output stream. Queries and replies follow
+// the date server's:
+//
+//   CONTAINS date     YES or NO
+//   COUNT             Number of dates in the index
+//   COUNT first last  Number of dates in [first, last]
+//   RANGE first last  Each date in [first, last] on its own line, then END
+//
+// Returns false if reading or writing fails.
+bool RunRangeQueries(const RangeIndex* index, FILE* inStream, FILE* outStream)
+{
+    char* line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &lineSize, inStream)) > 0) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+
+        char* args = strchr(line, ' ');
+        if (args != NULL) {
+            *args++ = '\0';
+        }
+        else {
+            args = line + length;
+        }
+
+        DateTime first;
+        DateTime last;
+
+        if (strcmp(line, "CONTAINS") == 0) {
+            if (!ServerParseDate(&args, &first)) {
+                fputs("ERR invalid date\n", outStream);
+            }
+            else {
+                fputs(RangeIndexContains(index, &first) ? "YES\n" : "NO\n", outStream);
+            }
+        }
+        else if (strcmp(line, "COUNT") == 0) {
+            if (*args == '\0') {
+                fprintf(outStream, "%zu\n", index->count);
+            }
+            else if (!ServerParseDate(&args, &first) || !ServerParseDate(&args, &last)) {
+                fputs("ERR invalid date\n", outStream);
+            }
+            else {
+                fprintf(outStream, "%zu\n", RangeIndexCount(index, &first, &last));
+            }
+        }
+        else if (strcmp(line, "RANGE") == 0) {
+            if (!ServerParseDate(&args, &first) || !ServerParseDate(&args, &last)) {
+                fputs("ERR invalid date\n", outStream);
+            }
+            else {
+                RangeIndexForEachInRange(index, &first, &last, RangeQueryVisitor, outStream);
+                fputs("END\n", outStream);
+            }
+        }
+        else {
+            fputs("ERR unknown request\n", outStream);
+        }
+    }
+
+    free(line);
+    return !ferror(inStream) && fflush(outStream) == 0 && !ferror(outStream);
+}
+
+bool TestRangeIndex()
+{
+    char indexPath[] = "/tmp/distinct-dates-rangeXXXXXX";
+    int fd = mkstemp(indexPath);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+
+    // Enough one second apart for four levels of 125, 16, 2 and 1 nodes, each date given twice
+    const size_t numDistinct = 1000;
+    DateTime* dates = malloc(2 * numDistinct * sizeof(DateTime));
+    bool success = dates != NULL;
+    for (size_t i = 0; success && i < numDistinct; i++) {
+        PopulateDateTimeFromIsoString("2085-09-28T20:00:00Z", &dates[i]);
+        dates[i].minute = (unsigned int)(i / 60);
+        dates[i].second = (unsigned int)(i % 60);
+        dates[2 * numDistinct - 1 - i] = dates[i];
+    }
+
+    success = success && SaveRangeIndex(indexPath, dates, 2 * numDistinct);
+
+    RangeIndex index = { 0 };
+    FILE* indexFile = success ? fopen(indexPath, "rb") : NULL;
+    success = indexFile != NULL && MapRangeIndex(indexFile, &index, true)
+        && index.count == numDistinct && index.levelCount == 4;
+
+    // Every position is found from its own key, and from just after the key before it
+    for (size_t i = 0; success && i < numDistinct; i++) {
+        const uint64_t packed = PackDateTime(&dates[i]);
+        success = RangeIndexLowerBound(&index, packed) == i
+            && (i == 0 || RangeIndexLowerBound(&index, PackDateTime(&dates[i - 1]) + 1) == i)
+            && RangeIndexContains(&index, &dates[i]);
+    }
+
+    DateTime first;
+    DateTime last;
+    PopulateDateTimeFromIsoString("2085-09-28T20:00:00Z", &first);
+    PopulateDateTimeFromIsoString("2085-09-28T20:16:39Z", &last);
+    success = success && RangeIndexCount(&index, &first, &last) == numDistinct
+        && RangeIndexCount(&index, &last, &first) == 0
+        && RangeIndexLowerBound(&index, PackDateTime(&last) + 1) == numDistinct;
+
+    FILE* queries = tmpfile();
+    FILE* replies = tmpfile();
+    const char* requests =
+        "CONTAINS 2085-09-28T20:01:01Z\n"
+        "CONTAINS 2085-09-28T20:16:40Z\n"
+        "COUNT\n"
+        "COUNT 2085-09-28T20:01:00Z 2085-09-28T20:01:59Z\n"
+        "COUNT 1999-01-01T00:00:00Z 2085-09-28T20:00:02Z\r\n"
+        "RANGE 2085-09-28T20:16:38Z 3000-01-01T00:00:00Z\n"
+        "RANGE 1999-01-01T00:00:00Z 2000-01-01T00:00:00Z\n"
+        "CONTAINS tomorrow\n"
+        "FROB\n";
+    const char* expected =
+        "YES\nNO\n"
+        "1000\n60\n3\n"
+        "2085-09-28T20:16:38Z\n2085-09-28T20:16:39Z\nEND\n"
+        "END\n"
+        "ERR invalid date\nERR unknown request\n";
+
+    char output[512] = { 0 };
+    success = success && queries && replies && fputs(requests, queries) >= 0 && fseek(queries, 0, SEEK_SET) == 0
+        && RunRangeQueries(&index, queries, replies)
+        && pread(fileno(replies), output, sizeof(output) - 1, 0) >= 0
+        && strcmp(output, expected) == 0;
+    printf("%s", output);
+
+    if (queries) {
+        fclose(queries);
+    }
+    if (replies) {
+        fclose(replies);
+    }
+    UnmapRangeIndex(&index);
+    if (indexFile) {
+        fclose(indexFile);
+    }
+
+    // An empty index answers everything with nothing
+    success = success && SaveRangeIndex(indexPath, dates, 0);
+    indexFile = success ? fopen(indexPath, "rb") : NULL;
+    success = indexFile != NULL && MapRangeIndex(indexFile, &index, true) && index.count == 0
+        && !RangeIndexContains(&index, &first) && RangeIndexCount(&index, &first, &last) == 0;
+    UnmapRangeIndex(&index);
+    if (indexFile) {
+        fclose(indexFile);
+    }
+
+    free(dates);
+    remove(indexPath);
+    return success;
+}
+
+// Synthetic input for benchmarking: lines of ISO 8601 date strings with a controlled mix of
+// duplicates, years, time zone offsets, presortedness and malformed lines.
+#define GENERATOR_DUPLICATE_WINDOW 4096
+
+typedef struct generatorOptions {
+    size_t lineCount;           // Number of lines to generate
+    double duplicateRatio;      // Fraction of lines repeating one of the recent lines
+    unsigned int firstYear;     // Dates fall in [firstYear, firstYear + yearSpread)
+    unsigned int yearSpread;
+    double offsetRatio;         // Fraction of dates given a +hh:mm or -hh:mm offset rather than Z
+    double sortedRatio;         // Fraction of dates that follow on in ascending order from the last
+    double malformedRatio;      // Fraction of lines corrupted so that they fail to parse
+    uint64_t seed;
+} GeneratorOptions;
+
+// Returns the next value of the splitmix64 generator with the given state.
+uint64_t NextRandom(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Returns a random value in [0, 1) from the generator with the given state.
+double NextRandomRatio(uint64_t* state)
+{
+    return (double)(NextRandom(state) >> 11) / (double)(1ull << 53);
+}
+
+// Moves the given DateTime forward by the given number of seconds, following the calendar.
+// Years past lastYear wrap around to firstYear.
+void AdvanceDateTime(DateTime* dateTime, unsigned int seconds, unsigned int firstYear, unsigned int lastYear)
+{
+    unsigned int total = dateTime->second + seconds;
+    dateTime->second = total % 60;
+    total = dateTime->minute + total / 60;
+    dateTime->minute = total % 60;
+    total = dateTime->hour + total / 60;
+    dateTime->hour = total % 24;
+
+    for (unsigned int days = total / 24; days > 0; days--) {
+        if (++dateTime->day > DaysInMonth(dateTime->year, dateTime->month)) {
+            dateTime->day = 1;
+            if (++dateTime->month > 12) {
+                dateTime->month = 1;
+                dateTime->year = (dateTime->year >= lastYear) ? firstYear : dateTime->year + 1;
+            }
+        }
+    }
+}
+
+// Writes the given number of lines of synthetic ISO 8601 date strings, per the given options,
+// to the given stream. If outMalformed is given it receives the number of malformed lines.
+// Returns true if successful.
+bool GenerateDateTimes(FILE* stream, const GeneratorOptions* options, size_t* outMalformed)
+{
+    if (!stream || !options || options->yearSpread == 0 || options->firstYear + options->yearSpread > 10000) {
+        return false;
+    }
+
+    // Recently generated lines, from which duplicates are drawn
+    char (*window)[ISO_LINE_LEN + 8] = calloc(GENERATOR_DUPLICATE_WINDOW, sizeof(*window));
+    size_t* windowLengths = calloc(GENERATOR_DUPLICATE_WINDOW, sizeof(size_t));
+    if (window == NULL || windowLengths == NULL) {
+        free(window);
+        free(windowLengths);
+        return false;
+    }
+
+    const unsigned int lastYear = options->firstYear + options->yearSpread - 1;
+    uint64_t state = options->seed;
+    size_t windowCount = 0;
+    size_t malformed = 0;
+    DateTime sorted = { .year = options->firstYear, .month = 1, .day = 1 };
+
+    for (size_t i = 0; i < options->lineCount; i++) {
+        char line[ISO_LINE_LEN + 8];
+        size_t length = ISO_LINE_LEN;
+
+        if (windowCount > 0 && NextRandomRatio(&state) < options->duplicateRatio) {
+            size_t index = NextRandom(&state) % windowCount;
+            length = windowLengths[index];
+            memcpy(line, window[index], length);
+        }
+        else {
+            DateTime dateTime;
+            if (NextRandomRatio(&state) < options->sortedRatio) {
+                AdvanceDateTime(&sorted, (unsigned int)(NextRandom(&state) % 120), options->firstYear, lastYear);
+                dateTime = sorted;
+            }
+            else {
+                dateTime.year = options->firstYear + (unsigned int)(NextRandom(&state) % options->yearSpread);
+                dateTime.month = 1 + (unsigned int)(NextRandom(&state) % 12);
+                dateTime.day = 1 + (unsigned int)(NextRandom(&state) % DaysInMonth(dateTime.year, dateTime.month));
+                dateTime.hour = (unsigned int)(NextRandom(&state) % 24);
+                dateTime.minute = (unsigned int)(NextRandom(&state) % 60);
+                dateTime.second = (unsigned int)(NextRandom(&state) % 60);
+            }
+
+            FormatDateTime(line, &dateTime);
+
+            if (NextRandomRatio(&state) < options->offsetRatio) {
+                uint64_t offset = NextRandom(&state);
+                line[ISO_GMT_LEN - 1] = (offset & 1) ? '+' : '-';
+                memcpy(&line[ISO_GMT_LEN], &TwoDigits[((offset >> 1) % 24) * 2], 2);
+                line[ISO_GMT_LEN + 2] = ':';
+                memcpy(&line[ISO_GMT_LEN + 3], &TwoDigits[((offset >> 8) % 60) * 2], 2);
+                line[ISO_GMT_LEN + 5] = '\n';
+                length = ISO_GMT_LEN + 6;
+            }
+
+            if (NextRandomRatio(&state) < options->malformedRatio) {
+                line[NextRandom(&state) % (length - 1)] = 'x';
+                malformed++;
+            }
+            else {
+                // Only well formed lines are duplicated, so the malformed ratio holds
+                size_t index = (windowCount < GENERATOR_DUPLICATE_WINDOW) ? windowCount++ : NextRandom(&state) % GENERATOR_DUPLICATE_WINDOW;
+                memcpy(window[index], line, length);
+                windowLengths[index] = length;
+            }
+        }
+
+        if (fwrite(line, 1, length, stream) != length) {
+            free(window);
+            free(windowLengths);
+            return false;
+        }
+    }
+
+    free(window);
+    free(windowLengths);
+
+    if (outMalformed) {
+        *outMalformed = malformed;
+    }
+
+    return fflush(stream) == 0;
+}
+
+bool TestGenerateDateTimes()
+{
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        return false;
+    }
+
+    GeneratorOptions options = {
+        .lineCount = 10000,
+        .duplicateRatio = 0.5,
+        .firstYear = 2020,
+        .yearSpread = 2,
+        .offsetRatio = 0.3,
+        .sortedRatio = 0.5,
+        .malformedRatio = 0.1,
+        .seed = 42,
+    };
+
+    size_t malformed = 0;
+    if (!GenerateDateTimes(file, &options, &malformed)) {
+        fclose(file);
+        return false;
+    }
+
+    DateTime* dates = NULL;
+    size_t datesSize = 0;
+    size_t numDates = 0;
+    bool success = IngestDateTimesMapped(&dates, &datesSize, file, &numDates);
+    fclose(file);
+
+    size_t* distinctKeys = malloc(numDates * sizeof(size_t));
+    size_t numDistinctKeys = 0;
+    success = success && distinctKeys && DistinctDateTimes(dates, numDates, distinctKeys, &numDistinctKeys);
+    printf("%zu lines, %zu malformed, %zu distinct\n", options.lineCount, malformed, numDistinctKeys);
+
+    // Every well formed line parses, and about half of them are duplicates
+    success = success
+        && numDates == options.lineCount - malformed
+        && malformed > 0
+        && numDistinctKeys < numDates * 2 / 3;
+
+    free(distinctKeys);
+    free(dates);
+    return success;
+}
+
+// Algorithms available for finding distinct DateTimes
+typedef enum distinctEngine {
+    DISTINCT_ENGINE_SORT,   // Sort, then scan for unique entries; output is ascending
+    DISTINCT_ENGINE_HASH,   // Hash set; output keeps the input order of first occurrences
+    DISTINCT_ENGINE_BITMAP, // Two-level bitmap of seconds; output is ascending
+    DISTINCT_ENGINE_EXTERNAL,   // Sorted runs within memoryBudget spilled to disk, then merged; output is ascending
+    DISTINCT_ENGINE_HLL,    // HyperLogLog sketch; output is an estimated count, not the DateTimes
+    DISTINCT_ENGINE_MERGE,  // Loser-tree merge of the input files, sorting only unsorted ones; output is ascending
+} DistinctEngine;
+
+// Returns the end of chunk i of chunkCount chunks of the given mapped file, where the chunk
+// starts at begin, the end of the chunk before it. Each chunk ends just past the first newline
+// at or after its share of the file, so chunks hold whole lines.
+const char* LineChunkEnd(const char* mapping, size_t fileSize, size_t chunkCount, size_t i, const char* begin)
+{
+    const char* end = mapping + fileSize;
+    const char* split = mapping + (fileSize / chunkCount) * (i + 1);
+
+    if (i + 1 == chunkCount || split >= end) {
+        return end;
+    }
+    if (split <= begin) {
+        return begin;
+    }
+
+    const char* newline = memchr(split, '\n', (size_t)(end - split));
+    return newline ? newline + 1 : end;
+}
+
+// A range of whole lines of a mapped input file, parsed by one thread of
+// IngestDateTimesParallel into its own DateTime buffer
+typedef struct parseChunk {
+    const char* begin;
+    const char* end;
+    DateTime* dateTimes;
+    size_t size;            // Size of dateTimes in bytes
+    size_t count;           // Number of valid DateTimes parsed
+} ParseChunk;
+
+void* ParseChunkThread(void* arg)
+{
+    ParseChunk* chunk = (ParseChunk*)arg;
+    chunk->count = ParseDateTimeLines(chunk->begin, chunk->end, &chunk->dateTimes, &chunk->size, 0, true);
+    return NULL;
+}
+
+// Reads the given file containing ISO 8601 format date strings on each line into a DateTime
+// buffer, the same as IngestDateTimesMapped, but splits the mapped file into threadCount ranges
+// at line boundaries and parses each range on its own thread. Each range parses straight into
+// its own slot of the buffer, which is then closed up in file order, so the result is
+// identical to a single-threaded ingest.
+//
+// The slots need room for DateTimeCountBound(fileSize) + threadCount - 1 DateTimes. A buffer
+// allocated here is grown with realloc before parsing. One supplied by the caller never is;
+// as with IngestDateTimesMapped, lines past those its slots are sure to hold are left unread.
+// Sets outCount and fails the same way as IngestDateTimesMapped.
+bool IngestDateTimesParallel(DateTime** dateTimeBuff, size_t* n, FILE* stream, size_t threadCount, size_t* outCount)
+{
+    *outCount = 0;
+    if (!dateTimeBuff || !n || !stream || threadCount == 0) {
+        return false;
+    }
+    const bool callerBuffer = *dateTimeBuff != NULL;
+
+    // If caller didn't allocate dateTimeBuff (and no size is provided) we can allocate it
+    if (*dateTimeBuff == NULL) {
+        if (*n == 0) {
+            *dateTimeBuff = (DateTime*)calloc(1, sizeof(DateTime));
+            if (*dateTimeBuff == NULL) {
+                return false;
+            }
+            *n = sizeof(DateTime);
+        }
+        else { // If user provided a non-zero size but no dateTimeBuff, then fail
+            return false;
+        }
+    }
+
+    size_t fileSize = 0;
+    const char* mapping = MapInputFile(stream, &fileSize);
+    if (mapping == NULL) {
+        return IsEmptyRegularFile(stream);
+    }
+
+    ParseChunk* chunks = calloc(threadCount, sizeof(ParseChunk));
+    if (chunks == NULL) {
+        munmap((void*)mapping, fileSize);
+        return false;
+    }
+
+    size_t inputSize = fileSize;
+    if (callerBuffer) {
+        const size_t capacity = *n / sizeof(DateTime);
+        inputSize = FittingInputSize(mapping, fileSize, capacity >= threadCount ? capacity - (threadCount - 1) : 0);
+    }
+
+    // Each slot holds as many DateTimes as its range can, so no thread ever grows its slot
+    size_t slotCount = 0;
+    for (size_t i = 0; i < threadCount; i++) {
+        const char* begin = (i == 0) ? mapping : chunks[i - 1].end;
+        const char* split = LineChunkEnd(mapping, inputSize, threadCount, i, begin);
+
+        chunks[i].begin = begin;
+        chunks[i].end = split;
+        chunks[i].size = DateTimeCountBound((size_t)(split - begin)) * sizeof(DateTime);
+        slotCount += DateTimeCountBound((size_t)(split - begin));
+    }
+
+    if (*n < slotCount * sizeof(DateTime)) {
+        DateTime* grown = (DateTime*)realloc(*dateTimeBuff, slotCount * sizeof(DateTime));
+        if (grown == NULL) {
+            free(chunks);
+            munmap((void*)mapping, fileSize);
+            return false;
+        }
+        *dateTimeBuff = grown;
+        *n = slotCount * sizeof(DateTime);
+    }
+
+    DateTime* slot = *dateTimeBuff;
+    for (size_t i = 0; i < threadCount; i++) {
+        chunks[i].dateTimes = slot;
+        slot += chunks[i].size / sizeof(DateTime);
+    }
+
+    RunOnThreads(ParseChunkThread, chunks, sizeof(ParseChunk), threadCount);
+
+    // Slots only ever move towards the front, so each can be moved over the gap before it
+    size_t validDateTimes = 0;
+    for (size_t i = 0; i < threadCount; i++) {
+        memmove(&(*dateTimeBuff)[validDateTimes], chunks[i].dateTimes, chunks[i].count * sizeof(DateTime));
+        validDateTimes += chunks[i].count;
+    }
+
+    free(chunks);
+    munmap((void*)mapping, fileSize);
+
+    *outCount = validDateTimes;
+    return true;
+}
+
+bool TestIngestDateTimesParallel()
+{
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        return false;
+    }
+
+    // Lines of varying length, so chunk boundaries land mid-line
+    for (unsigned int i = 0; i < 1000; i++) {
+        if (i % 7 == 0) {
+            fprintf(file, "Not a date %u\n", i);
+        }
+        else if (i % 3 == 0) {
+            fprintf(file, "2085-%02u-%02uT08:03:29+12:30\n", i % 12 + 1, i % 28 + 1);
+        }
+        else {
+            fprintf(file, "%04u-09-28T20:33:%02uZ\n", i, i % 60);
+        }
+    }
+    fputs("2085-09-28T20:33:29Z", file);
+    fflush(file);
+
+    DateTime* expected = NULL;
+    size_t expectedSize = 0;
+    size_t numExpected = 0;
+    bool success = IngestDateTimesMapped(&expected, &expectedSize, file, &numExpected) && numExpected > 0;
+
+    // More threads than lines leaves some chunks empty
+    const size_t threadCounts[] = { 1, 2, 3, 8, 2000 };
+    for (size_t t = 0; success && t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++) {
+        DateTime* dates = NULL;
+        size_t datesSize = 0;
+        size_t numDates = 0;
+        success = IngestDateTimesParallel(&dates, &datesSize, file, threadCounts[t], &numDates);
+        printf("%zu threads: %zu dates\n", threadCounts[t], numDates);
+
+        success = success && numDates == numExpected;
+        for (size_t i = 0; success && i < numDates; i++) {
+            success = DateTimesEqual(&dates[i], &expected[i]);
+        }
+
+        free(dates);
+    }
+
+    // A buffer of exactly the documented size, which can't be reallocated, is parsed into in place
+    const size_t fileSize = (size_t)ftell(file);
+    for (size_t t = 0; success && t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++) {
+        const size_t bound = DateTimeCountBound(fileSize) + threadCounts[t] - 1;
+        Arena arena;
+        success = ArenaInit(&arena, bound * sizeof(DateTime), false);
+
+        DateTime* slots = ArenaAlloc(&arena, bound * sizeof(DateTime));
+        DateTime* dates = slots;
+        size_t datesSize = bound * sizeof(DateTime);
+        size_t numDates = 0;
+        success = success && IngestDateTimesParallel(&dates, &datesSize, file, threadCounts[t], &numDates)
+            && numDates == numExpected && dates == slots;
+        for (size_t i = 0; success && i < numExpected; i++) {
+            success = DateTimesEqual(&dates[i], &expected[i]);
+        }
+
+        ArenaFree(&arena);
+    }
+
+    free(expected);
+    fclose(file);
+
+    return success;
+}
+
+// Streaming finds the distinct DateTimes of input that can't be mapped or read twice, such as
+// a pipe, in a fixed amount of memory besides the set of distinct DateTimes itself. A reader
+// thread fills batches with whole lines, parser threads turn each batch's lines into DateTimes
+// and the calling thread adds them to a DateTimeBitmap, writing each DateTime new to the set
+// as soon as it is found for input order output, or the whole set at the end for ascending
+// output.
+//
+// Stages hand batches to each other through single-producer, single-consumer rings. A fixed
+// pool of batches circulates from the reader, round robin through the parsers, to the writer
+// and back to the reader, so a slow stage stalls the stages before it instead of letting
+// buffers grow. The writer takes batches from the parsers in the same round robin order the
+// reader gave them out in, which keeps them in input order.
+#define STREAM_BATCH_BYTES ((size_t)256 * 1024)
+#define STREAM_BATCHES_PER_PARSER 4
+#define SPIN_WAIT_YIELDS 64                 // Yields before a waiting stage starts sleeping
+#define SPIN_WAIT_SLEEP_NANOSECONDS 100000
+
+// A lock-free queue of pointers from one producer thread to one consumer thread. The indices
+// only ever increase, and are kept on separate cache lines so that the two threads don't
+// contend for one.
+typedef struct spscRing {
+    void** slots;           // capacity entries
+    size_t capacity;        // A power of two
+    char padding[64 - sizeof(void**) - sizeof(size_t)];
+    atomic_size_t head;     // Next slot to pop, written only by the consumer
+    char headPadding[64 - sizeof(atomic_size_t)];
+    atomic_size_t tail;     // Next slot to push, written only by the producer
+} SpscRing;
+
+// Initializes the given ring to hold at least minCapacity entries. Returns true if successful.
+bool SpscRingInit(SpscRing* ring, size_t minCapacity)
+{
+    size_t capacity = 1;
+    while (capacity < minCapacity) {
+        capacity *= 2;
+    }
+
+    ring->slots = calloc(capacity, sizeof(void*));
+    ring->capacity = capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    return ring->slots != NULL;
+}
+
+void SpscRingFree(SpscRing* ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+// Adds the given item to the given ring. Only the producer may call this.
+// Returns false if the ring is full.
+bool SpscRingTryPush(SpscRing* ring, void* item)
+{
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == ring->capacity) {
+        return false;
+    }
+
+    ring->slots[tail & (ring->capacity - 1)] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);  // Publishes the slot
+    return true;
+}
+
+// Removes the oldest item from the given ring into outItem. Only the consumer may call this.
+// Returns false if the ring is empty.
+bool SpscRingTryPop(SpscRing* ring, void** outItem)
+{
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+        return false;
+    }
+
+    *outItem = ring->slots[head & (ring->capacity - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);  // Frees the slot
+    return true;
+}
+
+// Backs off from a full or empty ring: yielding at first, then sleeping, so that a stage
+// waiting on a slow one doesn't keep a core busy
+void SpinWait(unsigned int* attempts)
+{
+    if (*attempts < SPIN_WAIT_YIELDS) {
+        (*attempts)++;
+        sched_yield();
+    }
+    else {
+        nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = SPIN_WAIT_SLEEP_NANOSECONDS }, NULL);
+    }
+}
+
+// Adds the given item to the given ring, waiting while it is full
+void SpscRingPush(SpscRing* ring, void* item)
+{
+    unsigned int attempts = 0;
+    while (!SpscRingTryPush(ring, item)) {
+        SpinWait(&attempts);
+    }
+}
+
+// Removes and returns the oldest item from the given ring, waiting while it is empty
+void* SpscRingPop(SpscRing* ring)
+{
+    void* item = NULL;
+    unsigned int attempts = 0;
+    while (!SpscRingTryPop(ring, &item)) {
+        SpinWait(&attempts);
+    }
+
+    return item;
+}
+
+typedef struct spscRingTestProducer {
+    SpscRing* ring;
+    size_t count;
+} SpscRingTestProducer;
+
+void* SpscRingTestProducerThread(void* arg)
+{
+    SpscRingTestProducer* producer = (SpscRingTestProducer*)arg;
+    for (size_t i = 1; i <= producer->count; i++) {
+        SpscRingPush(producer->ring, (void*)i);
+    }
+
+    return NULL;
+}
+
+bool TestSpscRing()
+{
+    // A small ring wraps around many times and is often full and often empty
+    SpscRing ring;
+    if (!SpscRingInit(&ring, 3)) {
+        return false;
+    }
+
+    bool success = ring.capacity == 4;
+
+    SpscRingTestProducer producer = { .ring = &ring, .count = 100000 };
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, SpscRingTestProducerThread, &producer) != 0) {
+        SpscRingFree(&ring);
+        return false;
+    }
+
+    // Every item arrives, once and in order
+    for (size_t i = 1; i <= producer.count; i++) {
+        success = ((size_t)SpscRingPop(&ring) == i) && success;
+    }
+    pthread_join(thread, NULL);
+
+    void* item = NULL;
+    success = success && !SpscRingTryPop(&ring, &item);
+
+    SpscRingFree(&ring);
+    return success;
+}
+
+// Whole lines of input, and the DateTimes parsed from them
+typedef struct lineBatch {
+    char* text;             // STREAM_BATCH_BYTES bytes
+    const char* lines;      // The whole lines in text
+    size_t length;          // Bytes of lines
+    DateTime* dateTimes;    // Room for every DateTime text can hold
+    size_t dateTimesSize;   // Bytes of dateTimes
+    size_t count;           // DateTimes parsed from lines
+} LineBatch;
+
+// State shared by the stages of StreamDistinctDateTimes
+typedef struct streamPipeline {
+    int fd;                     // Input
+    Granularity granularity;
+    size_t parserCount;
+    SpscRing freeBatches;       // Writer to reader: batches ready to be refilled
+    SpscRing* parseQueues;      // Reader to each parser: batches of lines, then NULL
+    SpscRing* writeQueues;      // Each parser to the writer: parsed batches, then NULL
+    atomic_bool failed;         // Set by any stage that fails, to stop the reader early
+} StreamPipeline;
+
+// One parser of a StreamPipeline
+typedef struct streamParser {
+    StreamPipeline* pipeline;
+    size_t index;               // Of the parser's queues
+} StreamParser;
+
+// Returns true if the given file descriptor can be read without waiting
+bool InputReady(int fd)
+{
+    struct pollfd pollFd = { .fd = fd, .events = POLLIN };
+    return poll(&pollFd, 1, 0) > 0;
+}
+
+// Reader stage: fills free batches with whole lines of input, handing them to the parsers in
+// turn, then ends every parser's queue with NULL
+void* StreamReaderThread(void* arg)
+{
+    StreamPipeline* pipeline = (StreamPipeline*)arg;
+
+    // The partial line at the end of a read is moved here, out of the batch sent on without it
+    char* carry = malloc(STREAM_BATCH_BYTES);
+    size_t carryLength = 0;
+    bool discarding = false;    // Skipping the rest of a line longer than a batch
+    bool atEnd = carry == NULL;
+    size_t parser = 0;          // Given the next batch
+
+    if (carry == NULL) {
+        atomic_store(&pipeline->failed, true);
+    }
+
+    while (!atEnd && !atomic_load_explicit(&pipeline->failed, memory_order_relaxed)) {
+        LineBatch* batch = (LineBatch*)SpscRingPop(&pipeline->freeBatches);
+        memcpy(batch->text, carry, carryLength);
+        size_t filled = carryLength;
+
+        // Keep reading while more input is ready, so that batches are large when input is
+        // plentiful but lines that trickle in are still passed on as they arrive
+        do {
+            const ssize_t bytesRead = read(pipeline->fd, batch->text + filled, STREAM_BATCH_BYTES - filled);
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead <= 0) {
+                if (bytesRead < 0) {
+                    atomic_store(&pipeline->failed, true);
+                }
+                atEnd = true;
+                break;
+            }
+            filled += (size_t)bytesRead;
+        } while (filled < STREAM_BATCH_BYTES && InputReady(pipeline->fd));
+
+        size_t skipped = 0;
+        if (discarding) {
+            const char* newline = memchr(batch->text, '\n', filled);
+            skipped = newline ? (size_t)(newline + 1 - batch->text) : filled;
+            discarding = newline == NULL;
+        }
+
+        batch->lines = batch->text + skipped;
+        batch->length = filled - skipped;
+        carryLength = 0;
+
+        if (!atEnd && batch->length > 0) {
+            const char* lastNewline = memrchr(batch->lines, '\n', batch->length);
+            if (lastNewline) {
+                carryLength = (size_t)(batch->lines + batch->length - (lastNewline + 1));
+            }
+            else if (filled == STREAM_BATCH_BYTES) {
+                // A line longer than a batch can't hold a valid date. Its start is passed on to
+                // be counted as rejected, and the rest is skipped.
+                discarding = true;
+            }
+            else {
+                carryLength = batch->length;
+            }
+
+            batch->length -= carryLength;
+            memcpy(carry, batch->lines + batch->length, carryLength);
+        }
+
+        SpscRingPush(&pipeline->parseQueues[parser], batch);
+        parser = (parser + 1) % pipeline->parserCount;
+    }
+
+    for (size_t i = 0; i < pipeline->parserCount; i++) {
+        SpscRingPush(&pipeline->parseQueues[i], NULL);
+    }
+
+    free(carry);
+    return NULL;
+}
+
+// Parser stage: parses each batch of lines from the parser's queue into DateTimes and passes
+// it on to the writer, until the queue ends
+void* StreamParserThread(void* arg)
+{
+    StreamParser* parser = (StreamParser*)arg;
+    StreamPipeline* pipeline = parser->pipeline;
+
+    for (;;) {
+        LineBatch* batch = (LineBatch*)SpscRingPop(&pipeline->parseQueues[parser->index]);
+        if (batch) {
+            uint64_t start = MonotonicNanoseconds();
+            batch->count = ParseDateTimeLines(batch->lines, batch->lines + batch->length, &batch->dateTimes, &batch->dateTimesSize, 0, true);
+            TruncateDateTimes(batch->dateTimes, batch->count, pipeline->granularity);
+            StatsAddStageTime(PIPELINE_STAGE_INGEST, start);
+        }
+
+        SpscRingPush(&pipeline->writeQueues[parser->index], batch);
+        if (batch == NULL) {
+            return NULL;
+        }
+    }
+}
+
+// Reads ISO 8601 date strings, one per line, from the given file descriptor until it ends and
+// writes the distinct DateTimes at the given granularity to the given stream, through a reader
+// thread, parserCount parser threads and the calling thread. With inputOrder, each DateTime is
+// written as soon as it is first seen, in the order of the input; otherwise all of them are
+// written in ascending order once the input ends. Returns true if successful.
+bool StreamDistinctDateTimes(int fd, FILE* stream, size_t parserCount, Granularity granularity, bool inputOrder)
+{
+    if (fd < 0 || !stream || parserCount == 0) {
+        return false;
+    }
+
+    StreamPipeline pipeline = {
+        .fd = fd,
+        .granularity = granularity,
+        .parserCount = parserCount,
+    };
+    atomic_init(&pipeline.failed, false);
+
+    // Every batch can be in any one queue at once, along with the NULL ending it
+    const size_t batchCount = parserCount * STREAM_BATCHES_PER_PARSER;
+    const size_t dateTimesBound = DateTimeCountBound(STREAM_BATCH_BYTES);
+    LineBatch* batches = calloc(batchCount, sizeof(LineBatch));  // calloc should initialize memory to 0
+    pipeline.parseQueues = calloc(parserCount, sizeof(SpscRing));
+    pipeline.writeQueues = calloc(parserCount, sizeof(SpscRing));
+    StreamParser* parsers = calloc(parserCount, sizeof(StreamParser));
+    ThreadStart* starts = calloc(parserCount + 1, sizeof(ThreadStart));
+    pthread_t* threads = calloc(parserCount + 1, sizeof(pthread_t));
+
+    bool success = batches && pipeline.parseQueues && pipeline.writeQueues && parsers && starts && threads
+        && SpscRingInit(&pipeline.freeBatches, batchCount);
+    for (size_t i = 0; success && i < parserCount; i++) {
+        success = SpscRingInit(&pipeline.parseQueues[i], batchCount + 1) && SpscRingInit(&pipeline.writeQueues[i], batchCount + 1);
+    }
+    for (size_t i = 0; success && i < batchCount; i++) {
+        batches[i].text = malloc(STREAM_BATCH_BYTES);
+        batches[i].dateTimesSize = dateTimesBound * sizeof(DateTime);
+        batches[i].dateTimes = malloc(batches[i].dateTimesSize);
+        success = batches[i].text && batches[i].dateTimes && SpscRingTryPush(&pipeline.freeBatches, &batches[i]);
+    }
+
+    DateTimeBitmap distinct;
+    DateTimeWriter writer;
+    success = success && DateTimeBitmapInit(&distinct);
+    if (success && !DateTimeWriterInit(&writer, stream)) {
+        DateTimeWriterFree(&writer);
+        DateTimeBitmapFree(&distinct);
+        success = false;
+    }
+
+    // The parsers are started first, so that the reader only hands batches to ones running
+    size_t threadCount = 0;
+    for (size_t i = 0; success && i < parserCount; i++) {
+        parsers[i] = (StreamParser){ .pipeline = &pipeline, .index = i };
+        starts[i] = (ThreadStart){ .func = StreamParserThread, .arg = &parsers[i] };
+        if (pthread_create(&threads[i], NULL, RunThreadStart, &starts[i]) != 0) {
+            break;
+        }
+        threadCount++;
+    }
+    pipeline.parserCount = threadCount;
+
+    bool readerStarted = false;
+    if (threadCount > 0) {
+        starts[threadCount] = (ThreadStart){ .func = StreamReaderThread, .arg = &pipeline };
+        readerStarted = pthread_create(&threads[threadCount], NULL, RunThreadStart, &starts[threadCount]) == 0;
+        if (!readerStarted) {
+            // End the parsers' queues in the reader's place
+            atomic_store(&pipeline.failed, true);
+            for (size_t i = 0; i < threadCount; i++) {
+                SpscRingPush(&pipeline.parseQueues[i], NULL);
+            }
+        }
+    }
+
+    // Writer stage, on this thread
+    size_t total = 0;
+    for (size_t parser = 0; threadCount > 0; parser = (parser + 1) % threadCount) {
+        LineBatch* batch = NULL;
+        if (!SpscRingTryPop(&pipeline.writeQueues[parser], (void**)&batch)) {
+            // Nothing is ready, so pass on what has been found so far before waiting
+            if (inputOrder) {
+                DateTimeWriterFlush(&writer);
+            }
+            batch = (LineBatch*)SpscRingPop(&pipeline.writeQueues[parser]);
+        }
+
+        if (batch == NULL) {
+            break;
+        }
+
+        uint64_t start = MonotonicNanoseconds();
+        bool added = true;
+        for (size_t i = 0; added && i < batch->count; i++) {
+            bool inserted = false;
+            added = DateTimeBitmapAdd(&distinct, &batch->dateTimes[i], &inserted);
+            if (inserted && inputOrder) {
+                DateTimeWriterPut(&writer, &batch->dateTimes[i]);
+            }
+        }
+        total += batch->count;
+        StatsAddStageTime(PIPELINE_STAGE_DEDUP, start);
+
+        if (!added) {
+            atomic_store(&pipeline.failed, true);
+        }
+        SpscRingPush(&pipeline.freeBatches, batch);
+    }
+
+    for (size_t i = 0; i < threadCount + (readerStarted ? 1 : 0); i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (success) {
+        StatsAdd(&ThreadPipelineStats()->duplicatesRemoved, total - distinct.count);
+
+        uint64_t start = MonotonicNanoseconds();
+        if (!inputOrder) {
+            DateTimeBitmapForEach(&distinct, DateTimeWriterVisitor, &writer);
+        }
+        success = DateTimeWriterFree(&writer) && readerStarted && !atomic_load(&pipeline.failed);
+        StatsAddStageTime(PIPELINE_STAGE_WRITE, start);
+
+        DateTimeBitmapFree(&distinct);
+    }
+
+    for (size_t i = 0; batches && i < batchCount; i++) {
+        free(batches[i].text);
+        free(batches[i].dateTimes);
+    }
+    for (size_t i = 0; i < parserCount && pipeline.parseQueues && pipeline.writeQueues; i++) {
+        SpscRingFree(&pipeline.parseQueues[i]);
+        SpscRingFree(&pipeline.writeQueues[i]);
+    }
+    SpscRingFree(&pipeline.freeBatches);
+    free(batches);
+    free(pipeline.parseQueues);
+    free(pipeline.writeQueues);
+    free(parsers);
+    free(starts);
+    free(threads);
+
+    return success;
+}
+
+bool TestStreamDistinctDateTimes()
+{
+    FILE* file = tmpfile();
+    FILE* expectedFile = tmpfile();
+    FILE* outFile = tmpfile();
+    if (file == NULL || expectedFile == NULL || outFile == NULL) {
+        return false;
+    }
+
+    // Several batches of lines with duplicates and rejects, with a line longer than a batch
+    // ending in a date that must not be found
+    for (unsigned int i = 0; i < 40000; i++) {
+        if (i % 11 == 0) {
+            fprintf(file, "Not a date %u\n", i);
+        }
+        else if (i % 3 == 0) {
+            fprintf(file, "2085-%02u-%02uT08:03:29+12:30\n", i % 12 + 1, i % 28 + 1);
+        }
+        else {
+            fprintf(file, "%04u-09-28T20:33:%02uZ\n", i % 5000, i % 60);
+        }
+
+        if (i == 20000) {
+            for (size_t j = 0; j < STREAM_BATCH_BYTES + 100; j++) {
+                fputc('x', file);
+            }
+            fputs("1234-05-06T07:08:09Z\n", file);
+        }
+    }
+    fputs("2085-09-28T20:33:29Z", file);
+    fflush(file);
+
+    DateTime* dates = NULL;
+    size_t datesSize = 0;
+    size_t numDates = 0;
+    bool success = IngestDateTimesMapped(&dates, &datesSize, file, &numDates) && numDates > 0;
+    for (int inputOrder = 1; success && inputOrder >= 0; inputOrder--) {
+        // The expected output, from the same bitmap without the pipeline
+        DateTimeBitmap distinct = { 0 };
+        DateTimeWriter writer = { .fd = -1 };
+        success = ftruncate(fileno(expectedFile), 0) == 0 && lseek(fileno(expectedFile), 0, SEEK_SET) == 0 && DateTimeBitmapInit(&distinct) && DateTimeWriterInit(&writer, expectedFile);
+        for (size_t i = 0; success && i < numDates; i++) {
+            bool inserted = false;
+            success = DateTimeBitmapAdd(&distinct, &dates[i], &inserted);
+            if (inserted && inputOrder) {
+                DateTimeWriterPut(&writer, &dates[i]);
+            }
+        }
+        if (!inputOrder) {
+            DateTimeBitmapForEach(&distinct, DateTimeWriterVisitor, &writer);
+        }
+        success = DateTimeWriterFree(&writer) && success;
+        const size_t expectedLength = distinct.count * ISO_LINE_LEN;
+        DateTimeBitmapFree(&distinct);
+
+        char* expected = malloc(expectedLength);
+        char* actual = malloc(expectedLength + 1);
+        success = success && expected && actual && pread(fileno(expectedFile), expected, expectedLength, 0) == (ssize_t)expectedLength;
+
+        const size_t parserCounts[] = { 1, 3 };
+        for (size_t p = 0; success && p < sizeof(parserCounts) / sizeof(parserCounts[0]); p++) {
+            success = lseek(fileno(file), 0, SEEK_SET) == 0 && ftruncate(fileno(outFile), 0) == 0 && lseek(fileno(outFile), 0, SEEK_SET) == 0
+                && StreamDistinctDateTimes(fileno(file), outFile, parserCounts[p], GRANULARITY_SECOND, inputOrder);
+
+            const ssize_t actualLength = pread(fileno(outFile), actual, expectedLength + 1, 0);
+            printf("%zu parsers, %s: %zd bytes\n", parserCounts[p], inputOrder ? "input order" : "ascending", actualLength);
+            success = success && actualLength == (ssize_t)expectedLength && memcmp(actual, expected, expectedLength) == 0;
+        }
+
+        free(expected);
+        free(actual);
+    }
+
+    free(dates);
+    fclose(outFile);
+    fclose(expectedFile);
+    fclose(file);
+
+    return success;
+}
+
+// Multi-file ingestion reads many files, such as a directory of hourly logs, keeping many
+// large reads in flight at once so that the storage queue stays full, rather than reading one
+// file after another. Reads go through io_uring into a ring of registered buffers, issued in
+// the order of the files and their chunks. Each buffer is handed to the parser, in the same
+// order, as soon as its read completes, and is then reused for a read further ahead. Where
+// io_uring isn't available, the same chunks are read with pread one at a time.
+//
+// Lines that span two chunks of a file are joined from a carry buffer, and each file's last
+// line ends with it even without a newline, so the DateTimes are exactly those of parsing each
+// file in turn.
+#define INGEST_BUFFER_BYTES ((size_t)512 * 1024)
+#define INGEST_BUFFER_COUNT 16      // Reads in flight, and registered memory of 8 MiB
+
+// A minimal io_uring, driven through its system calls directly
+typedef struct uring {
+    int fd;
+    void* sqRing;               // Submission ring, also the completion ring with IORING_FEAT_SINGLE_MMAP
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    atomic_uint* sqTail;        // Written by us, read by the kernel
+    unsigned int sqMask;
+    unsigned int* sqArray;
+    atomic_uint* cqHead;        // Written by us, read by the kernel
+    atomic_uint* cqTail;        // Written by the kernel
+    unsigned int cqMask;
+    struct io_uring_cqe* cqes;
+    unsigned int queued;        // Entries added since the last UringSubmit
+} Uring;
+
+void UringFree(Uring* ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    ring->fd = -1;
+}
+
+// Sets up the given ring with room for the given number of entries in flight.
+// Returns false if io_uring isn't available.
+bool UringInit(Uring* ring, unsigned int entries)
+{
+    memset(ring, 0, sizeof(Uring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return false;
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        ring->sqRingSize = ring->cqRingSize = (ring->sqRingSize > ring->cqRingSize) ? ring->sqRingSize : ring->cqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqRing = singleMap ? ring->sqRing
+        : mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        UringFree(ring);
+        return false;
+    }
+
+    char* sq = (char*)ring->sqRing;
+    ring->sqTail = (atomic_uint*)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned int*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned int*)(sq + params.sq_off.array);
+
+    char* cq = (char*)ring->cqRing;
+    ring->cqHead = (atomic_uint*)(cq + params.cq_off.head);
+    ring->cqTail = (atomic_uint*)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned int*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+// Queues a read of length bytes at the given offset of the given file into buffer, which is
+// the registered buffer bufferIndex or, if that is negative, any memory. The caller must not
+// queue more entries than the ring was set up for before they complete.
+void UringQueueRead(Uring* ring, int fd, void* buffer, size_t length, uint64_t offset, int bufferIndex, uint64_t userData)
+{
+    const unsigned int tail = atomic_load_explicit(ring->sqTail, memory_order_relaxed);
+    const unsigned int index = tail & ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = (bufferIndex >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = (uint32_t)length;
+    sqe->off = offset;
+    sqe->buf_index = (bufferIndex >= 0) ? (uint16_t)bufferIndex : 0;
+    sqe->user_data = userData;
+
+    ring->sqArray[index] = index;
+    atomic_store_explicit(ring->sqTail, tail + 1, memory_order_release);  // Publishes the entry
+    ring->queued++;
+}
+
+// Submits the queued entries, then waits until at least minComplete entries have completed.
+// Returns true if successful.
+bool UringSubmit(Uring* ring, unsigned int minComplete)
+{
+    while (ring->queued > 0 || minComplete > 0) {
+        const long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued, minComplete,
+            minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        ring->queued -= (unsigned int)submitted;
+        minComplete = 0;
+    }
+
+    return true;
+}
+
+// Waits, without submitting anything queued, until at least one entry has completed.
+// Returns true if successful.
+bool UringWait(Uring* ring)
+{
+    while (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Removes the oldest completion from the given ring into outCompletion.
+// Returns false if no entry has completed.
+bool UringPopCompletion(Uring* ring, struct io_uring_cqe* outCompletion)
+{
+    const unsigned int head = atomic_load_explicit(ring->cqHead, memory_order_relaxed);
+    if (head == atomic_load_explicit(ring->cqTail, memory_order_acquire)) {
+        return false;
+    }
+
+    *outCompletion = ring->cqes[head & ring->cqMask];
+    atomic_store_explicit(ring->cqHead, head + 1, memory_order_release);  // Frees the entry
+    return true;
+}
+
+// A read of part of one input file
+typedef struct ingestChunk {
+    int fd;
+    uint64_t offset;            // Of the chunk in its file
+    size_t length;              // Bytes to read
+    size_t done;                // Bytes read so far
+    bool lastInFile;            // The file is closed once this chunk is parsed
+    bool complete;              // Every byte has been read, or the file ended early
+} IngestChunk;
+
+// Hands out the chunks of the input files, in order, opening each file as it is reached
+typedef struct chunkCursor {
+    const char* const* paths;
+    size_t pathCount;
+    size_t path;                // Next file to open, or the file being handed out when fd >= 0
+    int fd;
+    uint64_t size;              // Of the file being handed out
+    uint64_t offset;            // Of the next chunk in the file being handed out
+    bool failed;                // A file couldn't be opened
+} ChunkCursor;
+
+// Sets outChunk to the next chunk of the input files. Returns false once there are no more or
+// a file couldn't be opened. Empty files have no chunks.
+bool ChunkCursorNext(ChunkCursor* cursor, IngestChunk* outChunk)
+{
+    while (cursor->fd < 0) {
+        if (cursor->failed || cursor->path == cursor->pathCount) {
+            return false;
+        }
+
+        struct stat fileStat;
+        cursor->fd = open(cursor->paths[cursor->path], O_RDONLY | O_CLOEXEC);
+        if (cursor->fd < 0 || fstat(cursor->fd, &fileStat) != 0) {
+            cursor->failed = true;
+            if (cursor->fd >= 0) {
+                close(cursor->fd);
+                cursor->fd = -1;
+            }
+            return false;
+        }
+
+        cursor->size = (uint64_t)fileStat.st_size;
+        cursor->offset = 0;
+        if (cursor->size == 0) {
+            close(cursor->fd);
+            cursor->fd = -1;
+            cursor->path++;
+        }
+    }
+
+    const uint64_t remaining = cursor->size - cursor->offset;
+    *outChunk = (IngestChunk){
+        .fd = cursor->fd,
+        .offset = cursor->offset,
+        .length = remaining < INGEST_BUFFER_BYTES ? (size_t)remaining : INGEST_BUFFER_BYTES,
+    };
+    cursor->offset += outChunk->length;
+    outChunk->lastInFile = cursor->offset == cursor->size;
+
+    // The last chunk takes ownership of the file
+    if (outChunk->lastInFile) {
+        cursor->fd = -1;
+        cursor->path++;
+    }
+
+    return true;
+}
+
+// Parses chunks of files, given in order, into a DateTime buffer
+typedef struct chunkParser {
+    DateTime** dateTimeBuff;
+    size_t* n;
+    size_t count;               // DateTimes in the buffer
+    char* carry;                // The start of a line continued in the next chunk
+    size_t carryLength;
+    size_t carryCapacity;
+    bool failed;                // The carry couldn't grow
+} ChunkParser;
+
+// Appends [begin, end) to the given parser's carry
+void ChunkParserCarry(ChunkParser* parser, const char* begin, const char* end)
+{
+    const size_t length = (size_t)(end - begin);
+    if (parser->carryLength + length > parser->carryCapacity) {
+        size_t capacity = parser->carryCapacity ? parser->carryCapacity : MAX_ISO_DATE_LEN;
+        while (capacity < parser->carryLength + length) {
+            capacity *= 2;
+        }
+
+        char* carry = realloc(parser->carry, capacity);
+        if (carry == NULL) {
+            parser->failed = true;
+            return;
+        }
+        parser->carry = carry;
+        parser->carryCapacity = capacity;
+    }
+
+    memcpy(parser->carry + parser->carryLength, begin, length);
+    parser->carryLength += length;
+}
+
+// Parses the lines of the given chunk, the next of its file, completing the line carried from
+// the file's previous chunk and carrying the partial line at its end unless it ends the file
+void ChunkParserAdd(ChunkParser* parser, const char* data, size_t length, bool lastInFile)
+{
+    const char* begin = data;
+    const char* end = data + length;
+
+    if (parser->carryLength > 0) {
+        const char* newline = memchr(begin, '\n', length);
+        begin = newline ? newline + 1 : end;
+        ChunkParserCarry(parser, data, begin);
+
+        if (newline || lastInFile) {
+            parser->count = ParseDateTimeLines(parser->carry, parser->carry + parser->carryLength, parser->dateTimeBuff, parser->n, parser->count, true);
+            parser->carryLength = 0;
+        }
+    }
+
+    const char* parseEnd = end;
+    if (!lastInFile && begin < end) {
+        const char* lastNewline = memrchr(begin, '\n', (size_t)(end - begin));
+        parseEnd = lastNewline ? lastNewline + 1 : begin;
+        ChunkParserCarry(parser, parseEnd, end);
+    }
+
+    parser->count = ParseDateTimeLines(begin, parseEnd, parser->dateTimeBuff, parser->n, parser->count, true);
+}
+
+// Returns the sum of DateTimeCountBound for the current sizes of the given files, or 0 if
+// one of them can't be examined.
+size_t FilesDateTimeCountBound(const char* const* paths, size_t pathCount)
+{
+    size_t bound = 0;
+    for (size_t i = 0; i < pathCount; i++) {
+        struct stat fileStat;
+        if (stat(paths[i], &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+            return 0;
+        }
+        bound += DateTimeCountBound((size_t)fileStat.st_size);
+    }
+
+    return bound;
+}
+
+// Reads the given files of ISO 8601 date strings, one per line, into a DateTime buffer in the
+// order of the files and their lines, through io_uring if useUring is true and it's available
+// and with pread otherwise. See IngestDateTimes for the handling of dateTimeBuff and n.
+// Sets outCount to the number of DateTimes read. Returns false if a file couldn't be read.
+bool IngestDateTimesFiles(DateTime** dateTimeBuff, size_t* n, const char* const* paths, size_t pathCount, bool useUring, size_t* outCount)
+{
+    *outCount = 0;
+    if (!dateTimeBuff || !n || (!paths && pathCount > 0)) {
+        return false;
+    }
+
+    // If caller didn't allocate dateTimeBuff (and no size is provided) we can allocate it,
+    // with room for every DateTime the files hold so that it only grows if they do
+    if (*dateTimeBuff == NULL) {
+        if (*n == 0) {
+            const size_t bound = FilesDateTimeCountBound(paths, pathCount) + 1;
+            *n = bound * sizeof(DateTime);
+            *dateTimeBuff = (DateTime*)calloc(bound, sizeof(DateTime));
+        }
+        else { // If user provided a non-zero size but no dateTimeBuff, then fail
+            return false;
+        }
+    }
+
+    char* buffers = malloc(INGEST_BUFFER_COUNT * INGEST_BUFFER_BYTES);
+    if (*dateTimeBuff == NULL || buffers == NULL) {
+        free(buffers);
+        return false;
+    }
+
+    ChunkCursor cursor = { .paths = paths, .pathCount = pathCount, .fd = -1 };
+    ChunkParser parser = { .dateTimeBuff = dateTimeBuff, .n = n };
+    IngestChunk chunks[INGEST_BUFFER_COUNT];
+    bool success = true;
+    bool buffersBusy = false;   // The kernel may still write into the buffers
+
+    Uring ring;
+    if (useUring && UringInit(&ring, INGEST_BUFFER_COUNT)) {
+        // Registered buffers are mapped into the kernel once rather than on every read. Without
+        // them, perhaps for lack of locked memory, plain reads work the same.
+        struct iovec iovecs[INGEST_BUFFER_COUNT];
+        for (size_t i = 0; i < INGEST_BUFFER_COUNT; i++) {
+            iovecs[i] = (struct iovec){ .iov_base = buffers + i * INGEST_BUFFER_BYTES, .iov_len = INGEST_BUFFER_BYTES };
+        }
+        const bool registered = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iovecs, INGEST_BUFFER_COUNT) == 0;
+
+        // Chunk i goes in buffer i % INGEST_BUFFER_COUNT, so the buffers are parsed in turn
+        size_t issued = 0;
+        size_t parsed = 0;
+        size_t inFlight = 0;
+        for (;;) {
+            while (success && issued - parsed < INGEST_BUFFER_COUNT && ChunkCursorNext(&cursor, &chunks[issued % INGEST_BUFFER_COUNT])) {
+                const size_t slot = issued % INGEST_BUFFER_COUNT;
+                UringQueueRead(&ring, chunks[slot].fd, buffers + slot * INGEST_BUFFER_BYTES, chunks[slot].length, chunks[slot].offset,
+                    registered ? (int)slot : -1, slot);
+                issued++;
+                inFlight++;
+            }
+
+            // After a failure, reads in flight still finish before their buffers are freed
+            const bool ready = success && parsed < issued && chunks[parsed % INGEST_BUFFER_COUNT].complete;
+            if (inFlight == 0 && !ready) {
+                break;
+            }
+            if (!UringSubmit(&ring, ready ? 0 : 1)) {
+                success = false;
+                break;
+            }
+
+            struct io_uring_cqe completion;
+            while (UringPopCompletion(&ring, &completion)) {
+                const size_t slot = (size_t)completion.user_data;
+                IngestChunk* chunk = &chunks[slot];
+                inFlight--;
+
+                if (completion.res == -EINTR || completion.res == -EAGAIN) {
+                    completion.res = 0;
+                }
+                else if (completion.res < 0) {
+                    success = false;
+                    continue;
+                }
+                else if (completion.res == 0) {
+                    chunk->complete = true;     // The file was truncated while being read
+                    continue;
+                }
+
+                // A short read continues where it left off
+                chunk->done += (size_t)completion.res;
+                chunk->complete = chunk->done == chunk->length;
+                if (!chunk->complete && success) {
+                    UringQueueRead(&ring, chunk->fd, buffers + slot * INGEST_BUFFER_BYTES + chunk->done, chunk->length - chunk->done,
+                        chunk->offset + chunk->done, registered ? (int)slot : -1, slot);
+                    inFlight++;
+                }
+            }
+
+            while (success && parsed < issued && chunks[parsed % INGEST_BUFFER_COUNT].complete) {
+                const size_t slot = parsed % INGEST_BUFFER_COUNT;
+                ChunkParserAdd(&parser, buffers + slot * INGEST_BUFFER_BYTES, chunks[slot].done, chunks[slot].lastInFile);
+                if (chunks[slot].lastInFile) {
+                    close(chunks[slot].fd);
+                }
+                parsed++;
+            }
+        }
+
+        // Reads the kernel has taken must finish before their buffers are freed. Queued reads
+        // that were never submitted never run. If even waiting fails, the buffers are leaked
+        // rather than freed under the kernel.
+        while (inFlight > ring.queued) {
+            if (!UringWait(&ring)) {
+                buffersBusy = true;
+                break;
+            }
+
+            struct io_uring_cqe completion;
+            while (UringPopCompletion(&ring, &completion)) {
+                inFlight--;
+            }
+        }
+
+        // Files whose last chunk was read but never parsed
+        for (; parsed < issued; parsed++) {
+            if (chunks[parsed % INGEST_BUFFER_COUNT].lastInFile) {
+                close(chunks[parsed % INGEST_BUFFER_COUNT].fd);
+            }
+        }
+
+        UringFree(&ring);
+    }
+    else {
+        IngestChunk* chunk = &chunks[0];
+        while (success && ChunkCursorNext(&cursor, chunk)) {
+            while (chunk->done < chunk->length) {
+                const ssize_t bytesRead = pread(chunk->fd, buffers + chunk->done, chunk->length - chunk->done, (off_t)(chunk->offset + chunk->done));
+                if (bytesRead < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (bytesRead <= 0) {
+                    success = bytesRead == 0;
+                    break;
+                }
+                chunk->done += (size_t)bytesRead;
+            }
+
+            if (success) {
+                ChunkParserAdd(&parser, buffers, chunk->done, chunk->lastInFile);
+            }
+            if (chunk->lastInFile) {
+                close(chunk->fd);
+            }
+        }
+    }
+
+    if (cursor.fd >= 0) {
+        close(cursor.fd);
+    }
+    free(parser.carry);
+    if (!buffersBusy) {
+        free(buffers);
+    }
+
+    *outCount = parser.count;
+    return success && !cursor.failed && !parser.failed;
+}
+
+bool TestIngestDateTimesFiles()
+{
+    char directory[] = "/tmp/distinct-dates-test-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        return false;
+    }
+
+    // Empty files, files without a final newline, a file of only a partial line and files
+    // spanning several buffers, so that lines are split between reads
+    enum { fileCount = 40 };
+    char paths[fileCount][sizeof(directory) + 16];
+    const char* pathList[fileCount];
+    bool success = true;
+
+    for (unsigned int f = 0; success && f < fileCount; f++) {
+        snprintf(paths[f], sizeof(paths[f]), "%s/%02u.txt", directory, f);
+        pathList[f] = paths[f];
+
+        FILE* file = fopen(paths[f], "w");
+        if (file == NULL) {
+            success = false;
+            break;
+        }
+
+        const unsigned int lines = (f % 5 == 0) ? 0 : (f % 7 == 0) ? 60000 : f * 37;
+        for (unsigned int i = 0; i < lines; i++) {
+            if (i % 13 == 0) {
+                fprintf(file, "Not a date %u\n", i);
+            }
+            else if (i % 3 == 0) {
+                fprintf(file, "2085-%02u-%02uT08:03:29+12:30\n", i % 12 + 1, i % 28 + 1);
+            }
+            else {
+                fprintf(file, "%04u-%02u-28T20:33:%02uZ\n", (f * 100 + i) % 10000, f % 12 + 1, i % 60);
+            }
+        }
+        if (f % 3 == 0) {
+            fprintf(file, "%04u-09-28T20:33:29Z", f);
+        }
+        if (f == 11) {
+            fputs("2085-09-2", file);
+        }
+
+        success = fclose(file) == 0;
+    }
+
+    // Each file parsed in turn
+    DateTime* expected = NULL;
+    size_t numExpected = 0;
+    for (unsigned int f = 0; success && f < fileCount; f++) {
+        FILE* file = fopen(paths[f], "r");
+        success = file != NULL;
+        if (success) {
+            DateTime* dates = NULL;
+            size_t datesSize = 0;
+            size_t numDates = 0;
+            success = IngestDateTimesMapped(&dates, &datesSize, file, &numDates);
+            expected = realloc(expected, (numExpected + numDates + 1) * sizeof(DateTime));
+            memcpy(&expected[numExpected], dates, numDates * sizeof(DateTime));
+            numExpected += numDates;
+            free(dates);
+            fclose(file);
+        }
+    }
+
+    for (int useUring = 1; success && useUring >= 0; useUring--) {
+        DateTime* dates = NULL;
+        size_t datesSize = 0;
+        size_t numDates = 0;
+        success = IngestDateTimesFiles(&dates, &datesSize, pathList, fileCount, useUring, &numDates);
+        printf("%s: %zu dates, expected %zu\n", useUring ? "io_uring" : "pread", numDates, numExpected);
+
+        success = success && numDates == numExpected;
+        for (size_t i = 0; success && i < numDates; i++) {
+            success = DateTimesEqual(&dates[i], &expected[i]);
+        }
+        free(dates);
+    }
+
+    // A missing file fails the whole read
+    const char* missing[] = { paths[1], "/nonexistent/dates.txt" };
+    DateTime* dates = NULL;
+    size_t datesSize = 0;
+    size_t numDates = 0;
+    success = success && !IngestDateTimesFiles(&dates, &datesSize, missing, 2, true, &numDates)
+        && !IngestDateTimesFiles(&dates, &datesSize, missing, 2, false, &numDates);
+    free(dates);
+
+    free(expected);
+    for (unsigned int f = 0; f < fileCount; f++) {
+        unlink(paths[f]);
+    }
+    rmdir(directory);
+
+    return success;
+}
+
+// A HyperLogLog sketch estimates the number of distinct DateTimes in constant memory: each
+// packed key is hashed, the top precision bits of the hash pick one of 2^precision registers
+// and the register keeps the longest run of leading zeros seen in the remaining bits. The
+// standard error of the estimate is about 1.04 / sqrt(2^precision), 0.8% at the default
+// precision in 16 KiB of registers.
+//
+// Sketches of the same precision merge by taking the maximum of each register, so sketches
+// built on different threads, or from different files, can be unioned.
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+#define HLL_DEFAULT_PRECISION 14
+#define HLL_MAGIC "DDHLL"           // Eight bytes with the null terminator and padding
+#define HLL_VERSION 1
+
+typedef struct hyperLogLog {
+    unsigned int precision;     // [HLL_MIN_PRECISION, HLL_MAX_PRECISION]
+    uint8_t* registers;         // 2^precision registers
+} HyperLogLog;
+
+// Sketches are serialized as this header followed by the registers
+typedef struct hyperLogLogHeader {
+    char magic[8];              // HLL_MAGIC
+    uint32_t version;           // HLL_VERSION
+    uint32_t precision;
+} HyperLogLogHeader;
+
+// Initializes the given sketch to the empty set. Returns true if successful.
+bool HyperLogLogInit(HyperLogLog* sketch, unsigned int precision)
+{
+    if (!sketch || precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION) {
+        return false;
+    }
+
+    sketch->precision = precision;
+    sketch->registers = calloc((size_t)1 << precision, sizeof(uint8_t));  // calloc should initialize memory to 0
+    return sketch->registers != NULL;
+}
+
+void HyperLogLogFree(HyperLogLog* sketch)
+{
+    if (sketch) {
+        free(sketch->registers);
+        sketch->registers = NULL;
+    }
+}
+
+// Returns a hash of the given packed key whose bits are all well mixed, as HyperLogLog needs.
+// This is the finalizer of MurmurHash3.
+uint64_t MixPackedKey(uint64_t packed)
+{
+    packed ^= packed >> 33;
+    packed *= 0xFF51AFD7ED558CCDull;
+    packed ^= packed >> 33;
+    packed *= 0xC4CEB9FE1A85EC53ull;
+    packed ^= packed >> 33;
+    return packed;
+}
+
+// Adds the DateTime with the given packed key to the given sketch.
+void HyperLogLogAddPackedKey(HyperLogLog* sketch, uint64_t packed)
+{
+    const uint64_t hash = MixPackedKey(packed);
+    const size_t index = (size_t)(hash >> (64 - sketch->precision));
+
+    // A sentinel bit below the remaining bits bounds the rank when they are all zero
+    const uint64_t remaining = (hash << sketch->precision) | ((uint64_t)1 << (sketch->precision - 1));
+    const uint8_t rank = (uint8_t)(__builtin_clzll(remaining) + 1);
+
+    if (rank > sketch->registers[index]) {
+        sketch->registers[index] = rank;
+    }
+}
+
+// Adds the given DateTime, which is assumed to be valid, to the given sketch.
+void HyperLogLogAdd(HyperLogLog* sketch, const DateTime* dateTime)
+{
+    HyperLogLogAddPackedKey(sketch, PackDateTime(dateTime));
+}
+
+// Merges the source sketch into the destination sketch, leaving it a sketch of the union of
+// both sets. Returns false if the sketches have different precisions.
+bool HyperLogLogMerge(HyperLogLog* sketch, const HyperLogLog* source)
+{
+    if (!sketch || !source || sketch->precision != source->precision) {
+        return false;
+    }
+
+    for (size_t i = 0; i < (size_t)1 << sketch->precision; i++) {
+        if (source->registers[i] > sketch->registers[i]) {
+            sketch->registers[i] = source->registers[i];
+        }
+    }
+
+    return true;
+}
+
+// Returns the estimated number of distinct DateTimes added to the given sketch.
+double HyperLogLogEstimate(const HyperLogLog* sketch)
+{
+    const size_t registerCount = (size_t)1 << sketch->precision;
+    const double m = (double)registerCount;
+
+    double sum = 0.0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < registerCount; i++) {
+        sum += ldexp(1.0, -(int)sketch->registers[i]);
+        zeros += sketch->registers[i] == 0;
+    }
+
+    double alpha;
+    switch (registerCount) {
+    case 16: alpha = 0.673; break;
+    case 32: alpha = 0.697; break;
+    case 64: alpha = 0.709; break;
+    default: alpha = 0.7213 / (1.0 + 1.079 / m); break;
+    }
+
+    // Linear counting is more accurate while many registers are still empty. With 64-bit
+    // hashes no large range correction is needed.
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / (double)zeros);
+    }
+
+    return estimate;
+}
+
+// Writes the given sketch to the given file stream. Returns true if successful.
+bool WriteHyperLogLog(FILE* stream, const HyperLogLog* sketch)
+{
+    if (!stream || !sketch || !sketch->registers) {
+        return false;
+    }
+
+    HyperLogLogHeader header = { HLL_MAGIC, HLL_VERSION, sketch->precision };
+    const size_t registerCount = (size_t)1 << sketch->precision;
+
+    return fwrite(&header, sizeof(header), 1, stream) == 1
+        && fwrite(sketch->registers, sizeof(uint8_t), registerCount, stream) == registerCount
+        && fflush(stream) == 0;
+}
+
+// Initializes the given sketch from one written to the given file stream by WriteHyperLogLog.
+// Returns true if successful.
+bool ReadHyperLogLog(FILE* stream, HyperLogLog* sketch)
+{
+    HyperLogLogHeader header;
+    if (!stream || !sketch || fread(&header, sizeof(header), 1, stream) != 1
+        || memcmp(header.magic, HLL_MAGIC, sizeof(HLL_MAGIC)) != 0 || header.version != HLL_VERSION
+        || !HyperLogLogInit(sketch, header.precision)) {
+        return false;
+    }
+
+    const size_t registerCount = (size_t)1 << sketch->precision;
+    if (fread(sketch->registers, sizeof(uint8_t), registerCount, stream) != registerCount) {
+        HyperLogLogFree(sketch);
+        return false;
+    }
+
+    return true;
+}
+
+// Adds each valid ISO 8601 date string on the lines in [begin, end) to the given sketch,
+// counting lines in the calling thread's statistics.
+void SketchDateTimeLines(const char* begin, const char* end, HyperLogLog* sketch)
+{
+    LineCounter counter = { 0 };
+    DateTime dateTime;
+
+    const char* line = begin;
+    while (line < end) {
+        const char* lineEnd = memchr(line, '\n', (size_t)(end - line));
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+
+        if (ParseCountedLine(line, (size_t)(lineEnd - line), &dateTime, &counter)) {
+            HyperLogLogAdd(sketch, &dateTime);
+        }
+
+        line = lineEnd + 1;
+    }
+
+    FlushLineCounter(&counter);
+}
+
+typedef struct sketchChunk {
+    const char* begin;
+    const char* end;
+    HyperLogLog sketch;
+} SketchChunk;
+
+void* SketchChunkThread(void* arg)
+{
+    SketchChunk* chunk = (SketchChunk*)arg;
+    SketchDateTimeLines(chunk->begin, chunk->end, &chunk->sketch);
+    return NULL;
+}
+
+// Adds the DateTimes in the given file of ISO 8601 date strings to the given sketch, memory
+// mapping the file and splitting it at line boundaries across threadCount threads, each with
+// its own sketch. The thread sketches are merged once all threads are done.
+// Returns true if successful.
+bool SketchDateTimesMapped(FILE* stream, HyperLogLog* sketch, size_t threadCount)
+{
+    if (!stream || !sketch || threadCount == 0) {
+        return false;
+    }
+
+    size_t fileSize = 0;
+    const char* mapping = MapInputFile(stream, &fileSize);
+    if (mapping == NULL) {
+        return false;
+    }
+
+    SketchChunk* chunks = calloc(threadCount, sizeof(SketchChunk));
+    bool success = chunks != NULL;
+
+    for (size_t i = 0; success && i < threadCount; i++) {
+        chunks[i].begin = (i == 0) ? mapping : chunks[i - 1].end;
+        chunks[i].end = LineChunkEnd(mapping, fileSize, threadCount, i, chunks[i].begin);
+        success = HyperLogLogInit(&chunks[i].sketch, sketch->precision);
+    }
+
+    if (success) {
+        RunOnThreads(SketchChunkThread, chunks, sizeof(SketchChunk), threadCount);
+    }
+
+    for (size_t i = 0; chunks && i < threadCount; i++) {
+        success = success && HyperLogLogMerge(sketch, &chunks[i].sketch);
+        HyperLogLogFree(&chunks[i].sketch);
+    }
+
+    free(chunks);
+    munmap((void*)mapping, fileSize);
+    return success;
+}
+
+// Adds the DateTimes in the given file of ISO 8601 date strings to the given sketch, reading
+// it a line at a time. Returns false if the file couldn't be read to the end.
+bool SketchDateTimes(FILE* stream, HyperLogLog* sketch)
+{
+    if (!stream || !sketch) {
+        return false;
+    }
+
+    char* buff = NULL;
+    size_t buffSize = 0;
+    ssize_t chars;
+    LineCounter counter = { 0 };
+    DateTime dateTime;
+
+    while ((chars = getline(&buff, &buffSize, stream)) > 0) {
+        if (ParseCountedLine(buff, strlen(buff), &dateTime, &counter)) {
+            HyperLogLogAdd(sketch, &dateTime);
+        }
+    }
+
+    FlushLineCounter(&counter);
+    free(buff);
+    return !ferror(stream);
+}
+
+bool TestHyperLogLog()
+{
+    HyperLogLog sketch;
+    HyperLogLog other;
+    if (!HyperLogLogInit(&sketch, HLL_DEFAULT_PRECISION) || !HyperLogLogInit(&other, HLL_DEFAULT_PRECISION)) {
+        return false;
+    }
+
+    // 100,000 distinct seconds, each added twice, split between two sketches with an overlap
+    DateTime date;
+    PopulateDateTimeFromIsoString("2020-01-01T00:00:00Z", &date);
+    for (uint32_t i = 0; i < 100000; i++) {
+        date.day = 1 + i / SECONDS_PER_DAY;
+        date.hour = (i % SECONDS_PER_DAY) / 3600;
+        date.minute = (i / 60) % 60;
+        date.second = i % 60;
+
+        HyperLogLogAdd(i < 60000 ? &sketch : &other, &date);
+        HyperLogLogAdd(i < 40000 ? &sketch : &other, &date);
+    }
+
+    bool success = HyperLogLogMerge(&sketch, &other);
+    double estimate = HyperLogLogEstimate(&sketch);
+    printf("Estimated %.0f distinct dates of 100000\n", estimate);
+    success = success && estimate > 97000 && estimate < 103000;
+
+    // A round trip through a file keeps the estimate
+    FILE* file = tmpfile();
+    HyperLogLogFree(&other);
+    success = success && file && WriteHyperLogLog(file, &sketch) && fseek(file, 0, SEEK_SET) == 0
+        && ReadHyperLogLog(file, &other) && HyperLogLogEstimate(&other) == estimate;
+    if (file) {
+        fclose(file);
+    }
+
+    // Small sets are counted nearly exactly by linear counting
+    HyperLogLogFree(&other);
+    success = success && HyperLogLogInit(&other, HLL_DEFAULT_PRECISION);
+    for (size_t i = 0; success && i < 10; i++) {
+        date.second = (unsigned int)i;
+        HyperLogLogAdd(&other, &date);
+    }
+    success = success && (size_t)(HyperLogLogEstimate(&other) + 0.5) == 10;
+
+    // Sketches of different precisions can't be merged
+    HyperLogLog coarse = { 0 };
+    success = success && HyperLogLogInit(&coarse, HLL_MIN_PRECISION) && !HyperLogLogMerge(&sketch, &coarse);
+
+    HyperLogLogFree(&coarse);
+    HyperLogLogFree(&other);
+    HyperLogLogFree(&sketch);
+    return success;
+}
+
+// Ways of reading DateTimes from the input file
+typedef enum ingestMode {
+    INGEST_MODE_STDIO,      // Read a line at a time with getline
+    INGEST_MODE_MMAP,       // Memory map the file and parse it in place, across threadCount threads
+    INGEST_MODE_CACHE,      // Memory map a date cache written by an earlier run with --save-cache
+    INGEST_MODE_URING,      // Read every input file with many reads in flight through io_uring
+} IngestMode;
+
+// Sorts available to the sort engine
+typedef enum sortMode {
+    SORT_MODE_FIELDS,       // SortDateTimes: radix sort each DateTime field in turn
+    SORT_MODE_PACKED,       // SortDateTimesPacked: radix sort packed 64-bit keys, across threadCount threads
+    SORT_MODE_RECORDS,      // SortDateTimesRecords: radix sort contiguous (packed key, index) records
+} SortMode;
+
+// What a run of the program does
+typedef enum programMode {
+    PROGRAM_MODE_DISTINCT,      // Write the distinct DateTimes of the input to the output
+    PROGRAM_MODE_GENERATE,      // Write synthetic input to the output
+    PROGRAM_MODE_BENCHMARK,     // Time each stage of finding distinct DateTimes, printing JSON to stdout
+    PROGRAM_MODE_SERVE,         // Serve date requests on a Unix domain socket until told to shut down
+    PROGRAM_MODE_CONNECT,       // Send requests from stdin to a date server, printing replies to stdout
+    PROGRAM_MODE_QUERY,         // Answer queries from stdin against a range index, printing replies to stdout
+} ProgramMode;
+
+// Options controlling a run of the program, populated from the command line
+typedef struct options {
+    ProgramMode mode;
+    GeneratorOptions generator; // Used when generating input
+    const char* inputPath;      // File of ISO 8601 date strings, one per line, or - for stdin
+    const char** inputPaths;    // Files read in turn by uring ingestion, or NULL for just inputPath
+    size_t inputPathCount;
+    const char* outputPath;     // File the distinct DateTimes are written to, or - for stdout
+    IngestMode ingestMode;      // How DateTimes are read from the input file
+    size_t threadCount;         // Number of threads to use where supported
+    size_t memoryBudget;        // Bytes of DateTimes the external and merge engines may hold in memory
+    DistinctEngine engine;      // How distinct DateTimes are found
+    SortMode sortMode;          // Sort used to bring equal DateTimes together
+    const char* statsPath;      // File the pipeline statistics are written to when done, or NULL
+    const char* saveCachePath;  // File the ingested DateTimes are written to as a date cache, or NULL
+    const char* appendIndexPath;// Distinct index the input is merged into, instead of finding distinct dates, or NULL
+    const char* socketPath;     // Unix domain socket of the date server
+    const char* saveRangeIndexPath; // File the distinct DateTimes are written to as a range index, or NULL
+    const char* rangeIndexPath; // Range index queried in query mode
+    unsigned int precision;     // HyperLogLog precision of the hll engine
+    size_t exactLimit;          // Estimates up to this are also counted exactly by the hll engine
+    const char* saveSketchPath; // File the hll engine's sketch is written to, or NULL
+    const char* mergeSketchPath;// Sketch the hll engine merges into its own before estimating, or NULL
+    Granularity granularity;    // Resolution at which DateTimes are distinct
+    bool counts;                // Write each distinct DateTime with its number of occurrences
+    size_t topCount;            // With counts, write only this many of the most frequent, or 0 for all
+    bool hugePages;             // Back the arena holding the DateTimes and keys with huge pages
+    bool stream;                // Find distinct DateTimes through the streaming pipeline, as the input arrives
+} Options;
+
+void PrintUsage(const char* program)
+{
+    printf("Usage: %s [-i input] [-o output] [--ingest stdio|mmap|cache|uring] [--threads n] [--engine sort|hash|bitmap|external|hll|merge] [--memory mib] [--sort fields|packed|records]\n", program);
+    printf("          [--stats path] [--save-cache path] [--save-range-index path] [--append index] [--granularity g]\n");
+    printf("          [--counts] [--top k] [--huge-pages] [input files]\n");
+    printf("  -i        Input file, or - for stdin (default dates.txt)\n");
+    printf("  input files  Read in turn instead of -i, with --ingest uring, or merged by the merge engine\n");
+    printf("  -o        Output file, or - for stdout (default distinct-dates.txt, or dates.txt when generating)\n");
+    printf("  --ingest  stdio: read the input a line at a time (default)\n");
+    printf("            mmap: memory map the input and parse it in place\n");
+    printf("            cache: memory map a date cache written by --save-cache instead of parsing text\n");
+    printf("            uring: read the input files with many reads in flight through io_uring, or\n");
+    printf("            with pread where io_uring isn't available. Not supported by the external and\n");
+    printf("            hll engines\n");
+    printf("  --threads Number of threads used by mmap ingestion, the packed sort and output (default 1)\n");
+    printf("  --engine  sort: ascending output via a radix sort (default)\n");
+    printf("            hash: input order output via a hash set, without sorting\n");
+    printf("            bitmap: ascending output via a bitmap of seconds, without sorting\n");
+    printf("            external: ascending output via sorted runs spilled to disk, for inputs larger than memory\n");
+    printf("            hll: estimated count of distinct dates via a HyperLogLog sketch, in constant memory\n");
+    printf("            merge: ascending output via a loser-tree merge of the input files. Files already\n");
+    printf("            sorted are merged from their text; the others are sorted within --memory first\n");
+    printf("  --memory  MiB of DateTimes the external and merge engines may hold in memory (default 1024)\n");
+    printf("  --sort    fields: radix sort each DateTime field (default)\n");
+    printf("            packed: radix sort a packed 64-bit key\n");
+    printf("            records: radix sort (packed key, index) records, streaming memory in each pass\n");
+    printf("  --stats   Write pipeline statistics as JSON to the given file when done, or stderr for -\n");
+    printf("            Statistics are also written to stderr whenever SIGUSR1 is received\n");
+    printf("  --save-cache Write the ingested dates to the given file as a date cache, for reuse with\n");
+    printf("            --ingest cache. Not supported by the external engine\n");
+    printf("  --save-range-index Write the distinct dates to the given file as a range index, for --query.\n");
+    printf("            Not supported by the external and hll engines\n");
+    printf("  --append  Merge the input's distinct dates into the given distinct index, creating it if\n");
+    printf("            needed, and write only the dates new to the index to the output\n");
+    printf("  --granularity second|minute|hour|day|month: resolution at which dates are distinct\n");
+    printf("            (default second). Finer fields are truncated; at day or month granularity the\n");
+    printf("            sort and bitmap engines use a dense bitmap of days instead\n");
+    printf("  --counts  Write each distinct date with a tab and its number of occurrences. Sort engine only\n");
+    printf("  --top     Write only the k most frequent dates with their counts, most frequent first\n");
+    printf("  --huge-pages Back the dates and keys of mmap and cache ingestion with huge pages: explicit\n");
+    printf("            ones if the system has set enough aside, otherwise transparent ones\n");
+    printf("\n");
+    printf("Usage: %s --generate lines [-o output] [--duplicates r] [--years first-last] [--offsets r]\n", program);
+    printf("          [--sorted r] [--malformed r] [--seed n]\n");
+    printf("  Writes synthetic input. Ratios are in [0, 1]; defaults are --duplicates 0.5 --years 2000-2029\n");
+    printf("  --offsets 0.4 --sorted 0 --malformed 0 --seed 1\n");
+    printf("\n");
+    printf("Usage: %s --engine hll [-i input] [-o output] [--ingest stdio|mmap|cache] [--threads n] [--precision p]\n", program);
+    printf("          [--exact-limit n] [--save-sketch path] [--merge-sketch path]\n");
+    printf("  Writes an estimate of the number of distinct dates as JSON\n");
+    printf("  --precision     Sketch of 2^p registers, p in [4, 18] (default 14, about 0.8%% error)\n");
+    printf("  --exact-limit   Also count exactly when the estimate is at most n (default 0). The count is\n");
+    printf("                  null if the input can't be mapped, such as a pipe\n");
+    printf("  --save-sketch   Write the sketch to the given file\n");
+    printf("  --merge-sketch  Union a sketch saved with --save-sketch into this one before estimating\n");
+    printf("\n");
+    printf("Usage: %s --stream [-i input] [-o output] [--threads n] [--engine sort|hash|bitmap] [--granularity g]\n", program);
+    printf("  Finds distinct dates as the input arrives, reading stdin and writing stdout by default, through\n");
+    printf("  a reader thread, n parser threads and a writer. Besides the distinct dates, memory is fixed at\n");
+    printf("  about 2 MiB per parser. The hash engine writes each new date as soon as it is read; the sort\n");
+    printf("  and bitmap engines write ascending dates once the input ends\n");
+    printf("\n");
+    printf("Usage: %s --benchmark [distinct options]\n", program);
+    printf("  Times each stage of finding distinct dates and prints the results as JSON\n");
+    printf("\n");
+    printf("Usage: %s --serve socket\n", program);
+    printf("  Keeps a set of distinct dates in memory and serves requests on a Unix domain socket, one\n");
+    printf("  per line: INSERT date, CONTAINS date, COUNT, RANGE first last and SHUTDOWN\n");
+    printf("\n");
+    printf("Usage: %s --connect socket\n", program);
+    printf("  Sends requests read from stdin to a server and prints its replies to stdout\n");
+    printf("\n");
+    printf("Usage: %s --query index\n", program);
+    printf("  Answers queries read from stdin against a range index written by --save-range-index, one\n");
+    printf("  per line: CONTAINS date, COUNT, COUNT first last and RANGE first last\n");
+}
+
+// Parses the given string as a non-negative decimal integer. Returns true if successful.
+bool ParseSize(const char* value, size_t* outSize)
+{
+    char* valueEnd = NULL;
+    unsigned long long size = strtoull(value, &valueEnd, 10);
+    if (valueEnd == value || *valueEnd != '\0' || value[0] == '-') {
+        return false;
+    }
+
+    *outSize = (size_t)size;
+    return true;
+}
+
+// Parses the given string as a ratio in [0, 1]. Returns true if successful.
+bool ParseRatio(const char* value, double* outRatio)
+{
+    char* valueEnd = NULL;
+    double ratio = strtod(value, &valueEnd);
+    if (valueEnd == value || *valueEnd != '\0' || !(ratio >= 0.0 && ratio <= 1.0)) {
+        return false;
+    }
+
+    *outRatio = ratio;
+    return true;
+}
+
+// Populates the given Options from the given command line arguments.
+// Returns false if an argument is unknown or is missing its value.
+bool ParseOptions(int argc, char** argv, Options* options)
+{
+    if (!options) {
+        return false;
+    }
+
+    options->mode = PROGRAM_MODE_DISTINCT;
+    options->generator = (GeneratorOptions){
+        .lineCount = 0,
+        .duplicateRatio = 0.5,
+        .firstYear = 2000,
+        .yearSpread = 30,
+        .offsetRatio = 0.4,
+        .sortedRatio = 0.0,
+        .malformedRatio = 0.0,
+        .seed = 1,
+    };
+    options->inputPath = NULL;
+    options->inputPaths = NULL;
+    options->inputPathCount = 0;
+    options->outputPath = NULL;
+    options->ingestMode = INGEST_MODE_STDIO;
+    options->threadCount = 1;
+    options->memoryBudget = (size_t)1024 * 1024 * 1024;
+    options->engine = DISTINCT_ENGINE_SORT;
+    options->sortMode = SORT_MODE_FIELDS;
+    options->statsPath = NULL;
+    options->saveCachePath = NULL;
+    options->appendIndexPath = NULL;
+    options->socketPath = NULL;
+    options->saveRangeIndexPath = NULL;
+    options->rangeIndexPath = NULL;
+    options->precision = HLL_DEFAULT_PRECISION;
+    options->exactLimit = 0;
+    options->saveSketchPath = NULL;
+    options->mergeSketchPath = NULL;
+    options->granularity = GRANULARITY_SECOND;
+    options->counts = false;
+    options->topCount = 0;
+    options->hugePages = false;
+    options->stream = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        // Flags without a value
+        if (strcmp(arg, "--benchmark") == 0) {
+            options->mode = PROGRAM_MODE_BENCHMARK;
+            continue;
+        }
+        if (strcmp(arg, "--counts") == 0) {
+            options->counts = true;
+            continue;
+        }
+        if (strcmp(arg, "--huge-pages") == 0) {
+            options->hugePages = true;
+            continue;
+        }
+        if (strcmp(arg, "--stream") == 0) {
+            options->stream = true;
+            continue;
+        }
+
+        // Input files follow the options, listed in memory freed by FreeOptions
+        if (arg[0] != '-') {
+            if (options->inputPaths == NULL) {
+                options->inputPaths = calloc((size_t)argc, sizeof(const char*));
+                if (options->inputPaths == NULL) {
+                    return false;
+                }
+            }
+            options->inputPaths[options->inputPathCount++] = arg;
+            continue;
+        }
+
+        if (value == NULL) {
+            return false;
+        }
+
+        if (strcmp(arg, "-i") == 0) {
+            options->inputPath = value;
+        }
+        else if (strcmp(arg, "-o") == 0) {
+            options->outputPath = value;
+        }
+        else if (strcmp(arg, "--ingest") == 0) {
+            if (strcmp(value, "stdio") == 0) {
+                options->ingestMode = INGEST_MODE_STDIO;
+            }
+            else if (strcmp(value, "mmap") == 0) {
+                options->ingestMode = INGEST_MODE_MMAP;
+            }
+            else if (strcmp(value, "cache") == 0) {
+                options->ingestMode = INGEST_MODE_CACHE;
+            }
+            else if (strcmp(value, "uring") == 0) {
+                options->ingestMode = INGEST_MODE_URING;
+            }
+            else {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--threads") == 0) {
+            if (!ParseSize(value, &options->threadCount) || options->threadCount == 0) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--memory") == 0) {
+            if (!ParseSize(value, &options->memoryBudget) || options->memoryBudget == 0) {
+                return false;
+            }
+            options->memoryBudget *= 1024 * 1024;
+        }
+        else if (strcmp(arg, "--generate") == 0) {
+            options->mode = PROGRAM_MODE_GENERATE;
+            if (!ParseSize(value, &options->generator.lineCount)) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--duplicates") == 0) {
+            if (!ParseRatio(value, &options->generator.duplicateRatio)) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--offsets") == 0) {
+            if (!ParseRatio(value, &options->generator.offsetRatio)) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--sorted") == 0) {
+            if (!ParseRatio(value, &options->generator.sortedRatio)) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--malformed") == 0) {
+            if (!ParseRatio(value, &options->generator.malformedRatio)) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--years") == 0) {
+            size_t first = 0;
+            size_t last = 0;
+            if (sscanf(value, "%zu-%zu", &first, &last) != 2 || first > last || last > 9999) {
+                return false;
+            }
+            options->generator.firstYear = (unsigned int)first;
+            options->generator.yearSpread = (unsigned int)(last - first + 1);
+        }
+        else if (strcmp(arg, "--seed") == 0) {
+            size_t seed = 0;
+            if (!ParseSize(value, &seed)) {
+                return false;
+            }
+            options->generator.seed = seed;
+        }
+        else if (strcmp(arg, "--engine") == 0) {
+            if (strcmp(value, "sort") == 0) {
+                options->engine = DISTINCT_ENGINE_SORT;
+            }
+            else if (strcmp(value, "hash") == 0) {
+                options->engine = DISTINCT_ENGINE_HASH;
+            }
+            else if (strcmp(value, "bitmap") == 0) {
+                options->engine = DISTINCT_ENGINE_BITMAP;
+            }
+            else if (strcmp(value, "external") == 0) {
+                options->engine = DISTINCT_ENGINE_EXTERNAL;
+            }
+            else if (strcmp(value, "hll") == 0) {
+                options->engine = DISTINCT_ENGINE_HLL;
+            }
+            else if (strcmp(value, "merge") == 0) {
+                options->engine = DISTINCT_ENGINE_MERGE;
+            }
+            else {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--granularity") == 0) {
+            size_t granularity = 0;
+            while (granularity < GRANULARITY_COUNT && strcmp(value, GranularityNames[granularity]) != 0) {
+                granularity++;
+            }
+            if (granularity == GRANULARITY_COUNT) {
+                return false;
+            }
+            options->granularity = (Granularity)granularity;
+        }
+        else if (strcmp(arg, "--top") == 0) {
+            if (!ParseSize(value, &options->topCount) || options->topCount == 0) {
+                return false;
+            }
+            options->counts = true;
+        }
+        else if (strcmp(arg, "--precision") == 0) {
+            size_t precision = 0;
+            if (!ParseSize(value, &precision) || precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION) {
+                return false;
+            }
+            options->precision = (unsigned int)precision;
+        }
+        else if (strcmp(arg, "--exact-limit") == 0) {
+            if (!ParseSize(value, &options->exactLimit)) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--save-sketch") == 0) {
+            options->saveSketchPath = value;
+        }
+        else if (strcmp(arg, "--merge-sketch") == 0) {
+            options->mergeSketchPath = value;
+        }
+        else if (strcmp(arg, "--stats") == 0) {
+            options->statsPath = value;
+        }
+        else if (strcmp(arg, "--serve") == 0) {
+            options->mode = PROGRAM_MODE_SERVE;
+            options->socketPath = value;
+        }
+        else if (strcmp(arg, "--connect") == 0) {
+            options->mode = PROGRAM_MODE_CONNECT;
+            options->socketPath = value;
+        }
+        else if (strcmp(arg, "--query") == 0) {
+            options->mode = PROGRAM_MODE_QUERY;
+            options->rangeIndexPath = value;
+        }
+        else if (strcmp(arg, "--save-range-index") == 0) {
+            options->saveRangeIndexPath = value;
+        }
+        else if (strcmp(arg, "--append") == 0) {
+            options->appendIndexPath = value;
+        }
+        else if (strcmp(arg, "--save-cache") == 0) {
+            options->saveCachePath = value;
+        }
+        else if (strcmp(arg, "--sort") == 0) {
+            if (strcmp(value, "fields") == 0) {
+                options->sortMode = SORT_MODE_FIELDS;
+            }
+            else if (strcmp(value, "packed") == 0) {
+                options->sortMode = SORT_MODE_PACKED;
+            }
+            else if (strcmp(value, "records") == 0) {
+                options->sortMode = SORT_MODE_RECORDS;
+            }
+            else {
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+
+        i++;  // Consume value
+    }
+
+    // Several input files are only read by uring ingestion, which the default of stdio gives way to
+    if (options->inputPathCount > 0) {
+        if (options->inputPath != NULL || (options->ingestMode != INGEST_MODE_STDIO && options->ingestMode != INGEST_MODE_URING)) {
+            return false;
+        }
+        options->ingestMode = INGEST_MODE_URING;
+        options->inputPath = options->inputPaths[0];
+    }
+
+    // The external and hll engines read a single stream of their own
+    if (options->ingestMode == INGEST_MODE_URING
+        && (options->engine == DISTINCT_ENGINE_EXTERNAL || options->engine == DISTINCT_ENGINE_HLL)) {
+        return false;
+    }
+
+    // The external engine streams text and never holds every DateTime at once
+    if (options->engine == DISTINCT_ENGINE_EXTERNAL
+        && (options->ingestMode == INGEST_MODE_CACHE || options->saveCachePath != NULL || options->appendIndexPath != NULL
+            || options->saveRangeIndexPath != NULL)) {
+        return false;
+    }
+
+    // Only the sort engine brings equal DateTimes together to be counted
+    if (options->counts && (options->engine != DISTINCT_ENGINE_SORT || options->appendIndexPath != NULL)) {
+        return false;
+    }
+
+    // The merge engine reads each input file itself, never holding all of the DateTimes
+    if (options->engine == DISTINCT_ENGINE_MERGE
+        && (options->ingestMode == INGEST_MODE_MMAP || options->ingestMode == INGEST_MODE_CACHE || options->counts
+            || options->saveCachePath != NULL || options->appendIndexPath != NULL || options->saveRangeIndexPath != NULL)) {
+        return false;
+    }
+
+    // The external and hll engines never hold the DateTimes to truncate them
+    if (options->granularity != GRANULARITY_SECOND
+        && (options->engine == DISTINCT_ENGINE_EXTERNAL || options->engine == DISTINCT_ENGINE_HLL)) {
+        return false;
+    }
+
+    // The hll engine doesn't hold the DateTimes at all
+    if (options->engine == DISTINCT_ENGINE_HLL
+        && (options->saveCachePath != NULL || options->appendIndexPath != NULL || options->saveRangeIndexPath != NULL)) {
+        return false;
+    }
+
+    // Streaming reads text as it arrives and only keeps a bitmap of the distinct DateTimes
+    if (options->stream
+        && (options->mode != PROGRAM_MODE_DISTINCT || options->ingestMode != INGEST_MODE_STDIO || options->counts
+            || (options->engine != DISTINCT_ENGINE_SORT && options->engine != DISTINCT_ENGINE_HASH && options->engine != DISTINCT_ENGINE_BITMAP)
+            || options->saveCachePath != NULL || options->appendIndexPath != NULL || options->saveRangeIndexPath != NULL)) {
+        return false;
+    }
+
+    // Streaming sits in a pipeline, and generated input goes where the distinct pipeline reads
+    // from by default
+    if (options->inputPath == NULL) {
+        options->inputPath = options->stream ? "-" : "dates.txt";
+    }
+    if (options->outputPath == NULL) {
+        if (options->stream) {
+            options->outputPath = "-";
+        }
+        else {
+            options->outputPath = (options->mode == PROGRAM_MODE_GENERATE) ? "dates.txt" : "distinct-dates.txt";
+        }
+    }
+
+    return true;
+}
+
+// Frees the memory owned by the given options
+void FreeOptions(Options* options)
+{
+    free(options->inputPaths);
+    options->inputPaths = NULL;
+    options->inputPathCount = 0;
+}
+
+// Returns the input files selected by the given options, setting outCount to their number.
+const char* const* InputPaths(const Options* options, size_t* outCount)
+{
+    if (options->inputPathCount > 0) {
+        *outCount = options->inputPathCount;
+        return options->inputPaths;
+    }
 
-        if (i > 0) {
-            DateTime* pPrevDate = &dates[distinctKeys[i-1]];
-            if (!DateTimeLessThan(pPrevDate, pCurDate)) {
-                return false;
-            }
+    *outCount = 1;
+    return &options->inputPath;
+}
+
+// Reads DateTimes from the given file the way selected by the given options, setting outCount
+// to the number read. See IngestDateTimes for the handling of dateTimeBuff and n.
+// Returns false if the input couldn't be read, as opposed to holding no DateTimes.
+bool IngestDateTimesWithOptions(const Options* options, DateTime** dateTimeBuff, size_t* n, FILE* stream, size_t* outCount)
+{
+    switch (options->ingestMode) {
+    case INGEST_MODE_CACHE:
+        return IngestDateTimesCached(dateTimeBuff, n, stream, outCount);
+    case INGEST_MODE_MMAP:
+        if (options->threadCount > 1) {
+            return IngestDateTimesParallel(dateTimeBuff, n, stream, options->threadCount, outCount);
         }
+        return IngestDateTimesMapped(dateTimeBuff, n, stream, outCount);
+    case INGEST_MODE_URING: {
+        size_t pathCount = 0;
+        const char* const* paths = InputPaths(options, &pathCount);
+        return IngestDateTimesFiles(dateTimeBuff, n, paths, pathCount, true, outCount);
+    }
+    case INGEST_MODE_STDIO:
+    default:
+        *outCount = IngestDateTimes(dateTimeBuff, n, stream);
+        return true;
     }
+}
 
-    return true;
+// Returns the most DateTimes that reading the given file the way selected by the given options
+// can give, or 0 if there is no bound because the input is read as a stream, or as files
+// opened one by one, that may grow.
+size_t IngestDateTimeCountBound(const Options* options, FILE* stream)
+{
+    struct stat fileStat;
+    if (options->ingestMode == INGEST_MODE_STDIO || options->ingestMode == INGEST_MODE_URING
+        || fstat(fileno(stream), &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+        return 0;
+    }
+
+    const size_t fileSize = (size_t)fileStat.st_size;
+    if (options->ingestMode == INGEST_MODE_CACHE) {
+        return fileSize / sizeof(uint64_t);
+    }
+
+    // Each parallel range can hold one more DateTime than its share of the bytes suggests
+    return DateTimeCountBound(fileSize) + (options->threadCount > 1 ? options->threadCount - 1 : 0);
 }
 
-// Reads the given file containing ISO 8601 format date strings on each line into
-// a DateTime buffer. If dateTimeBuff is NULL and n is 0 a buffer will be initialized
-// for the caller. Regardless, it is the caller's responsibility to free the buffer
-// when finished with it.
-#define MAX_ISO_DATE_LEN 25;
-size_t IngestDateTimes(DateTime** dateTimeBuff, size_t* n, FILE* stream)
+// Reserves the given arena for the DateTimes read from the given file the way selected by the
+// given options, plus the keys that finding the distinct ones needs, and carves the DateTime
+// buffer from it. Reading into the buffer then never reallocates it. Returns the buffer and
+// its size in bytes, or NULL with the arena uninitialized if the input has no bound; the
+// caller then ingests into a buffer of its own.
+DateTime* ReserveIngestArena(const Options* options, Arena* arena, FILE* stream, size_t* outSize)
 {
-    if (!dateTimeBuff || !n || !stream) {
-        return false;
+    *outSize = 0;
+    arena->base = NULL;
+
+    const size_t bound = IngestDateTimeCountBound(options, stream);
+    const size_t keyBuffers = 3;    // Distinct keys, counts and sort scratch
+    if (bound == 0 || !ArenaInit(arena, bound * (sizeof(DateTime) + keyBuffers * sizeof(size_t)) + (keyBuffers + 1) * ARENA_ALIGNMENT, options->hugePages)) {
+        return NULL;
     }
 
-    // If caller didn't allocate dateTimeBuff (and no size is provided) we can allocate it
-    if (*dateTimeBuff == NULL) {
-        if (*n == 0) {
-            *n = sizeof(DateTime);
-            *dateTimeBuff = (DateTime*)calloc(1, *n);
-        }
-        else { // If user provided a non-zero size but no dateTimeBuff, then fail
+    DateTime* dateTimes = ArenaAlloc(arena, bound * sizeof(DateTime));
+    *outSize = bound * sizeof(DateTime);
+    return dateTimes;
+}
+
+// Sorts keys indexing into the given list of DateTimes into outKeys with the sort selected by
+// the given options. The fields sort uses the given scratch buffer of count keys if it isn't
+// NULL; the others allocate their own packed keys or records.
+bool SortDateTimesWithOptions(const Options* options, const DateTime* dateTimes, size_t count, size_t* outKeys, size_t* scratch)
+{
+    switch (options->sortMode) {
+    case SORT_MODE_PACKED:
+        return SortDateTimesPackedParallel(dateTimes, count, outKeys, options->threadCount);
+    case SORT_MODE_RECORDS:
+        return SortDateTimesRecords(dateTimes, count, outKeys);
+    case SORT_MODE_FIELDS:
+    default:
+        return SortDateTimesWithScratch(dateTimes, count, outKeys, scratch);
+    }
+}
+
+// Returns true if the given options find distinct DateTimes with WriteDistinctDays: they are
+// truncated to day or month granularity and need neither counts nor input order.
+bool UsesDayBitmap(const Options* options)
+{
+    return options->granularity >= GRANULARITY_DAY && !options->counts
+        && (options->engine == DISTINCT_ENGINE_SORT || options->engine == DISTINCT_ENGINE_BITMAP);
+}
+
+// Finds the distinct DateTimes in the given list using the engine selected by the given
+// options and prints them to the given file stream, recording the time of each stage in the
+// pipeline statistics. Keys and sort scratch are carved from the given arena where it has
+// room, or allocated if it is NULL. Returns true if successful.
+bool WriteDistinctDateTimes(const Options* options, Arena* arena, const DateTime* dateTimes, size_t count, FILE* stream)
+{
+    PipelineStats* stats = ThreadPipelineStats();
+    uint64_t start = MonotonicNanoseconds();
+
+    if (UsesDayBitmap(options)) {
+        // Setting and scanning the day bitmap finds and writes the days in one step
+        size_t distinctCount = 0;
+        bool success = WriteDistinctDays(stream, dateTimes, count, &distinctCount);
+        StatsAddStageTime(PIPELINE_STAGE_DEDUP, start);
+        StatsAdd(&stats->duplicatesRemoved, count - distinctCount);
+        return success;
+    }
+
+    if (options->engine == DISTINCT_ENGINE_BITMAP) {
+        DateTimeBitmap bitmap;
+        if (!DateTimeBitmapInit(&bitmap)) {
             return false;
         }
+
+        DateTimeWriter writer;
+        bool success = DistinctDateTimesBitmap(dateTimes, count, &bitmap);
+        StatsAddStageTime(PIPELINE_STAGE_DEDUP, start);
+        StatsAdd(&stats->duplicatesRemoved, count - bitmap.count);
+
+        start = MonotonicNanoseconds();
+        success = success && DateTimeWriterInit(&writer, stream);
+        if (success) {
+            DateTimeBitmapForEach(&bitmap, DateTimeWriterVisitor, &writer);
+            success = DateTimeWriterFree(&writer);
+        }
+        StatsAddStageTime(PIPELINE_STAGE_WRITE, start);
+
+        DateTimeBitmapFree(&bitmap);
+        return success;
     }
-    
-    char* buff;
-    size_t buffSize = MAX_ISO_DATE_LEN;
 
-    buff = (char*)malloc(buffSize * sizeof(char));
-    if (buff == NULL) {
+    size_t* distinctKeys;
+    size_t numDistinctKeys;
+    bool keysMalloced = false;
+    bool countsMalloced = false;
+    bool scratchMalloced = false;
+
+    distinctKeys = (size_t*)ArenaAllocOrMalloc(arena, count * sizeof(size_t), &keysMalloced);
+    size_t* counts = options->counts ? ArenaAllocOrMalloc(arena, count * sizeof(size_t), &countsMalloced) : NULL;
+    size_t* scratch = (options->engine == DISTINCT_ENGINE_SORT && options->sortMode == SORT_MODE_FIELDS)
+        ? ArenaAllocOrMalloc(arena, count * sizeof(size_t), &scratchMalloced) : NULL;
+
+    bool success = distinctKeys != NULL && (counts != NULL || !options->counts);
+    switch (options->engine) {
+    case DISTINCT_ENGINE_SORT:
+        success = success && SortDateTimesWithOptions(options, dateTimes, count, distinctKeys, scratch);
+        StatsAddStageTime(PIPELINE_STAGE_SORT, start);
+
+        // Run lengths of equal dates come from the same scan that removes them
+        start = MonotonicNanoseconds();
+        success = success && DistinctSortedDateTimesCounted(dateTimes, distinctKeys, count, distinctKeys, counts, &numDistinctKeys);
+        StatsAddStageTime(PIPELINE_STAGE_DEDUP, start);
+        break;
+    case DISTINCT_ENGINE_HASH:
+        success = success && DistinctDateTimesHashed(dateTimes, count, distinctKeys, &numDistinctKeys);
+        StatsAddStageTime(PIPELINE_STAGE_DEDUP, start);
+        break;
+    default:
+        success = false;
+        break;
+    }
+
+    if (success) {
+        StatsAdd(&stats->duplicatesRemoved, count - numDistinctKeys);
+
+        start = MonotonicNanoseconds();
+        if (options->counts) {
+            success = WriteDateTimeCounts(stream, dateTimes, distinctKeys, counts, numDistinctKeys, options->topCount);
+        }
+        else {
+            success = WriteDateTimes(stream, dateTimes, distinctKeys, numDistinctKeys, options->threadCount);
+        }
+        StatsAddStageTime(PIPELINE_STAGE_WRITE, start);
+    }
+
+    if (scratchMalloced) {
+        free(scratch);
+    }
+    if (countsMalloced) {
+        free(counts);
+    }
+    if (keysMalloced) {
+        free(distinctKeys);
+    }
+    return success;
+}
+
+// Counts the distinct DateTimes in the given input file exactly in a DateTimeBitmap, reading it
+// as ISO 8601 lines, or as a date cache if selected by the given options. Lines are not
+// counted in the pipeline statistics, since the input has already been read once.
+// Returns false if the file can't be mapped.
+bool CountDistinctDateTimesExact(const Options* options, FILE* stream, size_t* outCount)
+{
+    DateTimeBitmap bitmap;
+    if (!DateTimeBitmapInit(&bitmap)) {
         return false;
     }
 
-    size_t chars = 0;
-    size_t validDateTimes = 0;
+    size_t mappingSize = 0;
+    const char* mapping = MapInputFile(stream, &mappingSize);
+    bool success = mapping != NULL;
+    DateTime dateTime;
+
+    if (success && options->ingestMode == INGEST_MODE_CACHE) {
+        const uint64_t* packedKeys = (const uint64_t*)(mapping + sizeof(DateCacheHeader));
+        const size_t count = mappingSize >= sizeof(DateCacheHeader) ? (mappingSize - sizeof(DateCacheHeader)) / sizeof(uint64_t) : 0;
+        for (size_t i = 0; success && i < count; i++) {
+            UnpackDateTime(packedKeys[i], &dateTime);
+            success = DateTimeBitmapInsert(&bitmap, &dateTime);
+        }
+    }
+    else if (success) {
+        const char* end = mapping + mappingSize;
+        for (const char* line = mapping; success && line < end; ) {
+            const char* lineEnd = memchr(line, '\n', (size_t)(end - line));
+            if (lineEnd == NULL) {
+                lineEnd = end;
+            }
 
-    while (!feof(stream)) {
-        chars = getline(&buff, &buffSize, stream);
-        if (chars > 0) {
-            // If we're out of space, allocate more
-            const size_t spaceRemaining = *n - (validDateTimes * sizeof(DateTime));
-            if (spaceRemaining < sizeof(DateTime)) {
-                *n *= 2;
-                *dateTimeBuff = (DateTime*)realloc(*dateTimeBuff, *n);
+            if (PopulateDateTimeFromIsoCharsFast(line, (size_t)(lineEnd - line), &dateTime)) {
+                success = DateTimeBitmapInsert(&bitmap, &dateTime);
             }
+            line = lineEnd + 1;
+        }
+    }
 
-            if (PopulateDateTimeFromIsoString(buff, &(*dateTimeBuff)[validDateTimes])) {
-                validDateTimes++;
+    if (mapping) {
+        munmap((void*)mapping, mappingSize);
+    }
+
+    *outCount = bitmap.count;
+    DateTimeBitmapFree(&bitmap);
+    return success;
+}
+
+// Estimates the number of distinct DateTimes in the given input file with a HyperLogLog
+// sketch of the precision selected by the given options, reading the input the way they
+// select, and prints the estimate to the given output file stream as a line of JSON. The
+// sketch can be unioned with a saved one before estimating, and saved afterwards.
+// Returns true if successful.
+bool CountDistinctDateTimes(const Options* options, FILE* inStream, FILE* outStream)
+{
+    HyperLogLog sketch;
+    if (!HyperLogLogInit(&sketch, options->precision)) {
+        return false;
+    }
+
+    uint64_t start = MonotonicNanoseconds();
+    bool success = true;
+
+    switch (options->ingestMode) {
+    case INGEST_MODE_CACHE: {
+        DateCacheHeader header;
+        size_t mappingSize = 0;
+        const char* mapping = MapDateCache(inStream, &header, &mappingSize);
+        success = mapping != NULL;
+
+        for (size_t i = 0; success && i < header.count; i++) {
+            HyperLogLogAddPackedKey(&sketch, ((const uint64_t*)(mapping + sizeof(DateCacheHeader)))[i]);
+        }
+
+        if (mapping) {
+            munmap((void*)mapping, mappingSize);
+        }
+        break;
+    }
+    case INGEST_MODE_MMAP:
+        success = SketchDateTimesMapped(inStream, &sketch, options->threadCount);
+        break;
+    case INGEST_MODE_STDIO:
+    default:
+        success = SketchDateTimes(inStream, &sketch);
+        break;
+    }
+
+    StatsAddStageTime(PIPELINE_STAGE_INGEST, start);
+
+    if (success && options->mergeSketchPath != NULL) {
+        HyperLogLog saved;
+        FILE* savedFile = fopen(options->mergeSketchPath, "rb");
+        success = savedFile != NULL && ReadHyperLogLog(savedFile, &saved);
+        if (success) {
+            success = HyperLogLogMerge(&sketch, &saved);
+            HyperLogLogFree(&saved);
+        }
+        if (savedFile != NULL) {
+            fclose(savedFile);
+        }
+    }
+
+    if (success && options->saveSketchPath != NULL) {
+        FILE* savedFile = fopen(options->saveSketchPath, "wb");
+        success = savedFile != NULL && WriteHyperLogLog(savedFile, &sketch);
+        if (savedFile != NULL) {
+            success = (fclose(savedFile) == 0) && success;
+        }
+    }
+
+    if (success) {
+        double estimate = HyperLogLogEstimate(&sketch);
+        fprintf(outStream, "{\"estimate\":%.0f,\"precision\":%u,\"standard_error\":%.4f",
+            estimate, options->precision, 1.04 / sqrt((double)((size_t)1 << options->precision)));
+
+        // An exact count only describes this input, so it isn't given for a merged sketch. One
+        // asked for that can't be made, as for input that can't be mapped, is given as null
+        size_t exact = 0;
+        if (options->mergeSketchPath == NULL && estimate <= (double)options->exactLimit) {
+            if (CountDistinctDateTimesExact(options, inStream, &exact)) {
+                fprintf(outStream, ",\"exact\":%zu", exact);
+            }
+            else {
+                fprintf(outStream, ",\"exact\":null");
+                fprintf(stderr, "Couldn't count exactly: the input can't be mapped, or memory ran out\n");
             }
         }
+        fprintf(outStream, "}\n");
+    }
+
+    HyperLogLogFree(&sketch);
+    return success;
+}
+
+// Sorts and dedups the given list of DateTimes with the sort selected by the given options,
+// then merges them into the distinct index at options->appendIndexPath, printing the dates that
+// were new to the index to the given file stream. Returns true if successful.
+bool AppendDistinctDateTimes(const Options* options, const DateTime* dateTimes, size_t count, FILE* stream)
+{
+    size_t* distinctKeys = malloc((count ? count : 1) * sizeof(size_t));
+    if (distinctKeys == NULL) {
+        return false;
+    }
+
+    uint64_t start = MonotonicNanoseconds();
+    bool success = SortDateTimesWithOptions(options, dateTimes, count, distinctKeys, NULL);
+    StatsAddStageTime(PIPELINE_STAGE_SORT, start);
+
+    size_t numDistinctKeys = 0;
+    start = MonotonicNanoseconds();
+    success = success && DistinctSortedDateTimes(dateTimes, distinctKeys, count, distinctKeys, &numDistinctKeys);
+    StatsAddStageTime(PIPELINE_STAGE_DEDUP, start);
+
+    if (success) {
+        StatsAdd(&ThreadPipelineStats()->duplicatesRemoved, count - numDistinctKeys);
+
+        size_t newCount = 0;
+        start = MonotonicNanoseconds();
+        success = AppendToDateIndex(options->appendIndexPath, dateTimes, distinctKeys, numDistinctKeys, stream, &newCount);
+        StatsAddStageTime(PIPELINE_STAGE_WRITE, start);
+    }
+
+    free(distinctKeys);
+    return success;
+}
+
+// Writes the final pipeline statistics to the file at the given path, or to stderr for "-".
+// Does nothing for a NULL path. Returns true if successful.
+bool WritePipelineStats(const char* path)
+{
+    if (path == NULL) {
+        return true;
+    }
+
+    if (strcmp(path, "-") == 0) {
+        FPrintPipelineStats(stderr);
+        return true;
+    }
+
+    FILE* stream = fopen(path, "w");
+    if (stream == NULL) {
+        return false;
+    }
+
+    FPrintPipelineStats(stream);
+    return fclose(stream) == 0;
+}
+
+// Stages of the pipeline timed by RunBenchmark
+typedef enum benchmarkStage {
+    BENCHMARK_STAGE_INGEST,     // Read and parse the input file with the selected ingest mode
+    BENCHMARK_STAGE_PARSE,      // Parse the input again from memory, to separate parsing from I/O
+    BENCHMARK_STAGE_SORT,
+    BENCHMARK_STAGE_DEDUP,
+    BENCHMARK_STAGE_WRITE,
+    BENCHMARK_STAGE_COUNT,
+} BenchmarkStage;
+
+static const char* BenchmarkStageNames[BENCHMARK_STAGE_COUNT] = { "ingest", "parse", "sort", "dedup", "write" };
+
+// Returns the current time of the monotonic clock in seconds.
+double MonotonicSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Runs the distinct pipeline selected by the given options over the given input file, timing
+// each stage separately, and prints the timings as a single line of JSON to stdout. The input
+// must be a regular file.
+// Returns true if successful.
+bool RunBenchmark(const Options* options, FILE* inStream, FILE* outStream)
+{
+    if (options->engine == DISTINCT_ENGINE_EXTERNAL || options->engine == DISTINCT_ENGINE_HLL || options->engine == DISTINCT_ENGINE_MERGE) {
+        fprintf(stderr, "The external, hll and merge engines stream their input and can't be timed by stage\n");
+        return false;
+    }
+
+    double seconds[BENCHMARK_STAGE_COUNT] = { 0 };
+    double start = MonotonicSeconds();
+
+    Arena arena;
+    size_t datesSize = 0;
+    DateTime* dates = ReserveIngestArena(options, &arena, inStream, &datesSize);
+    size_t numDates = 0;
+    const bool ingested = IngestDateTimesWithOptions(options, &dates, &datesSize, inStream, &numDates);
+    TruncateDateTimes(dates, numDates, options->granularity);
+    seconds[BENCHMARK_STAGE_INGEST] = MonotonicSeconds() - start;
+
+    // Counting lines faults the whole input into memory, so that parsing it again is timed
+    // without any I/O
+    size_t inputSize = 0;
+    const char* input = MapInputFile(inStream, &inputSize);
+    size_t numLines = 0;
+    if (input) {
+        const char* end = input + inputSize;
+        for (const char* pos = input; (pos = memchr(pos, '\n', (size_t)(end - pos))) != NULL; pos++) {
+            numLines++;
+        }
+        if (input[inputSize - 1] != '\n') {
+            numLines++;
+        }
+
+        size_t parsedSize = (numLines + 1) * sizeof(DateTime);
+        DateTime* parsed = malloc(parsedSize);
+        if (parsed) {
+            start = MonotonicSeconds();
+            ParseDateTimeLines(input, end, &parsed, &parsedSize, 0, false);
+            seconds[BENCHMARK_STAGE_PARSE] = MonotonicSeconds() - start;
+        }
+
+        free(parsed);
+        munmap((void*)input, inputSize);
+    }
+
+    bool keysMalloced = false;
+    bool scratchMalloced = false;
+    size_t* keys = ArenaAllocOrMalloc(&arena, numDates * sizeof(size_t), &keysMalloced);
+    size_t* scratch = ArenaAllocOrMalloc(&arena, numDates * sizeof(size_t), &scratchMalloced);
+    size_t numDistinct = 0;
+    bool success = ingested && dates && keys && scratch;
+    if (!ingested) {
+        fputs((options->ingestMode == INGEST_MODE_CACHE) ? "Couldn't read the input as a valid date cache\n" : "Couldn't read the input\n", stderr);
+    }
+
+    if (success && UsesDayBitmap(options)) {
+        // Finding and writing the distinct days is one step, timed as dedup
+        start = MonotonicSeconds();
+        success = WriteDistinctDays(outStream, dates, numDates, &numDistinct);
+        seconds[BENCHMARK_STAGE_DEDUP] = MonotonicSeconds() - start;
+    }
+    else if (success && options->engine == DISTINCT_ENGINE_BITMAP) {
+        DateTimeBitmap bitmap;
+        DateTimeWriter writer;
+
+        start = MonotonicSeconds();
+        success = DateTimeBitmapInit(&bitmap) && DistinctDateTimesBitmap(dates, numDates, &bitmap);
+        seconds[BENCHMARK_STAGE_DEDUP] = MonotonicSeconds() - start;
+
+        start = MonotonicSeconds();
+        if (success && DateTimeWriterInit(&writer, outStream)) {
+            DateTimeBitmapForEach(&bitmap, DateTimeWriterVisitor, &writer);
+            success = DateTimeWriterFree(&writer);
+        }
+        seconds[BENCHMARK_STAGE_WRITE] = MonotonicSeconds() - start;
+
+        numDistinct = bitmap.count;
+        DateTimeBitmapFree(&bitmap);
+    }
+    else if (success) {
+        if (options->engine == DISTINCT_ENGINE_HASH) {
+            start = MonotonicSeconds();
+            success = DistinctDateTimesHashed(dates, numDates, keys, &numDistinct);
+            seconds[BENCHMARK_STAGE_DEDUP] = MonotonicSeconds() - start;
+        }
         else {
-            validDateTimes = chars;
-            break;
+            start = MonotonicSeconds();
+            success = SortDateTimesWithOptions(options, dates, numDates, keys, scratch);
+            seconds[BENCHMARK_STAGE_SORT] = MonotonicSeconds() - start;
+
+            start = MonotonicSeconds();
+            success = success && DistinctSortedDateTimes(dates, keys, numDates, keys, &numDistinct);
+            seconds[BENCHMARK_STAGE_DEDUP] = MonotonicSeconds() - start;
         }
+
+        start = MonotonicSeconds();
+        success = success && WriteDateTimes(outStream, dates, keys, numDistinct, options->threadCount);
+        seconds[BENCHMARK_STAGE_WRITE] = MonotonicSeconds() - start;
     }
 
-    free(buff);
+    if (keysMalloced) {
+        free(keys);
+    }
+    if (scratchMalloced) {
+        free(scratch);
+    }
+    if (arena.base == NULL) {
+        free(dates);
+    }
+    ArenaFree(&arena);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    static const char* engineNames[] = { "sort", "hash", "bitmap", "external", "hll", "merge" };
+    static const char* sortNames[] = { "fields", "packed", "records" };
+    static const char* ingestNames[] = { "stdio", "mmap", "cache", "uring" };
+
+    // The input is the only field not chosen from a fixed set of names, so it alone is escaped
+    printf("{\"input\":");
+    FPrintJsonString(stdout, options->inputPath);
+    printf(",\"engine\":\"%s\",\"sort\":\"%s\",\"ingest\":\"%s\",\"granularity\":\"%s\",\"threads\":%zu,"
+        "\"lines\":%zu,\"bytes\":%zu,\"dates\":%zu,\"distinct\":%zu,\"peak_rss_kb\":%ld,\"minor_faults\":%ld,\"success\":%s,\"stages\":{",
+        engineNames[options->engine], sortNames[options->sortMode], ingestNames[options->ingestMode],
+        GranularityNames[options->granularity], options->threadCount, numLines, inputSize, numDates, numDistinct, usage.ru_maxrss, usage.ru_minflt, success ? "true" : "false");
+
+    double total = 0;
+    for (size_t stage = 0; stage < BENCHMARK_STAGE_COUNT; stage++) {
+        // Parsing repeats part of ingestion, so it is left out of the total
+        if (stage != BENCHMARK_STAGE_PARSE) {
+            total += seconds[stage];
+        }
 
-    return validDateTimes;
-}
+        // Stages the engine doesn't run report rates of zero
+        double elapsed = seconds[stage];
+        printf("\"%s\":{\"seconds\":%.6f,\"lines_per_second\":%.0f,\"bytes_per_second\":%.0f},",
+            BenchmarkStageNames[stage], elapsed, elapsed > 0 ? numLines / elapsed : 0, elapsed > 0 ? inputSize / elapsed : 0);
+    }
 
+    printf("\"total\":{\"seconds\":%.6f,\"lines_per_second\":%.0f,\"bytes_per_second\":%.0f}}}\n",
+        total, total > 0 ? numLines / total : 0, total > 0 ? inputSize / total : 0);
+
+    return success;
+}
 
 #define TEST(t) \
     printf("===Running Test %s===\n", #t); \
     printf("%s\n\n", t() ? "Passed" : "Failed") ;
 
-int main()
+// Runs the program as selected by the given options. Returns the exit status.
+int RunProgram(const Options* options)
 {
-    TEST(TestCountSort);
-    TEST(TestCopyDigits);
-    TEST(TestPopulateDateTimeFromIsoString);
-    TEST(TestYearSelectors);
-    TEST(TestSortDateTimes);
-    TEST(TestDistinctDateTimes);
-    TEST(TestOffsetAndWrap);
+    if (options->mode == PROGRAM_MODE_GENERATE) {
+        FILE* fileOut = fopen(options->outputPath, "w");
+        if (fileOut == NULL) {
+            return -1;
+        }
+
+        bool success = GenerateDateTimes(fileOut, &options->generator, NULL);
+        fclose(fileOut);
+
+        return success ? 0 : -1;
+    }
+
+    if (options->mode == PROGRAM_MODE_SERVE) {
+        int listenFd = OpenServerSocket(options->socketPath);
+        if (listenFd < 0) {
+            fprintf(stderr, "Couldn't listen on %s\n", options->socketPath);
+            return -1;
+        }
+
+        bool success = ServeDates(listenFd);
+        unlink(options->socketPath);
+
+        return success ? 0 : -1;
+    }
+
+    if (options->mode == PROGRAM_MODE_CONNECT) {
+        return RunDateClient(options->socketPath, STDIN_FILENO, STDOUT_FILENO) ? 0 : -1;
+    }
+
+    if (options->mode == PROGRAM_MODE_QUERY) {
+        FILE* indexFile = fopen(options->rangeIndexPath, "rb");
+        RangeIndex index;
+        bool success = indexFile != NULL && MapRangeIndex(indexFile, &index, false);
+        if (success) {
+            success = RunRangeQueries(&index, stdin, stdout);
+            UnmapRangeIndex(&index);
+        }
+        if (indexFile != NULL) {
+            fclose(indexFile);
+        }
+
+        return success ? 0 : -1;
+    }
+
+    // Self tests print to stdout, which would corrupt the benchmark's report or output sent there
+    if (options->mode == PROGRAM_MODE_DISTINCT && strcmp(options->outputPath, "-") != 0) {
+        TEST(TestCountSort);
+        TEST(TestCopyDigits);
+        TEST(TestPopulateDateTimeFromIsoString);
+        TEST(TestPopulateDateTimeFromIsoCharsFast);
+        TEST(TestYearSelectors);
+        TEST(TestSortDateTimes);
+        TEST(TestSortDateTimesMatchesCountSort);
+        TEST(TestPackDateTime);
+        TEST(TestSortDateTimesPacked);
+        TEST(TestSortDateTimesRecords);
+        TEST(TestRadixSortPackedKeysParallel);
+        TEST(TestDistinctDateTimes);
+        TEST(TestDistinctSortedDateTimesCounted);
+        TEST(TestDistinctDateTimesHashed);
+        TEST(TestDistinctDateTimesBitmap);
+        TEST(TestOffsetDateTime);
+        TEST(TestIngestDateTimesMapped);
+        TEST(TestArena);
+        TEST(TestIngestDateTimesParallel);
+        TEST(TestSpscRing);
+        TEST(TestStreamDistinctDateTimes);
+        TEST(TestIngestDateTimesFiles);
+        TEST(TestHyperLogLog);
+        TEST(TestFormatDateTime);
+        TEST(TestWriteDateTimeCounts);
+        TEST(TestWriteDistinctDays);
+        TEST(TestGenerateDateTimes);
+        TEST(TestWriteDistinctDateTimesExternal);
+        TEST(TestWriteDistinctDateTimesMerged);
+        TEST(TestDateCache);
+        TEST(TestAppendToDateIndex);
+        TEST(TestDateServer);
+        TEST(TestServerRangeReply);
+        TEST(TestRangeIndex);
+        TEST(TestPipelineStats);
+
+        // Only the real input belongs in the statistics
+        ResetPipelineStats();
+    }
+
+    // Block SIGUSR1 before starting any other thread, so that only the reporter receives it
+    StartStatsReporter();
 
     FILE* fileIn;
     FILE* fileOut;
-    fileIn = fopen("dates.txt", "r");
-    fileOut = fopen("distinct-dates.txt", "w");
+    fileIn = (strcmp(options->inputPath, "-") == 0) ? stdin : fopen(options->inputPath, "r");
+    fileOut = (strcmp(options->outputPath, "-") == 0) ? stdout : fopen(options->outputPath, "w");
 
     if (fileIn == NULL || fileOut == NULL) {
+        fprintf(stderr, "Couldn't open %s\n", (fileIn == NULL) ? options->inputPath : options->outputPath);
         return -1;
     }
 
-    DateTime* datesBuffer = NULL;
-    size_t datesBufferSize = 0;
-    size_t numDates = 0;
+    if (options->stream) {
+        bool success = StreamDistinctDateTimes(fileno(fileIn), fileOut, options->threadCount, options->granularity,
+            options->engine == DISTINCT_ENGINE_HASH);
+
+        fclose(fileOut);
+        fclose(fileIn);
 
-    numDates = IngestDateTimes(&datesBuffer, &datesBufferSize, fileIn);
+        return (WritePipelineStats(options->statsPath) && success) ? 0 : -1;
+    }
 
-    if (numDates > 0) {
-        size_t* distinctKeys;
-        size_t numDistinctKeys;
+    if (options->mode == PROGRAM_MODE_BENCHMARK) {
+        bool success = RunBenchmark(options, fileIn, fileOut);
 
-        distinctKeys = (size_t*)malloc(numDates * sizeof(size_t));
-        if (distinctKeys == NULL) {
-            return -1;
+        fclose(fileOut);
+        fclose(fileIn);
+
+        return success ? 0 : -1;
+    }
+
+    if (options->engine == DISTINCT_ENGINE_EXTERNAL) {
+        // Ingestion, sorting and merging are interleaved, so the whole run is one stage
+        uint64_t start = MonotonicNanoseconds();
+        bool success = WriteDistinctDateTimesExternal(fileIn, fileOut, options->memoryBudget);
+        StatsAddStageTime(PIPELINE_STAGE_INGEST, start);
+
+        fclose(fileOut);
+        fclose(fileIn);
+
+        return (WritePipelineStats(options->statsPath) && success) ? 0 : -1;
+    }
+
+    if (options->engine == DISTINCT_ENGINE_MERGE) {
+        // Parsing, sorting and merging are interleaved, so the whole run is one stage
+        size_t pathCount = 0;
+        const char* const* paths = InputPaths(options, &pathCount);
+        uint64_t start = MonotonicNanoseconds();
+        bool success = WriteDistinctDateTimesMerged(paths, pathCount, options->granularity, options->memoryBudget, fileOut);
+        StatsAddStageTime(PIPELINE_STAGE_INGEST, start);
+        if (!success) {
+            fprintf(stderr, "Couldn't merge the input files\n");
         }
 
-        if (DistinctDateTimes(datesBuffer, numDates, distinctKeys, &numDistinctKeys)) {
-            for (size_t i = 0; i < numDistinctKeys; i++) {
-                FPrintDateTime(fileOut, &datesBuffer[distinctKeys[i]]);
-            }
+        fclose(fileOut);
+        fclose(fileIn);
+
+        return (WritePipelineStats(options->statsPath) && success) ? 0 : -1;
+    }
+
+    if (options->engine == DISTINCT_ENGINE_HLL) {
+        bool success = CountDistinctDateTimes(options, fileIn, fileOut);
+
+        fclose(fileOut);
+        fclose(fileIn);
+
+        return (WritePipelineStats(options->statsPath) && success) ? 0 : -1;
+    }
+
+    // A sorted cache is already in output order, so sorting and the engine can be skipped
+    if (options->ingestMode == INGEST_MODE_CACHE && options->saveCachePath == NULL && options->appendIndexPath == NULL
+        && options->saveRangeIndexPath == NULL && !options->counts) {
+        DateCacheHeader header;
+        size_t mappingSize = 0;
+        const char* mapping = MapDateCache(fileIn, &header, &mappingSize);
+
+        if (mapping && (header.flags & DATE_CACHE_SORTED)) {
+            uint64_t start = MonotonicNanoseconds();
+            bool success = WriteDistinctDateTimesSortedCache(&header, (const uint64_t*)(mapping + sizeof(DateCacheHeader)), options->granularity, fileOut);
+            StatsAddStageTime(PIPELINE_STAGE_WRITE, start);
+
+            munmap((void*)mapping, mappingSize);
+            fclose(fileOut);
+            fclose(fileIn);
+
+            return (WritePipelineStats(options->statsPath) && success) ? 0 : -1;
         }
 
-        free(distinctKeys);
+        if (mapping) {
+            munmap((void*)mapping, mappingSize);
+        }
     }
 
-    free(datesBuffer);
+    Arena arena;
+    size_t datesBufferSize = 0;
+    DateTime* datesBuffer = ReserveIngestArena(options, &arena, fileIn, &datesBufferSize);
+    size_t numDates = 0;
+
+    uint64_t start = MonotonicNanoseconds();
+    if (!IngestDateTimesWithOptions(options, &datesBuffer, &datesBufferSize, fileIn, &numDates)) {
+        fputs((options->ingestMode == INGEST_MODE_CACHE) ? "Couldn't read the input as a valid date cache\n" : "Couldn't read the input\n", stderr);
+        if (arena.base == NULL) {
+            free(datesBuffer);
+        }
+        ArenaFree(&arena);
+        fclose(fileOut);
+        fclose(fileIn);
+
+        return -1;
+    }
+    StatsAddStageTime(PIPELINE_STAGE_INGEST, start);
+
+    bool cacheSaved = true;
+    if (options->saveCachePath != NULL) {
+        FILE* cacheFile = fopen(options->saveCachePath, "wb");
+        cacheSaved = cacheFile != NULL && WriteDateCache(cacheFile, datesBuffer, numDates);
+        if (cacheFile != NULL) {
+            cacheSaved = (fclose(cacheFile) == 0) && cacheSaved;
+        }
+    }
+
+    bool rangeIndexSaved = true;
+    if (options->saveRangeIndexPath != NULL) {
+        rangeIndexSaved = SaveRangeIndex(options->saveRangeIndexPath, datesBuffer, numDates);
+    }
+
+    // The cache and range index keep full resolution, so they are saved before truncating
+    start = MonotonicNanoseconds();
+    TruncateDateTimes(datesBuffer, numDates, options->granularity);
+    StatsAddStageTime(PIPELINE_STAGE_INGEST, start);
+
+    bool written = true;
+    if (options->appendIndexPath != NULL) {
+        written = AppendDistinctDateTimes(options, datesBuffer, numDates, fileOut);
+    }
+    else if (numDates > 0) {
+        written = WriteDistinctDateTimes(options, &arena, datesBuffer, numDates, fileOut);
+    }
+
+    if (arena.base == NULL) {
+        free(datesBuffer);
+    }
+    ArenaFree(&arena);
     
-    fclose(fileOut);
+    written = (fclose(fileOut) == 0) && written;
     fclose(fileIn);
 
-    return 0;
-}
\ No newline at end of file
+    if (!written) {
+        fprintf(stderr, "Couldn't write the distinct dates\n");
+    }
+
+    return (WritePipelineStats(options->statsPath) && cacheSaved && rangeIndexSaved && written) ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    int status = -1;
+    if (ParseOptions(argc, argv, &options)) {
+        status = RunProgram(&options);
+    }
+    else {
+        PrintUsage(argv[0]);
+    }
+
+    FreeOptions(&options);
+    return status;
+}